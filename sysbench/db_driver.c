@@ -33,7 +33,8 @@
 
 #include "db_driver.h"
 #include "sb_list.h"
-#include "sb_percentile.h"
+#include "sb_atomic.h"
+#include "sb_output.h"
 
 /* Query length limit for bulk insert queries */
 #define BULK_PACKET_SIZE (512*1024)
@@ -41,24 +42,36 @@
 /* How many rows to insert before COMMITs (used in bulk insert) */
 #define ROWS_BEFORE_COMMIT 1000
 
+/* Database statistics counters */
 typedef struct {
-  unsigned long   read_ops;
-  unsigned long   write_ops;
-  unsigned long   other_ops;
-  unsigned long   transactions;
-  unsigned long   deadlocks;
-  pthread_mutex_t stat_mutex;
+  unsigned long long queries[DB_QUERY_TYPE_MAX];
+  unsigned long long rows[DB_QUERY_TYPE_MAX];   /* rows in result sets */
+  unsigned long long errors[DB_QUERY_TYPE_MAX];
+  unsigned long long transactions;
+  unsigned long long deadlocks;
+} db_stats_t;
+
+/* Number of counters in db_stats_t */
+#define DB_STATS_COUNTERS (sizeof(db_stats_t) / sizeof(unsigned long long))
+
+/*
+  Per-thread statistics. Counters only grow and are only written by the owning
+  thread, so they are updated with relaxed atomic stores rather than locks.
+  Reports subtract totals saved on the previous report or reset. Slots are
+  padded to avoid false sharing between threads.
+*/
+typedef struct {
+  db_stats_t stats;
+  char       pad[SB_CACHELINE_SIZE];
 } db_thread_stat_t;
 
 /* Global variables */
 db_globals_t db_globals;
 
-sb_percentile_t local_percentile;
-
-/* Used in intermediate reports */
-static unsigned long last_transactions;
-static unsigned long last_read_ops;
-static unsigned long last_write_ops;
+/* Totals at the last reset, used in cumulative reports */
+static db_stats_t stats_base;
+/* Totals at the last intermediate report */
+static db_stats_t stats_last;
 
 /* Static variables */
 static sb_list_t        drivers;          /* list of available DB drivers */
@@ -75,7 +88,10 @@ static void db_free_row(db_row_t *);
 static int db_bulk_do_insert(db_conn_t *, int);
 static db_query_type_t db_get_query_type(const char *);
 static void db_update_thread_stats(int, db_query_type_t);
-static void db_reset_stats(void);
+static void db_update_thread_errors(int, db_query_type_t, db_error_t);
+static void db_update_thread_rows(int, db_query_type_t, unsigned long long);
+static void db_sum_stats(db_stats_t *);
+static void db_reset_stats_to(const db_stats_t *);
 
 /* DB layer arguments */
 
@@ -180,7 +196,6 @@ db_driver_t *db_init(const char *name)
 {
   db_driver_t    *drv = NULL;
   sb_list_item_t *pos;
-  unsigned int   i;
   
   if (SB_LIST_IS_EMPTY(&drivers))
   {
@@ -228,14 +243,11 @@ db_driver_t *db_init(const char *name)
     return NULL;
 
   /* Initialize per-thread stats */
-  thread_stats = (db_thread_stat_t *)malloc(sb_globals.num_threads *
+  thread_stats = (db_thread_stat_t *)calloc(sb_globals.num_threads,
                                             sizeof(db_thread_stat_t));
   if (thread_stats == NULL)
     return NULL;
 
-  for (i = 0; i < sb_globals.num_threads; i++)
-    pthread_mutex_init(&thread_stats[i].stat_mutex, NULL);
-
   /* Initialize timers if in debug mode */
   if (db_globals.debug)
   {
@@ -247,9 +259,6 @@ db_driver_t *db_init(const char *name)
 
   db_reset_stats();
 
-  if (sb_percentile_init(&local_percentile, 100000, 1.0, 1e13))
-    return NULL;
-
   return drv;
 }
 
@@ -386,14 +395,14 @@ db_result_set_t *db_execute(db_stmt_t *stmt)
 
   rs->statement = stmt;
   rs->connection = con;
+  rs->type = stmt->type;
 
   con->db_errno = con->driver->ops.execute(stmt, rs);
   if (con->db_errno != SB_DB_ERROR_NONE)
   {
     log_text(LOG_DEBUG, "ERROR: exiting db_execute(), driver's execute method failed");
 
-    if (con->db_errno == SB_DB_ERROR_DEADLOCK)
-      thread_stats[con->thread_id].deadlocks++;
+    db_update_thread_errors(con->thread_id, stmt->type, con->db_errno);
     
     return NULL;
   }
@@ -461,15 +470,15 @@ db_result_set_t *db_query(db_conn_t *con, const char *query)
   memset(rs, 0, sizeof(db_result_set_t));
   
   rs->connection = con;
+  rs->type = db_get_query_type(query);
 
   con->db_errno = con->driver->ops.query(con, query, rs);
 
   if (con->db_errno == SB_DB_ERROR_NONE)
-    db_update_thread_stats(con->thread_id, db_get_query_type(query));
+    db_update_thread_stats(con->thread_id, rs->type);
   else
   {
-    if (con->db_errno == SB_DB_ERROR_DEADLOCK)
-      thread_stats[con->thread_id].deadlocks++;
+    db_update_thread_errors(con->thread_id, rs->type, con->db_errno);
 
     return NULL;
   }
@@ -538,11 +547,16 @@ int db_close(db_stmt_t *stmt)
 int db_store_results(db_result_set_t *rs)
 {
   db_conn_t *con = rs->connection;
+  int       rc;
 
   if (con == NULL || con->driver == NULL)
     return SB_DB_ERROR_FAILED;
 
-  return con->driver->ops.store_results(rs);
+  rc = con->driver->ops.store_results(rs);
+  if (rc == SB_DB_ERROR_NONE)
+    db_update_thread_rows(con->thread_id, rs->type, rs->nrows);
+
+  return rc;
 }
 
 
@@ -557,15 +571,8 @@ int db_done(db_driver_t *drv)
     free(fetch_timers);
   }
   
-  if (thread_stats != NULL)
-  {
-    unsigned int i;
-    for (i = 0; i < sb_globals.num_threads; i++)
-      pthread_mutex_destroy(&thread_stats[i].stat_mutex);
-    free(thread_stats);
-  }
-
-  sb_percentile_done(&local_percentile);
+  free(thread_stats);
+  thread_stats = NULL;
 
   return drv->ops.done();
 }
@@ -809,74 +816,138 @@ void db_print_stats(sb_stat_t type)
   unsigned int  i;
   sb_timer_t    exec_timer;
   sb_timer_t    fetch_timer;
-  unsigned long read_ops;
-  unsigned long write_ops;
-  unsigned long other_ops;
-  unsigned long transactions;
-  unsigned long deadlocks;
+  db_stats_t    totals;
+  db_stats_t    stats;
+  unsigned long long read_ops;
+  unsigned long long write_ops;
+  unsigned long long other_ops;
+  unsigned long long errors;
+  char          pct_buf[256];
+  double        pct_values[MAX_PERCENTILES];
+  double        pct_max;
+  sb_output_record_t rec;
+  static const char *query_types[DB_QUERY_TYPE_MAX] =
+    {"read", "write", "commit", "other"};
 
   /* Summarize per-thread counters */
-  read_ops = write_ops = other_ops = transactions = deadlocks = 0;
-  for (i = 0; i < sb_globals.num_threads; i++)
-  {
-    pthread_mutex_lock(&thread_stats[i].stat_mutex);
-    read_ops += thread_stats[i].read_ops;
-    write_ops += thread_stats[i].write_ops;
-    other_ops += thread_stats[i].other_ops;
-    transactions += thread_stats[i].transactions;
-    deadlocks += thread_stats[i].deadlocks;
-    pthread_mutex_unlock(&thread_stats[i].stat_mutex);
-  }
+  db_sum_stats(&totals);
 
   if (type == SB_STAT_INTERMEDIATE)
   {
     seconds = NS2SEC(sb_timer_split(&sb_globals.exec_timer));
 
-    log_timestamp(LOG_NOTICE, &sb_globals.exec_timer,
-                  "threads: %d, tps: %4.2f, reads/s: %4.2f, writes/s: %4.2f "
-                  "response time: %4.2fms (%u%%)",
-                  sb_globals.num_threads,
-                  (transactions - last_transactions) / seconds,
-                  (read_ops - last_read_ops) / seconds,
-                  (write_ops - last_write_ops) / seconds,
-                  NS2MS(sb_percentile_calculate(&local_percentile,
-                                                sb_globals.percentile_rank)),
-                  sb_globals.percentile_rank);
-
     SB_THREAD_MUTEX_LOCK();
-    last_transactions = transactions;
-    last_read_ops = read_ops;
-    last_write_ops = write_ops;
+    for (i = 0; i < DB_STATS_COUNTERS; i++)
+      ((unsigned long long *) &stats)[i] =
+        ((unsigned long long *) &totals)[i] -
+        ((unsigned long long *) &stats_last)[i];
+    stats_last = totals;
     SB_THREAD_MUTEX_UNLOCK();
 
-    sb_percentile_reset(&local_percentile);
+    read_ops = stats.queries[DB_QUERY_TYPE_READ];
+    write_ops = stats.queries[DB_QUERY_TYPE_WRITE];
+    errors = 0;
+    for (i = 0; i < DB_QUERY_TYPE_MAX; i++)
+      errors += stats.errors[i];
+
+    log_get_interval_percentiles(pct_values, &pct_max);
+
+    log_timestamp(LOG_NOTICE, &sb_globals.exec_timer,
+                  "threads: %d, tps: %4.2f, reads/s: %4.2f, writes/s: %4.2f "
+                  "errors/s: %4.2f response time: %s",
+                  sb_globals.num_threads,
+                  stats.transactions / seconds,
+                  read_ops / seconds,
+                  write_ops / seconds,
+                  errors / seconds,
+                  log_format_percentiles(pct_values, pct_max, pct_buf,
+                                         sizeof(pct_buf)));
+
+    if (SB_OUTPUT_ENABLED())
+    {
+      sb_output_begin(&rec, type, "db");
+      sb_output_add(&rec, "threads", sb_globals.num_threads);
+      sb_output_add(&rec, "tps", stats.transactions / seconds);
+      sb_output_add(&rec, "reads_per_sec", read_ops / seconds);
+      sb_output_add(&rec, "writes_per_sec", write_ops / seconds);
+      sb_output_add(&rec, "errors_per_sec", errors / seconds);
+      sb_output_add_percentiles(&rec, "latency", pct_values, pct_max);
+      sb_output_write(&rec);
+    }
 
     return;
   }
   else if (type != SB_STAT_CUMULATIVE)
     return;
 
+  for (i = 0; i < DB_STATS_COUNTERS; i++)
+    ((unsigned long long *) &stats)[i] =
+      ((unsigned long long *) &totals)[i] -
+      ((unsigned long long *) &stats_base)[i];
+
+  read_ops = stats.queries[DB_QUERY_TYPE_READ];
+  write_ops = stats.queries[DB_QUERY_TYPE_WRITE];
+  other_ops = stats.queries[DB_QUERY_TYPE_COMMIT] +
+    stats.queries[DB_QUERY_TYPE_OTHER];
+  errors = 0;
+  for (i = 0; i < DB_QUERY_TYPE_MAX; i++)
+    errors += stats.errors[i];
+
   seconds = NS2SEC(sb_timer_split(&sb_globals.cumulative_timer1));
 
   log_text(LOG_NOTICE, "OLTP test statistics:");
   log_text(LOG_NOTICE, "    queries performed:");
-  log_text(LOG_NOTICE, "        read:                            %d",
+  log_text(LOG_NOTICE, "        read:                            %llu",
            read_ops);
-  log_text(LOG_NOTICE, "        write:                           %d",
+  log_text(LOG_NOTICE, "        write:                           %llu",
            write_ops);
-  log_text(LOG_NOTICE, "        other:                           %d",
+  log_text(LOG_NOTICE, "        other:                           %llu",
            other_ops);
-  log_text(LOG_NOTICE, "        total:                           %d",
+  log_text(LOG_NOTICE, "        total:                           %llu",
            read_ops + write_ops + other_ops);
-  log_text(LOG_NOTICE, "    transactions:                        %-6d"
-           " (%.2f per sec.)", transactions, transactions / seconds);
-  log_text(LOG_NOTICE, "    deadlocks:                           %-6d"
-           " (%.2f per sec.)", deadlocks, deadlocks / seconds);
-  log_text(LOG_NOTICE, "    read/write requests:                 %-6d"
+  log_text(LOG_NOTICE, "    transactions:                        %-6llu"
+           " (%.2f per sec.)", stats.transactions,
+           stats.transactions / seconds);
+  log_text(LOG_NOTICE, "    deadlocks:                           %-6llu"
+           " (%.2f per sec.)", stats.deadlocks, stats.deadlocks / seconds);
+  log_text(LOG_NOTICE, "    errors:                              %-6llu"
+           " (%.2f per sec.)", errors, errors / seconds);
+  log_text(LOG_NOTICE, "    read/write requests:                 %-6llu"
            " (%.2f per sec.)", read_ops + write_ops,
            (read_ops + write_ops) / seconds);  
-  log_text(LOG_NOTICE, "    other operations:                    %-6d"
+  log_text(LOG_NOTICE, "    other operations:                    %-6llu"
            " (%.2f per sec.)", other_ops, other_ops / seconds);
+  log_text(LOG_NOTICE, "    per query type:          queries        rows"
+           "      errors");
+  for (i = 0; i < DB_QUERY_TYPE_MAX; i++)
+    log_text(LOG_NOTICE, "        %-16s %12llu %11llu %11llu",
+             query_types[i], stats.queries[i], stats.rows[i],
+             stats.errors[i]);
+
+  if (SB_OUTPUT_ENABLED())
+  {
+    sb_output_begin(&rec, type, "db");
+    sb_output_add(&rec, "reads", read_ops);
+    sb_output_add(&rec, "writes", write_ops);
+    sb_output_add(&rec, "other", other_ops);
+    sb_output_add(&rec, "transactions", stats.transactions);
+    sb_output_add(&rec, "tps", stats.transactions / seconds);
+    sb_output_add(&rec, "deadlocks", stats.deadlocks);
+    sb_output_add(&rec, "errors", errors);
+    sb_output_add(&rec, "rw_requests_per_sec",
+                  (read_ops + write_ops) / seconds);
+    sb_output_add(&rec, "other_per_sec", other_ops / seconds);
+    for (i = 0; i < DB_QUERY_TYPE_MAX; i++)
+    {
+      char name[32];
+
+      snprintf(name, sizeof(name), "%s_rows", query_types[i]);
+      sb_output_add(&rec, name, stats.rows[i]);
+      snprintf(name, sizeof(name), "%s_errors", query_types[i]);
+      sb_output_add(&rec, name, stats.errors[i]);
+    }
+    sb_output_write(&rec);
+  }
 
   if (db_globals.debug)
   {
@@ -911,7 +982,8 @@ void db_print_stats(sb_stat_t type)
              NS2SEC(get_sum_time(&fetch_timer)));
   }
 
-  db_reset_stats();
+  /* Start the next period from the totals reported above */
+  db_reset_stats_to(&totals);
 }
 
 /* Get query type */
@@ -937,53 +1009,97 @@ db_query_type_t db_get_query_type(const char *query)
   return DB_QUERY_TYPE_OTHER;
 }
 
+/* Increment a counter of the calling thread */
+
+static inline void db_stat_add(unsigned long long *counter,
+                               unsigned long long n)
+{
+  /* Only the owning thread writes, no read-modify-write atomicity needed */
+  sb_atomic_store_u64(counter, sb_atomic_load_u64(counter) + n);
+}
+
 /* Update stats according to type */
 
 void db_update_thread_stats(int id, db_query_type_t type)
 {
+  db_stats_t *stats;
+
   if (id < 0)
     return;
 
-  pthread_mutex_lock(&thread_stats[id].stat_mutex);
-
-  switch (type)
+  if (type >= DB_QUERY_TYPE_MAX)
   {
-    case DB_QUERY_TYPE_READ:
-      thread_stats[id].read_ops++;
-      break;
-    case DB_QUERY_TYPE_WRITE:
-      thread_stats[id].write_ops++;
-      break;
-    case DB_QUERY_TYPE_COMMIT:
-      thread_stats[id].other_ops++;
-      thread_stats[id].transactions++;
-      break;
-    case DB_QUERY_TYPE_OTHER:
-      thread_stats[id].other_ops++;
-      break;
-    default:
-      log_text(LOG_WARNING, "Unknown query type: %d", type);
+    log_text(LOG_WARNING, "Unknown query type: %d", type);
+    return;
   }
 
-  pthread_mutex_unlock(&thread_stats[id].stat_mutex);
+  stats = &thread_stats[id].stats;
+  db_stat_add(&stats->queries[type], 1);
+  if (type == DB_QUERY_TYPE_COMMIT)
+    db_stat_add(&stats->transactions, 1);
 }
 
-static void db_reset_stats(void)
+/* Account a failed query */
+
+void db_update_thread_errors(int id, db_query_type_t type, db_error_t err)
 {
-  unsigned int i;
+  db_stats_t *stats;
+
+  if (id < 0 || type >= DB_QUERY_TYPE_MAX)
+    return;
+
+  stats = &thread_stats[id].stats;
+  db_stat_add(&stats->errors[type], 1);
+  if (err == SB_DB_ERROR_DEADLOCK)
+    db_stat_add(&stats->deadlocks, 1);
+}
+
+/* Account rows of a stored result set */
 
-  for(i = 0; i < sb_globals.num_threads; i++)
+void db_update_thread_rows(int id, db_query_type_t type,
+                           unsigned long long nrows)
+{
+  if (id < 0 || type >= DB_QUERY_TYPE_MAX)
+    return;
+
+  db_stat_add(&thread_stats[id].stats.rows[type], nrows);
+}
+
+/* Sum counters of all threads */
+
+void db_sum_stats(db_stats_t *sum)
+{
+  unsigned long long *to = (unsigned long long *) sum;
+  unsigned long long *from;
+  unsigned int       i, j;
+
+  memset(sum, 0, sizeof(db_stats_t));
+  for (i = 0; i < sb_globals.num_threads; i++)
   {
-    thread_stats[i].read_ops = 0;
-    thread_stats[i].write_ops = 0;
-    thread_stats[i].other_ops = 0;
-    thread_stats[i].transactions = 0;
-    thread_stats[i].deadlocks = 0;
+    from = (unsigned long long *) &thread_stats[i].stats;
+    for (j = 0; j < DB_STATS_COUNTERS; j++)
+      to[j] += sb_atomic_load_u64(from + j);
   }
+}
+
+/* Reset database-specific test stats */
+
+void db_reset_stats(void)
+{
+  db_stats_t totals;
+
+  db_sum_stats(&totals);
+  db_reset_stats_to(&totals);
+}
+
+/* Start a new statistics period from the specified totals */
+
+void db_reset_stats_to(const db_stats_t *totals)
+{
+  unsigned int i;
 
-  last_transactions = 0;
-  last_read_ops = 0;
-  last_write_ops = 0;
+  stats_base = *totals;
+  stats_last = *totals;
 
   /*
     So that intermediate stats are calculated from the current moment
@@ -24,7 +24,6 @@
 
 #include "sysbench.h"
 #include "sb_list.h"
-#include "sb_percentile.h"
 
 
 /* Prepared statements usage modes */
@@ -46,8 +45,6 @@ typedef struct
 
 extern db_globals_t db_globals;
 
-extern sb_percentile_t local_percentile;
-
 /* Driver capabilities definition */
 
 typedef struct
@@ -180,6 +177,14 @@ typedef enum {
   DB_CONN_TYPE_MYSQL
 } db_conn_type_t;
 
+typedef enum {
+  DB_QUERY_TYPE_READ,
+  DB_QUERY_TYPE_WRITE,
+  DB_QUERY_TYPE_COMMIT,
+  DB_QUERY_TYPE_OTHER,
+  DB_QUERY_TYPE_MAX
+} db_query_type_t;
+
 /* Result set definition */
 
 typedef struct db_result_set
@@ -190,6 +195,7 @@ typedef struct db_result_set
   struct db_row  *row;        /* Last row fetched by db_fetch_row */
   void           *ptr;        /* Pointer to driver-specific data */
   unsigned long long nrows;   /* Number of rows in a result set */
+  db_query_type_t type;       /* Type of the query for this result set */
 } db_result_set_t;
 
 /* Database connection structure */
@@ -214,13 +220,6 @@ typedef struct db_conn
   db_result_set_t rs;                /* Result set */
 } db_conn_t;
 
-typedef enum {
-  DB_QUERY_TYPE_READ,
-  DB_QUERY_TYPE_WRITE,
-  DB_QUERY_TYPE_COMMIT,
-  DB_QUERY_TYPE_OTHER
-} db_query_type_t;
-
 /* Prepared statement definition */
 
 typedef struct db_stmt
@@ -296,6 +295,9 @@ void db_bulk_insert_done(db_conn_t *);
 /* Print database-specific test stats */
 void db_print_stats(sb_stat_t type);
 
+/* Reset database-specific test stats */
+void db_reset_stats(void);
+
 /* Associate connection with a thread (required only for statistics */
 void db_set_thread(db_conn_t *, int);
 
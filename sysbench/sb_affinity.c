@@ -0,0 +1,371 @@
+/* Copyright (C) 2011 Alexey Kopytov.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+#ifdef _WIN32
+#include "sb_win.h"
+#endif
+
+#ifdef STDC_HEADERS
+# include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+# include <string.h>
+#endif
+#ifdef HAVE_ERRNO_H
+# include <errno.h>
+#endif
+#ifdef HAVE_SCHED_H
+# include <sched.h>
+#endif
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
+#ifdef HAVE_LIBNUMA
+# include <numa.h>
+#endif
+
+#include "sysbench.h"
+#include "sb_affinity.h"
+#include "sb_logger.h"
+#include "sb_options.h"
+
+/* Maximum number of NUMA nodes supported */
+#define SB_MAX_NODES 256
+
+static sb_affinity_mode_t affinity_mode;
+static char               *affinity_str;
+static sb_numa_policy_t   numa_policy;
+static char               *numa_str;
+
+/* CPUs available to the process ordered by NUMA node, and their nodes */
+static int                *cpus;
+static int                *cpu_nodes;
+static unsigned int       ncpus;
+
+/* NUMA nodes having available CPUs, with indexes of their first CPUs */
+static int                nodes[SB_MAX_NODES];
+static unsigned int       node_first[SB_MAX_NODES];
+static unsigned int       node_ncpus[SB_MAX_NODES];
+static unsigned int       nnodes;
+
+/* CPUs specified with an explicit list */
+static int                *cpu_list;
+static unsigned int       ncpu_list;
+
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+static int discover_cpus(void);
+static int parse_cpu_list(const char *str);
+#endif
+
+
+int sb_affinity_init(void)
+{
+  affinity_str = sb_get_value_string("thread-affinity");
+  if (!strcmp(affinity_str, "none"))
+    affinity_mode = SB_AFFINITY_NONE;
+  else if (!strcmp(affinity_str, "compact"))
+    affinity_mode = SB_AFFINITY_COMPACT;
+  else if (!strcmp(affinity_str, "scatter"))
+    affinity_mode = SB_AFFINITY_SCATTER;
+  else if (!strcmp(affinity_str, "node"))
+    affinity_mode = SB_AFFINITY_NODE;
+  else
+    affinity_mode = SB_AFFINITY_LIST;
+
+  numa_str = sb_get_value_string("numa-policy");
+  if (!strcmp(numa_str, "default"))
+    numa_policy = SB_NUMA_DEFAULT;
+  else if (!strcmp(numa_str, "local"))
+    numa_policy = SB_NUMA_LOCAL;
+  else if (!strcmp(numa_str, "interleave"))
+    numa_policy = SB_NUMA_INTERLEAVE;
+  else if (!strcmp(numa_str, "bind"))
+    numa_policy = SB_NUMA_BIND;
+  else
+  {
+    log_text(LOG_FATAL, "Invalid NUMA policy: %s.", numa_str);
+    return 1;
+  }
+
+#ifdef HAVE_LIBNUMA
+  if (numa_policy != SB_NUMA_DEFAULT && numa_available() < 0)
+  {
+    log_text(LOG_FATAL, "NUMA is not supported by the system");
+    return 1;
+  }
+#else
+  if (numa_policy != SB_NUMA_DEFAULT)
+  {
+    log_text(LOG_FATAL, "--numa-policy requires sysbench built with libnuma");
+    return 1;
+  }
+#endif
+
+  if (affinity_mode == SB_AFFINITY_NONE && numa_policy != SB_NUMA_BIND)
+    return 0;
+
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+  if (discover_cpus())
+    return 1;
+
+  if (affinity_mode == SB_AFFINITY_LIST && parse_cpu_list(affinity_str))
+    return 1;
+
+  return 0;
+#else
+  log_text(LOG_FATAL, "Thread affinity is not supported on this platform");
+  return 1;
+#endif
+}
+
+
+void sb_affinity_print_mode(void)
+{
+  if (affinity_mode != SB_AFFINITY_NONE)
+    log_text(LOG_NOTICE, "Thread affinity: %s (%u CPUs in %u NUMA nodes)",
+             affinity_str, ncpus, nnodes);
+  if (numa_policy != SB_NUMA_DEFAULT)
+    log_text(LOG_NOTICE, "NUMA memory policy: %s", numa_str);
+}
+
+
+int sb_affinity_thread_init(int thread_id)
+{
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+  cpu_set_t    set;
+  unsigned int i, n;
+  int          node = -1;
+  int          rc;
+
+  if (affinity_mode == SB_AFFINITY_NONE && numa_policy != SB_NUMA_BIND)
+    return 0;
+
+  CPU_ZERO(&set);
+
+  switch (affinity_mode) {
+    case SB_AFFINITY_COMPACT:
+      i = thread_id % ncpus;
+      CPU_SET(cpus[i], &set);
+      node = cpu_nodes[i];
+      break;
+    case SB_AFFINITY_SCATTER:
+      n = thread_id % nnodes;
+      i = node_first[n] + (thread_id / nnodes) % node_ncpus[n];
+      CPU_SET(cpus[i], &set);
+      node = nodes[n];
+      break;
+    case SB_AFFINITY_LIST:
+      CPU_SET(cpu_list[thread_id % ncpu_list], &set);
+      for (i = 0; i < ncpus; i++)
+        if (cpus[i] == cpu_list[thread_id % ncpu_list])
+          node = cpu_nodes[i];
+      break;
+    case SB_AFFINITY_NODE:
+    case SB_AFFINITY_NONE:
+      /* Threads are distributed across nodes, but not pinned to CPUs */
+      n = thread_id % nnodes;
+      for (i = node_first[n]; i < node_first[n] + node_ncpus[n]; i++)
+        CPU_SET(cpus[i], &set);
+      node = nodes[n];
+      break;
+  }
+
+  if ((rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) != 0)
+  {
+    errno = rc;
+    log_errno(LOG_FATAL, "pthread_setaffinity_np() failed for thread #%d",
+              thread_id);
+    return 1;
+  }
+#else
+  int node = -1;
+
+  if (affinity_mode == SB_AFFINITY_NONE && numa_policy != SB_NUMA_BIND)
+    return 0;
+#endif
+
+#ifdef HAVE_LIBNUMA
+  switch (numa_policy) {
+    case SB_NUMA_LOCAL:
+      numa_set_localalloc();
+      break;
+    case SB_NUMA_INTERLEAVE:
+      numa_set_interleave_mask(numa_all_nodes_ptr);
+      break;
+    case SB_NUMA_BIND:
+      if (node >= 0)
+      {
+        struct bitmask *mask = numa_allocate_nodemask();
+
+        numa_bitmask_setbit(mask, node);
+        numa_set_membind(mask);
+        numa_bitmask_free(mask);
+      }
+      break;
+    case SB_NUMA_DEFAULT:
+      break;
+  }
+#endif
+
+  (void) node; /* unused without libnuma */
+
+  return 0;
+}
+
+
+void sb_affinity_done(void)
+{
+  free(cpus);
+  free(cpu_nodes);
+  free(cpu_list);
+  cpus = cpu_nodes = cpu_list = NULL;
+  ncpus = ncpu_list = nnodes = 0;
+}
+
+
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+/* Get the CPUs available to the process and group them by NUMA nodes */
+
+
+int discover_cpus(void)
+{
+  cpu_set_t    set;
+  unsigned int i, j;
+  int          cpu, node;
+
+  if (sched_getaffinity(0, sizeof(set), &set))
+  {
+    log_errno(LOG_FATAL, "sched_getaffinity() failed");
+    return 1;
+  }
+
+  cpus = (int *)malloc(CPU_SETSIZE * sizeof(int));
+  cpu_nodes = (int *)malloc(CPU_SETSIZE * sizeof(int));
+  if (cpus == NULL || cpu_nodes == NULL)
+  {
+    log_text(LOG_FATAL, "Memory allocation failure.");
+    return 1;
+  }
+
+  /* Insertion sort by (node, cpu) */
+  for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+  {
+    if (!CPU_ISSET(cpu, &set))
+      continue;
+
+    node = 0;
+#ifdef HAVE_LIBNUMA
+    if (numa_available() >= 0 && (node = numa_node_of_cpu(cpu)) < 0)
+      node = 0;
+#endif
+    if (node >= SB_MAX_NODES)
+      node = SB_MAX_NODES - 1;
+
+    for (i = ncpus; i > 0 && cpu_nodes[i - 1] > node; i--)
+    {
+      cpus[i] = cpus[i - 1];
+      cpu_nodes[i] = cpu_nodes[i - 1];
+    }
+    cpus[i] = cpu;
+    cpu_nodes[i] = node;
+    ncpus++;
+  }
+
+  if (ncpus == 0)
+  {
+    log_text(LOG_FATAL, "No CPUs available for thread affinity");
+    return 1;
+  }
+
+  for (i = 0; i < ncpus; i = j)
+  {
+    for (j = i; j < ncpus && cpu_nodes[j] == cpu_nodes[i]; j++)
+      ;
+    nodes[nnodes] = cpu_nodes[i];
+    node_first[nnodes] = i;
+    node_ncpus[nnodes] = j - i;
+    nnodes++;
+  }
+
+  return 0;
+}
+
+
+/* Parse a list of CPUs in the "0-3,8,10-11" format */
+
+
+int parse_cpu_list(const char *str)
+{
+  const char   *p = str;
+  char         *end;
+  long         first, last, cpu;
+  unsigned int i;
+
+  cpu_list = (int *)malloc(CPU_SETSIZE * sizeof(int));
+  if (cpu_list == NULL)
+  {
+    log_text(LOG_FATAL, "Memory allocation failure.");
+    return 1;
+  }
+
+  while (*p != '\0')
+  {
+    first = strtol(p, &end, 10);
+    if (end == p || first < 0)
+      goto error;
+    last = first;
+    if (*end == '-')
+    {
+      p = end + 1;
+      last = strtol(p, &end, 10);
+      if (end == p || last < first)
+        goto error;
+    }
+    if (last >= CPU_SETSIZE)
+      goto error;
+
+    for (cpu = first; cpu <= last; cpu++)
+    {
+      for (i = 0; i < ncpus && cpus[i] != cpu; i++)
+        ;
+      if (i == ncpus)
+      {
+        log_text(LOG_FATAL, "CPU %ld is not available", cpu);
+        return 1;
+      }
+      if (ncpu_list < CPU_SETSIZE)
+        cpu_list[ncpu_list++] = (int) cpu;
+    }
+
+    if (*end == ',')
+      end++;
+    else if (*end != '\0')
+      goto error;
+    p = end;
+  }
+
+  if (ncpu_list > 0)
+    return 0;
+
+ error:
+  log_text(LOG_FATAL, "Invalid value of --thread-affinity: %s", str);
+  return 1;
+}
+#endif /* HAVE_PTHREAD_SETAFFINITY_NP */
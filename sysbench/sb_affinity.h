@@ -0,0 +1,54 @@
+/* Copyright (C) 2011 Alexey Kopytov.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef SB_AFFINITY_H
+#define SB_AFFINITY_H
+
+/* Placement of worker threads on CPUs */
+typedef enum
+{
+  SB_AFFINITY_NONE,         /* leave scheduling to the OS */
+  SB_AFFINITY_COMPACT,      /* fill CPUs of one NUMA node before the next */
+  SB_AFFINITY_SCATTER,      /* distribute threads across NUMA nodes */
+  SB_AFFINITY_NODE,         /* bind each thread to all CPUs of a NUMA node */
+  SB_AFFINITY_LIST          /* explicit list of CPUs */
+} sb_affinity_mode_t;
+
+/* Memory allocation policy of worker threads */
+typedef enum
+{
+  SB_NUMA_DEFAULT,          /* leave memory placement to the OS */
+  SB_NUMA_LOCAL,            /* allocate on the node of the running CPU */
+  SB_NUMA_INTERLEAVE,       /* interleave allocations across all nodes */
+  SB_NUMA_BIND              /* only allocate on the node of the thread */
+} sb_numa_policy_t;
+
+/* Parse --thread-affinity and --numa-policy, discover CPU topology */
+int sb_affinity_init(void);
+
+void sb_affinity_print_mode(void);
+
+/*
+  Apply CPU affinity and memory policy to the calling worker thread. Must be
+  called before the thread allocates its per-thread buffers, so that they are
+  placed according to the policy on first touch.
+*/
+int sb_affinity_thread_init(int thread_id);
+
+void sb_affinity_done(void);
+
+#endif /* SB_AFFINITY_H */
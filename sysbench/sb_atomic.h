@@ -0,0 +1,171 @@
+/* Copyright (C) 2011 Alexey Kopytov.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef SB_ATOMIC_H
+#define SB_ATOMIC_H
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#ifdef _WIN32
+# include "sb_win.h"
+#endif
+
+/*
+  Minimal set of atomic operations used to collect statistics without
+  locking. Unless stated otherwise, operations have relaxed memory ordering,
+  i.e. they only guarantee that values are never torn.
+*/
+
+#ifdef _WIN32
+
+static inline unsigned long long sb_atomic_load_u64(unsigned long long *ptr)
+{
+  return (unsigned long long) InterlockedCompareExchange64((volatile LONGLONG *) ptr, 0, 0);
+}
+
+static inline void sb_atomic_store_u64(unsigned long long *ptr,
+                                       unsigned long long val)
+{
+  InterlockedExchange64((volatile LONGLONG *) ptr, (LONGLONG) val);
+}
+
+/* Atomically add 'val' to '*ptr', return the previous value */
+static inline unsigned long long sb_atomic_add_u64(unsigned long long *ptr,
+                                                   unsigned long long val)
+{
+  return (unsigned long long) InterlockedExchangeAdd64((volatile LONGLONG *) ptr,
+                                                       (LONGLONG) val);
+}
+
+/* Atomically replace '*ptr' with 'val', return the previous value */
+static inline unsigned long long sb_atomic_exchange_u64(unsigned long long *ptr,
+                                                        unsigned long long val)
+{
+  return (unsigned long long) InterlockedExchange64((volatile LONGLONG *) ptr,
+                                                    (LONGLONG) val);
+}
+
+static inline unsigned long long
+sb_atomic_load_u64_acquire(unsigned long long *ptr)
+{
+  return sb_atomic_load_u64(ptr);
+}
+
+static inline void sb_atomic_store_u64_release(unsigned long long *ptr,
+                                               unsigned long long val)
+{
+  sb_atomic_store_u64(ptr, val);
+}
+
+/*
+  If '*ptr' equals '*expected', replace it with 'val' and return 1. Otherwise
+  store the current value in '*expected' and return 0.
+*/
+static inline int sb_atomic_cas_u64(unsigned long long *ptr,
+                                    unsigned long long *expected,
+                                    unsigned long long val)
+{
+  unsigned long long prev = (unsigned long long)
+    InterlockedCompareExchange64((volatile LONGLONG *) ptr, (LONGLONG) val,
+                                 (LONGLONG) *expected);
+
+  if (prev == *expected)
+    return 1;
+  *expected = prev;
+  return 0;
+}
+
+static inline void *sb_atomic_load_ptr_acquire(void **ptr)
+{
+  return InterlockedCompareExchangePointer((PVOID volatile *) ptr, NULL, NULL);
+}
+
+static inline void sb_atomic_store_ptr_release(void **ptr, void *val)
+{
+  InterlockedExchangePointer((PVOID volatile *) ptr, val);
+}
+
+#else /* !_WIN32 */
+
+static inline unsigned long long sb_atomic_load_u64(unsigned long long *ptr)
+{
+  return __atomic_load_n(ptr, __ATOMIC_RELAXED);
+}
+
+static inline void sb_atomic_store_u64(unsigned long long *ptr,
+                                       unsigned long long val)
+{
+  __atomic_store_n(ptr, val, __ATOMIC_RELAXED);
+}
+
+/* Atomically add 'val' to '*ptr', return the previous value */
+static inline unsigned long long sb_atomic_add_u64(unsigned long long *ptr,
+                                                   unsigned long long val)
+{
+  return __atomic_fetch_add(ptr, val, __ATOMIC_RELAXED);
+}
+
+/* Atomically replace '*ptr' with 'val', return the previous value */
+static inline unsigned long long sb_atomic_exchange_u64(unsigned long long *ptr,
+                                                        unsigned long long val)
+{
+  return __atomic_exchange_n(ptr, val, __ATOMIC_RELAXED);
+}
+
+/*
+  If '*ptr' equals '*expected', replace it with 'val' and return 1. Otherwise
+  store the current value in '*expected' and return 0.
+*/
+static inline int sb_atomic_cas_u64(unsigned long long *ptr,
+                                    unsigned long long *expected,
+                                    unsigned long long val)
+{
+  return __atomic_compare_exchange_n(ptr, expected, val, 0, __ATOMIC_RELAXED,
+                                     __ATOMIC_RELAXED);
+}
+
+/* Load a 64-bit value with acquire semantics */
+static inline unsigned long long
+sb_atomic_load_u64_acquire(unsigned long long *ptr)
+{
+  return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+/* Store a 64-bit value with release semantics */
+static inline void sb_atomic_store_u64_release(unsigned long long *ptr,
+                                               unsigned long long val)
+{
+  __atomic_store_n(ptr, val, __ATOMIC_RELEASE);
+}
+
+/* Load a pointer with acquire semantics */
+static inline void *sb_atomic_load_ptr_acquire(void **ptr)
+{
+  return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+/* Store a pointer with release semantics */
+static inline void sb_atomic_store_ptr_release(void **ptr, void *val)
+{
+  __atomic_store_n(ptr, val, __ATOMIC_RELEASE);
+}
+
+#endif /* _WIN32 */
+
+#endif /* SB_ATOMIC_H */
@@ -33,21 +33,40 @@
 #ifdef HAVE_MATH_H
 # include <math.h>
 #endif
+#ifdef HAVE_LIMITS_H
+# include <limits.h>
+#endif
 
 #include "sysbench.h"
 #include "sb_list.h"
 #include "sb_logger.h"
+#include "sb_atomic.h"
 #include "sb_percentile.h"
+#include "sb_output.h"
+#include "sb_trace.h"
 
 #define TEXT_BUFFER_SIZE 4096
 #define ERROR_BUFFER_SIZE 256
 
-#define OPER_LOG_GRANULARITY 100000
-#define OPER_LOG_MIN_VALUE   1
 #define OPER_LOG_MAX_VALUE   1E13
 
-/* per-thread timers for response time stats */
-sb_timer_t *timers;
+/*
+  Per-thread event timing slot. Only the owning thread starts and stops its
+  events. Statistics are published with atomic operations and collected by
+  reporting threads with atomic exchange, so that events never take a shared
+  lock. Slots are padded to avoid false sharing between threads.
+*/
+typedef struct
+{
+  sb_time_t          start;       /* start of the current event */
+  unsigned long long events;
+  unsigned long long sum_time;
+  unsigned long long min_time;
+  unsigned long long max_time;
+  char               pad[SB_CACHELINE_SIZE];
+} oper_timer_t;
+
+static oper_timer_t *timers;
 
 /* Array of message handlers (one chain per message type) */
 
@@ -62,14 +81,37 @@ static pthread_mutex_t text_mutex;
 static unsigned int    text_cnt;
 static char            text_buf[TEXT_BUFFER_SIZE];
 
-/* Temporary copy of timers */
+/* Statistics collected from timers by print_global_stats() */
 static sb_timer_t *timers_copy;
 
 /*
-  Mutex protecting timers.
-  TODO: replace with an rwlock (and implement pthread rwlocks for Windows).
+  Per-thread queue wait accounting for the open-loop mode (--tx-rate). Events
+  are timed from their intended start, and the time spent in the dispatcher
+  queue is reported separately from the service time. Sums are collected the
+  same way as statistics in 'timers', other fields are private to the owning
+  thread.
 */
-static pthread_mutex_t timers_mutex;
+typedef struct
+{
+  sb_time_t          origin;      /* intended start of the next event */
+  int                has_origin;  /* non-zero if 'origin' is set */
+  unsigned long long wait;        /* queue wait of the current event */
+  unsigned long long wait_sum;    /* total queue wait time */
+  unsigned long long service_sum; /* total service time */
+  char               pad[SB_CACHELINE_SIZE];
+} oper_wait_t;
+
+static oper_wait_t *waits;
+
+/* file to dump response time histograms to (--histogram-file) */
+static FILE *histogram_file;
+static unsigned int histogram_reports;
+
+static sb_percentile_t wait_percentile;
+static sb_percentile_t service_percentile;
+
+/* Serializes threads collecting statistics, never taken by events */
+static pthread_mutex_t stats_mutex;
 
 static int text_handler_init(void);
 static int text_handler_process(log_msg_t *msg);
@@ -77,6 +119,7 @@ static int text_handler_process(log_msg_t *msg);
 static int oper_handler_init(void);
 static int oper_handler_process(log_msg_t *msg);
 static int oper_handler_done(void);
+static int parse_percentiles(void);
 
 /* Built-in log handlers */
 
@@ -106,6 +149,13 @@ static sb_arg_t oper_handler_args[] =
 {
   {"percentile", "percentile rank of query response times to count",
    SB_ARG_TYPE_INT, "95"},
+  {"percentiles", "list of response time percentiles to report in addition "
+   "to --percentile", SB_ARG_TYPE_LIST, "50,90,95,99,99.9,99.99"},
+  {"histogram-digits", "number of significant decimal digits in response "
+   "time histograms", SB_ARG_TYPE_INT, "2"},
+  {"histogram-file", "dump the full response time distribution in CSV "
+   "format to the specified file on each global statistics report",
+   SB_ARG_TYPE_STRING, NULL},
 
   {NULL, NULL, SB_ARG_TYPE_NULL, NULL}
 };
@@ -480,6 +530,7 @@ int text_handler_process(log_msg_t *msg)
 int oper_handler_init(void)
 {
   unsigned int i, tmp;
+  char         *fname;
 
   tmp = sb_get_value_int("percentile");
   if (tmp < 1 || tmp > 100)
@@ -490,11 +541,23 @@ int oper_handler_init(void)
   }
   sb_globals.percentile_rank = tmp;
 
-  if (sb_percentile_init(&percentile, OPER_LOG_GRANULARITY, OPER_LOG_MIN_VALUE,
+  if (parse_percentiles())
+    return 1;
+
+  tmp = sb_get_value_int("histogram-digits");
+  if (tmp < SB_PERCENTILE_MIN_DIGITS || tmp > SB_PERCENTILE_MAX_DIGITS)
+  {
+    log_text(LOG_FATAL, "Invalid value for histogram-digits option: %d", tmp);
+    return 1;
+  }
+  sb_globals.histogram_digits = tmp;
+
+  if (sb_percentile_init(&percentile, sb_globals.histogram_digits,
                          OPER_LOG_MAX_VALUE))
     return 1;
 
-  timers = (sb_timer_t *)malloc(sb_globals.num_threads * sizeof(sb_timer_t));
+  timers = (oper_timer_t *)calloc(sb_globals.num_threads,
+                                  sizeof(oper_timer_t));
   timers_copy = (sb_timer_t *)malloc(sb_globals.num_threads *
                                      sizeof(sb_timer_t));
   if (timers == NULL || timers_copy == NULL)
@@ -504,44 +567,233 @@ int oper_handler_init(void)
   }
 
   for (i = 0; i < sb_globals.num_threads; i++)
-    sb_timer_init(&timers[i]);
+    timers[i].min_time = ULLONG_MAX;
 
-  pthread_mutex_init(&timers_mutex, NULL);
+  if (sb_globals.tx_rate > 0)
+  {
+    if (sb_percentile_init(&wait_percentile, sb_globals.histogram_digits,
+                           OPER_LOG_MAX_VALUE) ||
+        sb_percentile_init(&service_percentile, sb_globals.histogram_digits,
+                           OPER_LOG_MAX_VALUE))
+      return 1;
+
+    waits = (oper_wait_t *)calloc(sb_globals.num_threads, sizeof(oper_wait_t));
+    if (waits == NULL)
+    {
+      log_text(LOG_FATAL, "Memory allocation failure");
+      return 1;
+    }
+  }
+
+  fname = sb_get_value_string("histogram-file");
+  if (fname != NULL)
+  {
+    histogram_file = fopen(fname, "w");
+    if (histogram_file == NULL)
+    {
+      log_errno(LOG_FATAL, "Cannot open histogram file '%s'", fname);
+      return 1;
+    }
+    fprintf(histogram_file, "report,latency_ms,count\n");
+  }
+
+  pthread_mutex_init(&stats_mutex, NULL);
 
   return 0;
 }
 
 
+/*
+  Parse --percentiles into a sorted list of unique values, including the
+  percentile rank specified with --percentile.
+*/
+
+
+static int parse_percentiles(void)
+{
+  sb_list_t      *list;
+  sb_list_item_t *pos;
+  value_t        *val;
+  double         res;
+  unsigned int   i, n;
+
+  n = 0;
+  sb_globals.percentiles[n++] = sb_globals.percentile_rank;
+
+  list = sb_get_value_list("percentiles");
+  SB_LIST_FOR_EACH(pos, list)
+  {
+    char *endptr;
+
+    val = SB_LIST_ENTRY(pos, value_t, listitem);
+    res = strtod(val->data, &endptr);
+    if (*endptr != '\0' || res <= 0 || res > 100)
+    {
+      log_text(LOG_FATAL, "Invalid value for --percentiles: '%s'", val->data);
+      return 1;
+    }
+
+    /* Insert into the sorted list, skipping duplicates */
+    for (i = n; i > 0 && sb_globals.percentiles[i - 1] > res; i--)
+      ;
+    if (i > 0 && sb_globals.percentiles[i - 1] == res)
+      continue;
+    if (n == MAX_PERCENTILES)
+    {
+      log_text(LOG_FATAL, "Too many values in --percentiles "
+               "(up to %d can be defined)", MAX_PERCENTILES - 1);
+      return 1;
+    }
+    memmove(sb_globals.percentiles + i + 1, sb_globals.percentiles + i,
+            (n - i) * sizeof(double));
+    sb_globals.percentiles[i] = res;
+    n++;
+  }
+  sb_globals.n_percentiles = n;
+
+  return 0;
+}
+
+
+/* Publish a completed event in the timer slot of the calling thread */
+
+static void timer_add_event(oper_timer_t *timer, unsigned long long value)
+{
+  unsigned long long cur;
+
+  sb_atomic_add_u64(&timer->events, 1);
+  sb_atomic_add_u64(&timer->sum_time, value);
+
+  /* Retry only if a reporting thread has reset the value in between */
+  cur = sb_atomic_load_u64(&timer->min_time);
+  while (value < cur && !sb_atomic_cas_u64(&timer->min_time, &cur, value))
+    ;
+  cur = sb_atomic_load_u64(&timer->max_time);
+  while (value > cur && !sb_atomic_cas_u64(&timer->max_time, &cur, value))
+    ;
+}
+
+
+/* Move statistics accumulated in a timer slot to 'to' and reset them */
+
+static void collect_timer(oper_timer_t *timer, sb_timer_t *to)
+{
+  sb_timer_init(to);
+  to->events = sb_atomic_exchange_u64(&timer->events, 0);
+  to->sum_time = sb_atomic_exchange_u64(&timer->sum_time, 0);
+  to->min_time = sb_atomic_exchange_u64(&timer->min_time, ULLONG_MAX);
+  to->max_time = sb_atomic_exchange_u64(&timer->max_time, 0);
+}
+
+
 /* Process operation start/stop messages */
 
 
 int oper_handler_process(log_msg_t *msg)
 {
   log_msg_oper_t *oper_msg = (log_msg_oper_t *)msg->data;
-  sb_timer_t     *timer = &timers[oper_msg->thread_id];
+  oper_timer_t   *timer = &timers[oper_msg->thread_id];
+  oper_wait_t    *wait = NULL;
   long long      value;
+  long long      delta;
+
+  if (waits != NULL && waits[oper_msg->thread_id].has_origin)
+    wait = &waits[oper_msg->thread_id];
 
   if (oper_msg->action == LOG_MSG_OPER_START)
   {
-    pthread_mutex_lock(&timers_mutex);
-    sb_timer_start(timer);
-    pthread_mutex_unlock(&timers_mutex);
+    timer->start = sb_timer_now();
+    if (wait != NULL)
+    {
+      /* Move the start of the event back to its intended start time */
+      delta = sb_time_diff(timer->start, wait->origin);
+      if (delta > 0)
+      {
+        wait->wait = delta;
+        timer->start = wait->origin;
+      }
+      else
+        wait->wait = 0;
+    }
 
     return 0;
   }
 
-  pthread_mutex_lock(&timers_mutex);
+  value = sb_time_diff(sb_timer_now(), timer->start);
+  if (value < 0)
+    value = 0;
 
-  sb_timer_stop(timer);
-  value = sb_timer_value(timer);
+  timer_add_event(timer, value);
+  sb_percentile_update(&percentile, value);
 
-  pthread_mutex_unlock(&timers_mutex);
+  if (sb_trace_enabled)
+    sb_trace_event(oper_msg->thread_id, timer->start, value);
 
-  sb_percentile_update(&percentile, value);
+  if (wait != NULL)
+  {
+    sb_atomic_add_u64(&wait->wait_sum, wait->wait);
+    sb_atomic_add_u64(&wait->service_sum, value - wait->wait);
+    wait->has_origin = 0;
+
+    sb_percentile_update(&wait_percentile, wait->wait);
+    sb_percentile_update(&service_percentile, value - wait->wait);
+  }
 
   return 0;
 }
 
+
+/*
+  Set the intended start time for the next event executed by the specified
+  thread (used in the open-loop mode).
+*/
+
+
+void log_event_origin(int thread_id, sb_time_t origin)
+{
+  if (waits == NULL)
+    return;
+
+  waits[thread_id].origin = origin;
+  waits[thread_id].has_origin = 1;
+}
+
+/*
+  Record an event of the specified thread which started at 'start' and has
+  just completed. Used for requests which complete asynchronously. Returns the
+  event duration in nanoseconds.
+*/
+
+
+unsigned long long log_event_complete(int thread_id,
+                                      sb_time_t start)
+{
+  long long value;
+
+  value = sb_time_diff(sb_timer_now(), start);
+  if (value < 0)
+    value = 0;
+
+  timer_add_event(&timers[thread_id], value);
+  sb_percentile_update(&percentile, value);
+
+  if (sb_trace_enabled)
+    sb_trace_event(thread_id, start, value);
+
+  return value;
+}
+
+/* Write a histogram bucket to --histogram-file */
+
+static void dump_histogram_bucket(double value, unsigned long long count,
+                                  void *arg)
+{
+  (void) arg; /* unused */
+
+  fprintf(histogram_file, "%u,%.6f,%llu\n", histogram_reports, NS2MS(value),
+          count);
+}
+
 /*
   Print global stats either from the last checkpoint (if used) or
   from the test start.
@@ -558,30 +810,67 @@ int print_global_stats(void)
   double       events_stddev;
   double       time_avg;
   double       time_stddev;
-  double       percentile_val;
+  double       percentile_vals[MAX_PERCENTILES];
+  char         label[16];
+  double       wait_vals[MAX_PERCENTILES];
+  double       service_vals[MAX_PERCENTILES];
+  double       wait_max = 0;
+  double       service_max = 0;
+  unsigned long long wait_sum = 0;
+  unsigned long long service_sum = 0;
   unsigned long long total_time_ns;
 
   sb_timer_init(&t);
   nthreads = sb_globals.num_threads;
 
-  /* Create a temporary copy of timers and reset them */
-  pthread_mutex_lock(&timers_mutex);
+  /* Collect and reset statistics of all threads */
+  pthread_mutex_lock(&stats_mutex);
 
-  memcpy(timers_copy, timers, sb_globals.num_threads * sizeof(sb_timer_t));
   for (i = 0; i < sb_globals.num_threads; i++)
-    sb_timer_reset(&timers[i]);
+    collect_timer(&timers[i], &timers_copy[i]);
 
   total_time_ns = sb_timer_split(&sb_globals.cumulative_timer2);
 
-  percentile_val = sb_percentile_calculate(&percentile,
-                                           sb_globals.percentile_rank);
-  sb_percentile_reset(&percentile);
+  sb_percentile_calculate_multi(&percentile, sb_globals.percentiles,
+                                percentile_vals, sb_globals.n_percentiles,
+                                NULL);
+  if (histogram_file != NULL)
+  {
+    histogram_reports++;
+    sb_percentile_foreach(&percentile, dump_histogram_bucket, NULL);
+    fflush(histogram_file);
+  }
+  /* Keep the interval histogram intact for intermediate reports */
+  sb_percentile_reset_cumulative(&percentile);
+
+  if (waits != NULL)
+  {
+    for (i = 0; i < sb_globals.num_threads; i++)
+    {
+      wait_sum += sb_atomic_exchange_u64(&waits[i].wait_sum, 0);
+      service_sum += sb_atomic_exchange_u64(&waits[i].service_sum, 0);
+    }
+
+    sb_percentile_calculate_multi(&wait_percentile, sb_globals.percentiles,
+                                  wait_vals, sb_globals.n_percentiles,
+                                  &wait_max);
+    sb_percentile_reset(&wait_percentile);
+    sb_percentile_calculate_multi(&service_percentile, sb_globals.percentiles,
+                                  service_vals, sb_globals.n_percentiles,
+                                  &service_max);
+    sb_percentile_reset(&service_percentile);
+  }
 
-  pthread_mutex_unlock(&timers_mutex);
+  pthread_mutex_unlock(&stats_mutex);
 
   for(i = 0; i < nthreads; i++)
     t = merge_timers(&t, &timers_copy[i]);
 
+  /* Percentiles cannot exceed the exact maximum tracked by timers */
+  if (t.events > 0)
+    sb_percentile_clamp(percentile_vals, sb_globals.n_percentiles,
+                        get_max_time(&t));
+
 /* Print total statistics */
   log_text(LOG_NOTICE, "");
   log_text(LOG_NOTICE, "General statistics:");
@@ -600,11 +889,42 @@ int print_global_stats(void)
   log_text(LOG_NOTICE, "         max:                            %10.2fms",
            NS2MS(get_max_time(&t)));
 
-  /* Print approx. percentile value for event execution times */
+  /* Print approx. percentile values for event execution times */
   if (t.events > 0)
   {
-    log_text(LOG_NOTICE, "         approx. %3d percentile:         %10.2fms",
-             sb_globals.percentile_rank, NS2MS(percentile_val));
+    for (i = 0; i < sb_globals.n_percentiles; i++)
+    {
+      snprintf(label, sizeof(label), "%g", sb_globals.percentiles[i]);
+      log_text(LOG_NOTICE, "         approx. %6s percentile:      %10.2fms",
+               label, NS2MS(percentile_vals[i]));
+    }
+  }
+
+  /* Print queue wait and service times in the open-loop mode */
+  if (waits != NULL && t.events > 0)
+  {
+    log_text(LOG_NOTICE, "    queue wait time:");
+    log_text(LOG_NOTICE, "         avg:                            %10.2fms",
+             NS2MS(wait_sum / t.events));
+    log_text(LOG_NOTICE, "         max:                            %10.2fms",
+             NS2MS(wait_max));
+    for (i = 0; i < sb_globals.n_percentiles; i++)
+    {
+      snprintf(label, sizeof(label), "%g", sb_globals.percentiles[i]);
+      log_text(LOG_NOTICE, "         approx. %6s percentile:      %10.2fms",
+               label, NS2MS(wait_vals[i]));
+    }
+    log_text(LOG_NOTICE, "    service time:");
+    log_text(LOG_NOTICE, "         avg:                            %10.2fms",
+             NS2MS(service_sum / t.events));
+    log_text(LOG_NOTICE, "         max:                            %10.2fms",
+             NS2MS(service_max));
+    for (i = 0; i < sb_globals.n_percentiles; i++)
+    {
+      snprintf(label, sizeof(label), "%g", sb_globals.percentiles[i]);
+      log_text(LOG_NOTICE, "         approx. %6s percentile:      %10.2fms",
+               label, NS2MS(service_vals[i]));
+    }
   }
   log_text(LOG_NOTICE, "");
 
@@ -636,6 +956,33 @@ int print_global_stats(void)
            time_avg, time_stddev);
   log_text(LOG_NOTICE, "");
 
+  if (SB_OUTPUT_ENABLED())
+  {
+    sb_output_record_t rec;
+
+    sb_output_begin(&rec, SB_STAT_CUMULATIVE, "general");
+    sb_output_add(&rec, "threads", nthreads);
+    sb_output_add(&rec, "total_time_s", NS2SEC(total_time_ns));
+    sb_output_add(&rec, "events", t.events);
+    sb_output_add(&rec, "events_time_s", NS2SEC(get_sum_time(&t)));
+    sb_output_add(&rec, "latency_min_ms", NS2MS(get_min_time(&t)));
+    sb_output_add(&rec, "latency_avg_ms", NS2MS(get_avg_time(&t)));
+    sb_output_add_percentiles(&rec, "latency", percentile_vals,
+                              get_max_time(&t));
+    if (waits != NULL && t.events > 0)
+    {
+      sb_output_add(&rec, "wait_avg_ms", NS2MS(wait_sum / t.events));
+      sb_output_add_percentiles(&rec, "wait", wait_vals, wait_max);
+      sb_output_add(&rec, "service_avg_ms", NS2MS(service_sum / t.events));
+      sb_output_add_percentiles(&rec, "service", service_vals, service_max);
+    }
+    sb_output_add(&rec, "fairness_events_avg", events_avg);
+    sb_output_add(&rec, "fairness_events_stddev", events_stddev);
+    sb_output_add(&rec, "fairness_time_avg_s", time_avg);
+    sb_output_add(&rec, "fairness_time_stddev_s", time_stddev);
+    sb_output_write(&rec);
+  }
+
   if (sb_globals.debug)
   {
     log_text(LOG_DEBUG, "Verbose per-thread statistics:\n");
@@ -658,16 +1005,109 @@ int print_global_stats(void)
   return 0;
 }
 
+/* Get the number of events since the last global stats report */
+
+unsigned long long log_get_events(void)
+{
+  unsigned long long events = 0;
+  unsigned int       i;
+
+  for (i = 0; i < sb_globals.num_threads; i++)
+    events += sb_atomic_load_u64(&timers[i].events);
+
+  return events;
+}
+
+
+/* Get a response time percentile since the last global stats report */
+
+double log_get_percentile(double percent)
+{
+  return sb_percentile_calculate(&percentile, percent);
+}
+
+/*
+  Get values of all reported percentiles and the maximum response time since
+  the previous call (used in intermediate reports)
+*/
+
+void log_get_interval_percentiles(double *values, double *max)
+{
+  sb_percentile_calculate_interval(&percentile, sb_globals.percentiles, values,
+                                   sb_globals.n_percentiles, max);
+}
+
+/* Format values returned by log_get_interval_percentiles() */
+
+char *log_format_percentiles(const double *values, double max, char *buf,
+                             size_t size)
+{
+  unsigned int i;
+  size_t       len;
+
+  buf[0] = '\0';
+  len = 0;
+  for (i = 0; i < sb_globals.n_percentiles && len < size; i++)
+    len += snprintf(buf + len, size - len, "p%g: %.2fms, ",
+                    sb_globals.percentiles[i], NS2MS(values[i]));
+  if (len < size)
+    snprintf(buf + len, size - len, "max: %.2fms", NS2MS(max));
+
+  return buf;
+}
+
+/* Discard response time statistics collected so far */
+
+void log_reset_stats(void)
+{
+  unsigned int i;
+
+  pthread_mutex_lock(&stats_mutex);
+
+  for (i = 0; i < sb_globals.num_threads; i++)
+    collect_timer(&timers[i], &timers_copy[i]);
+  sb_percentile_reset(&percentile);
+
+  if (waits != NULL)
+  {
+    for (i = 0; i < sb_globals.num_threads; i++)
+    {
+      sb_atomic_exchange_u64(&waits[i].wait_sum, 0);
+      sb_atomic_exchange_u64(&waits[i].service_sum, 0);
+    }
+    sb_percentile_reset(&wait_percentile);
+    sb_percentile_reset(&service_percentile);
+  }
+
+  pthread_mutex_unlock(&stats_mutex);
+}
+
 /* Uninitialize operations messages handler */
 
 int oper_handler_done(void)
 {
-  print_global_stats();
+  /* Statistics of --threads-sweep steps are reported by each step */
+  if (sb_globals.n_sweep_steps == 0)
+    print_global_stats();
 
   free(timers);
   free(timers_copy);
 
-  pthread_mutex_destroy(&timers_mutex);
+  if (waits != NULL)
+  {
+    sb_percentile_done(&wait_percentile);
+    sb_percentile_done(&service_percentile);
+    free(waits);
+    waits = NULL;
+  }
+
+  if (histogram_file != NULL)
+  {
+    fclose(histogram_file);
+    histogram_file = NULL;
+  }
+
+  pthread_mutex_destroy(&stats_mutex);
 
   return 0;
 }
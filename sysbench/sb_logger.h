@@ -118,9 +118,6 @@ typedef struct {
   sb_list_item_t       listitem;  /* can be linked in a list */
 } log_handler_t;
 
-/* per-thread timers for response time stats */
-extern sb_timer_t *timers;
-
 /* Register logger */
 
 int log_register(void);
@@ -153,6 +150,22 @@ void log_text(log_msg_priority_t priority, const char *fmt, ...);
 void log_timestamp(log_msg_priority_t priority, const sb_timer_t *timer,
                    const char *fmt, ...);
 
+/*
+  Set the intended start time for the next event of the specified thread.
+  Response time of the event is then measured from that time, and the
+  difference from the actual start is reported as queue wait time.
+*/
+
+void log_event_origin(int thread_id, sb_time_t origin);
+
+/*
+  Record an event of the specified thread which started at 'start' (as
+  returned by sb_timer_now()) and has just completed (e.g. an asynchronous
+  I/O request). Returns the event duration in nanoseconds.
+*/
+
+unsigned long long log_event_complete(int thread_id, sb_time_t start);
+
 /* printf-like wrapper to log system error messages */
 
 void log_errno(log_msg_priority_t priority, const char *fmt, ...);
@@ -168,4 +181,31 @@ void log_done(void);
 
 int print_global_stats(void);
 
+/* Get the number of events since the last global stats report */
+
+unsigned long long log_get_events(void);
+
+/*
+  Get the specified percentile of response times (in nanoseconds) since the
+  last global stats report
+*/
+
+double log_get_percentile(double percent);
+
+/*
+  Get values of all reported percentiles and the maximum response time since
+  the previous call (used in intermediate reports)
+*/
+
+void log_get_interval_percentiles(double *values, double *max);
+
+/* Format values returned by log_get_interval_percentiles() */
+
+char *log_format_percentiles(const double *values, double max, char *buf,
+                             size_t size);
+
+/* Discard response time statistics collected so far (e.g. during warmup) */
+
+void log_reset_stats(void);
+
 #endif /* SB_LOGGER_H */
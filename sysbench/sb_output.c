@@ -0,0 +1,396 @@
+/* Copyright (C) 2011 Alexey Kopytov.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+#ifdef _WIN32
+#include "sb_win.h"
+#endif
+
+#ifdef STDC_HEADERS
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+#endif
+#ifdef HAVE_MATH_H
+# include <math.h>
+#endif
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
+
+#include "sysbench.h"
+#include "sb_output.h"
+#include "sb_logger.h"
+#include "sb_options.h"
+
+/* Maximum length of an option value in the configuration record */
+#define OPTION_VALUE_MAX 1024
+
+sb_output_format_t sb_output_format = SB_OUTPUT_TEXT;
+
+static FILE            *output_file;
+static pthread_mutex_t output_mutex;
+
+/* Header of the record being written, repeated in each CSV row */
+static const char      *cur_type;
+static const char      *cur_source;
+static double          cur_time;
+
+/* Non-zero in the checkpoint reports thread */
+static SB_THREAD_LOCAL int checkpoints_thread;
+
+static void write_json_string(const char *str);
+static void write_csv_string(const char *str);
+static void write_config_record(const char *testname);
+static void write_number(double value);
+
+
+int sb_output_init(const char *testname)
+{
+  char *str;
+
+  str = sb_get_value_string("output-format");
+  if (str == NULL || !strcmp(str, "text"))
+    sb_output_format = SB_OUTPUT_TEXT;
+  else if (!strcmp(str, "json"))
+    sb_output_format = SB_OUTPUT_JSON;
+  else if (!strcmp(str, "csv"))
+    sb_output_format = SB_OUTPUT_CSV;
+  else
+  {
+    log_text(LOG_FATAL, "Invalid value for --output-format: '%s'", str);
+    return 1;
+  }
+
+  if (!SB_OUTPUT_ENABLED())
+    return 0;
+
+  str = sb_get_value_string("output-file");
+  if (str != NULL && *str != '\0')
+  {
+    output_file = fopen(str, "w");
+    if (output_file == NULL)
+    {
+      log_errno(LOG_FATAL, "Cannot open output file '%s'", str);
+      return 1;
+    }
+  }
+  else
+    output_file = stdout;
+
+  pthread_mutex_init(&output_mutex, NULL);
+
+  if (sb_output_format == SB_OUTPUT_CSV)
+    fprintf(output_file, "type,source,time,name,value\n");
+
+  write_config_record(testname);
+
+  return 0;
+}
+
+
+void sb_output_thread_checkpoints(void)
+{
+  checkpoints_thread = 1;
+}
+
+
+void sb_output_begin(sb_output_record_t *rec, sb_stat_t type,
+                     const char *source)
+{
+  if (type == SB_STAT_INTERMEDIATE)
+    rec->type = "intermediate";
+  else
+    rec->type = checkpoints_thread ? "checkpoint" : "final";
+  rec->source = source;
+  rec->time = NS2SEC(sb_globals.exec_timer.elapsed);
+  rec->nfields = 0;
+  rec->size = 0;
+  rec->fields = NULL;
+}
+
+
+static sb_output_field_t *add_field(sb_output_record_t *rec, const char *name)
+{
+  sb_output_field_t *field;
+  unsigned int      size;
+
+  if (rec->nfields >= rec->size)
+  {
+    size = rec->size > 0 ? rec->size * 2 : SB_OUTPUT_INIT_FIELDS;
+    field = (sb_output_field_t *) realloc(rec->fields,
+                                          size * sizeof(sb_output_field_t));
+    if (field == NULL)
+    {
+      log_text(LOG_WARNING, "Failed to allocate output field '%s', dropped",
+               name);
+      return NULL;
+    }
+    rec->fields = field;
+    rec->size = size;
+  }
+
+  field = &rec->fields[rec->nfields++];
+  snprintf(field->name, sizeof(field->name), "%s", name);
+
+  return field;
+}
+
+
+void sb_output_add(sb_output_record_t *rec, const char *name, double value)
+{
+  sb_output_field_t *field = add_field(rec, name);
+
+  if (field == NULL)
+    return;
+
+  field->str = NULL;
+  field->value = value;
+}
+
+
+void sb_output_add_str(sb_output_record_t *rec, const char *name,
+                       const char *str)
+{
+  sb_output_field_t *field = add_field(rec, name);
+
+  if (field == NULL)
+    return;
+
+  field->str = str;
+}
+
+
+void sb_output_add_percentiles(sb_output_record_t *rec, const char *prefix,
+                               const double *values, double max)
+{
+  char         name[48];
+  unsigned int i;
+
+  for (i = 0; i < sb_globals.n_percentiles; i++)
+  {
+    snprintf(name, sizeof(name), "%s_p%g_ms", prefix,
+             sb_globals.percentiles[i]);
+    sb_output_add(rec, name, NS2MS(values[i]));
+  }
+  snprintf(name, sizeof(name), "%s_max_ms", prefix);
+  sb_output_add(rec, name, NS2MS(max));
+}
+
+
+/* Write a number, non-finite values are written as null/empty */
+
+static void write_number(double value)
+{
+  if (isfinite(value))
+    fprintf(output_file, "%.15g", value);
+  else if (sb_output_format == SB_OUTPUT_JSON)
+    fputs("null", output_file);
+}
+
+
+/*
+  Serialization of a record, must be called with output_mutex locked. In CSV
+  every value is written as a separate row prefixed with the record header.
+*/
+
+static void write_record_start(const char *type, const char *source,
+                               double time)
+{
+  cur_type = type;
+  cur_source = source;
+  cur_time = time;
+
+  if (sb_output_format == SB_OUTPUT_JSON)
+  {
+    fputs("{\"type\": ", output_file);
+    write_json_string(type);
+    fputs(", \"source\": ", output_file);
+    write_json_string(source);
+    fputs(", \"time\": ", output_file);
+    write_number(time);
+  }
+}
+
+
+static void write_field(const char *name, const char *str, double value)
+{
+  if (sb_output_format == SB_OUTPUT_JSON)
+  {
+    fputs(", ", output_file);
+    write_json_string(name);
+    fputs(": ", output_file);
+    if (str != NULL)
+      write_json_string(str);
+    else
+      write_number(value);
+  }
+  else
+  {
+    write_csv_string(cur_type);
+    fputc(',', output_file);
+    write_csv_string(cur_source);
+    fputc(',', output_file);
+    write_number(cur_time);
+    fputc(',', output_file);
+    write_csv_string(name);
+    fputc(',', output_file);
+    if (str != NULL)
+      write_csv_string(str);
+    else
+      write_number(value);
+    fputc('\n', output_file);
+  }
+}
+
+
+static void write_record_end(void)
+{
+  if (sb_output_format == SB_OUTPUT_JSON)
+    fputs("}\n", output_file);
+  fflush(output_file);
+}
+
+
+void sb_output_write(sb_output_record_t *rec)
+{
+  unsigned int i;
+
+  pthread_mutex_lock(&output_mutex);
+
+  write_record_start(rec->type, rec->source, rec->time);
+  for (i = 0; i < rec->nfields; i++)
+    write_field(rec->fields[i].name, rec->fields[i].str,
+                rec->fields[i].value);
+  write_record_end();
+
+  pthread_mutex_unlock(&output_mutex);
+
+  free(rec->fields);
+  rec->fields = NULL;
+  rec->nfields = rec->size = 0;
+}
+
+
+void sb_output_done(void)
+{
+  if (!SB_OUTPUT_ENABLED())
+    return;
+
+  if (output_file != stdout)
+    fclose(output_file);
+  output_file = NULL;
+
+  pthread_mutex_destroy(&output_mutex);
+}
+
+
+static void write_json_string(const char *str)
+{
+  const unsigned char *p;
+
+  fputc('"', output_file);
+  for (p = (const unsigned char *) str; *p != '\0'; p++)
+  {
+    if (*p == '"' || *p == '\\')
+      fprintf(output_file, "\\%c", *p);
+    else if (*p < 0x20)
+      fprintf(output_file, "\\u%04x", *p);
+    else
+      fputc(*p, output_file);
+  }
+  fputc('"', output_file);
+}
+
+
+static void write_csv_string(const char *str)
+{
+  const char *p;
+
+  if (strpbrk(str, ",\"\n") == NULL)
+  {
+    fputs(str, output_file);
+    return;
+  }
+
+  fputc('"', output_file);
+  for (p = str; *p != '\0'; p++)
+  {
+    if (*p == '"')
+      fputc('"', output_file);
+    fputc(*p, output_file);
+  }
+  fputc('"', output_file);
+}
+
+
+/* Check if an option holds a credential, e.g. --mysql-password */
+
+static int is_secret_option(const char *name)
+{
+  static const char suffix[] = "-password";
+  size_t            len = strlen(name);
+
+  return len >= sizeof(suffix) - 1 &&
+    !strcmp(name + len - (sizeof(suffix) - 1), suffix);
+}
+
+
+/*
+  Write values of all options as a configuration record. Options are written
+  as strings, list values are separated by commas. Values of credentials are
+  masked.
+*/
+
+static void write_config_record(const char *testname)
+{
+  sb_list_item_t *pos;
+  sb_list_item_t *vpos;
+  option_t       *opt;
+  value_t        *val;
+  char           buf[OPTION_VALUE_MAX];
+  size_t         len;
+
+  pthread_mutex_lock(&output_mutex);
+
+  write_record_start("config", testname, 0);
+  write_field("version", PACKAGE_VERSION, 0);
+
+  pos = sb_options_enum_start();
+  while ((pos = sb_options_enum_next(pos, &opt)) != NULL)
+  {
+    buf[0] = '\0';
+    len = 0;
+    SB_LIST_FOR_EACH(vpos, &opt->values)
+    {
+      val = SB_LIST_ENTRY(vpos, value_t, listitem);
+      if (len < sizeof(buf))
+        len += snprintf(buf + len, sizeof(buf) - len, "%s%s",
+                        len > 0 ? "," : "", val->data);
+    }
+    if (buf[0] != '\0' && is_secret_option(opt->name))
+      write_field(opt->name, "***", 0);
+    else
+      write_field(opt->name, buf, 0);
+  }
+
+  write_record_end();
+
+  pthread_mutex_unlock(&output_mutex);
+}
@@ -0,0 +1,95 @@
+/* Copyright (C) 2011 Alexey Kopytov.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#ifndef SB_OUTPUT_H
+#define SB_OUTPUT_H
+
+#include "sysbench.h"
+
+/*
+  Structured (machine-readable) output of reports. Tests and the logger fill
+  a record with named values at the time of a report, the record is then
+  serialized in the format requested with --output-format.
+*/
+
+/* Initial number of values in a record, grown on demand */
+#define SB_OUTPUT_INIT_FIELDS 64
+
+typedef enum
+{
+  SB_OUTPUT_TEXT,           /* human-readable text only */
+  SB_OUTPUT_JSON,           /* one JSON object per line */
+  SB_OUTPUT_CSV             /* one "type,source,time,name,value" row per value */
+} sb_output_format_t;
+
+typedef struct
+{
+  char               name[48];
+  const char         *str;  /* string value, or NULL for numbers */
+  double             value;
+} sb_output_field_t;
+
+typedef struct
+{
+  const char         *type;    /* config, intermediate, checkpoint or final */
+  const char         *source;  /* test name or "general" */
+  double             time;     /* seconds since the test start */
+  unsigned int       nfields;
+  unsigned int       size;     /* allocated number of fields */
+  sb_output_field_t  *fields;
+} sb_output_record_t;
+
+extern sb_output_format_t sb_output_format;
+
+/* Check if structured output is enabled */
+#define SB_OUTPUT_ENABLED() (sb_output_format != SB_OUTPUT_TEXT)
+
+/*
+  Parse --output-format and --output-file, open the output file and write
+  the configuration record for the specified test.
+*/
+int sb_output_init(const char *testname);
+
+/*
+  Mark the calling thread as the checkpoint reports thread, so that cumulative
+  records it produces are written as checkpoints rather than final results.
+*/
+void sb_output_thread_checkpoints(void);
+
+/* Start a new record of the specified report type */
+void sb_output_begin(sb_output_record_t *rec, sb_stat_t type,
+                     const char *source);
+
+/* Add a numeric value to a record */
+void sb_output_add(sb_output_record_t *rec, const char *name, double value);
+
+/* Add a string value to a record. The string must outlive the record */
+void sb_output_add_str(sb_output_record_t *rec, const char *name,
+                       const char *str);
+
+/*
+  Add values of all reported percentiles (in nanoseconds) and the maximum
+  as <prefix>_p<N>_ms and <prefix>_max_ms
+*/
+void sb_output_add_percentiles(sb_output_record_t *rec, const char *prefix,
+                               const double *values, double max);
+
+/* Serialize a record to the output file and free its fields */
+void sb_output_write(sb_output_record_t *rec);
+
+void sb_output_done(void);
+
+#endif /* SB_OUTPUT_H */
@@ -32,94 +32,417 @@
 # include <math.h>
 #endif
 
+#include "sysbench.h"
 #include "sb_percentile.h"
 #include "sb_logger.h"
+#include "sb_atomic.h"
 
-int sb_percentile_init(sb_percentile_t *percentile,
-                       unsigned int size, double range_min, double range_max)
+/*
+  Histograms are split into per-thread shards, so that updates from different
+  threads neither serialize on a mutex nor share cache lines. Counters are
+  updated atomically, since a shard may be shared by non-worker threads or when
+  the number of threads exceeds SB_PERCENTILE_MAX_SHARDS.
+
+  Each shard consists of two halves. Writers update the half selected by
+  'phase', which the reader flips before draining both halves into the merged
+  interval and cumulative histograms. Counters are drained with atomic
+  exchanges, so no updates are lost even if a writer still uses the half it
+  picked before the flip. Flipping first just keeps the reader away from the
+  cache lines writers are updating. As a result, interval reports never affect
+  cumulative percentiles.
+
+  The bucket layout follows HdrHistogram. With 2^m sub-buckets per bucket,
+  values below 2^m are counted exactly, and each following power-of-2 range
+  is divided into 2^(m-1) linear sub-buckets. Locating the counter for a value
+  only takes a count-leading-zeros instruction and a shift.
+*/
+
+static unsigned long long *get_shard(sb_percentile_t *percentile);
+
+/* Number of leading zero bits in a non-zero value */
+
+static inline unsigned int sb_clz64(unsigned long long x)
+{
+#if defined(__GNUC__)
+  return (unsigned int) __builtin_clzll(x);
+#else
+  unsigned int n = 0;
+
+  while (!(x & (1ULL << 63)))
+  {
+    x <<= 1;
+    n++;
+  }
+  return n;
+#endif
+}
+
+/* Get the counter index for a value */
+
+static inline unsigned int counts_index(sb_percentile_t *percentile,
+                                        unsigned long long value)
+{
+  unsigned int       half_magnitude = percentile->sub_bucket_half_count_magnitude;
+  unsigned int       bucket_idx;
+  unsigned long long sub_bucket_idx;
+
+  /* Index of the power-of-2 bucket, sub_bucket_mask ensures a non-zero arg */
+  bucket_idx = 64 - sb_clz64(value | percentile->sub_bucket_mask) -
+    (half_magnitude + 1);
+  sub_bucket_idx = value >> bucket_idx;
+
+  return ((bucket_idx + 1) << half_magnitude) +
+    (unsigned int) (sub_bucket_idx - percentile->sub_bucket_half_count);
+}
+
+/* Get the highest value counted by the specified counter */
+
+static unsigned long long counts_value(sb_percentile_t *percentile,
+                                       unsigned int idx)
+{
+  int                bucket_idx;
+  unsigned long long sub_bucket_idx;
+
+  bucket_idx = (int) (idx >> percentile->sub_bucket_half_count_magnitude) - 1;
+  sub_bucket_idx = (idx & (percentile->sub_bucket_half_count - 1)) +
+    percentile->sub_bucket_half_count;
+  if (bucket_idx < 0)
+  {
+    sub_bucket_idx -= percentile->sub_bucket_half_count;
+    bucket_idx = 0;
+  }
+
+  return (sub_bucket_idx << bucket_idx) + (1ULL << bucket_idx) - 1;
+}
+
+int sb_percentile_init(sb_percentile_t *percentile, unsigned int digits,
+                       unsigned long long max_value)
 {
-  percentile->values = (unsigned long long *)
-    calloc(size, sizeof(unsigned long long));
-  percentile->tmp = (unsigned long long *)
-    calloc(size, sizeof(unsigned long long));
-  if (percentile->values == NULL || percentile->tmp == NULL)
+  unsigned long long largest_single_unit;
+  unsigned long long smallest_untrackable;
+  unsigned int       magnitude;
+  unsigned int       bucket_count;
+  unsigned int       i;
+
+  if (digits < SB_PERCENTILE_MIN_DIGITS || digits > SB_PERCENTILE_MAX_DIGITS)
   {
-    log_text(LOG_FATAL, "Cannot allocate values array, size = %u", size);
+    log_text(LOG_FATAL, "Invalid number of significant digits: %u", digits);
     return 1;
   }
 
-  percentile->range_deduct = log(range_min);
-  percentile->range_mult = (size - 1) / (log(range_max) -
-                                         percentile->range_deduct);
-  percentile->range_min = range_min;
-  percentile->range_max = range_max;
-  percentile->size = size;
-  percentile->total = 0;
+  /* Number of sub-buckets required to resolve 'digits' decimal digits */
+  largest_single_unit = 2;
+  for (i = 0; i < digits; i++)
+    largest_single_unit *= 10;
+  for (magnitude = 1; (1ULL << magnitude) < largest_single_unit; magnitude++)
+    ;
+
+  percentile->sub_bucket_half_count_magnitude = magnitude - 1;
+  percentile->sub_bucket_half_count = 1U << (magnitude - 1);
+  percentile->sub_bucket_mask = (1ULL << magnitude) - 1;
+  percentile->max_value = max_value;
+
+  /* Number of power-of-2 buckets required to cover max_value */
+  smallest_untrackable = 1ULL << magnitude;
+  bucket_count = 1;
+  while (smallest_untrackable <= max_value)
+  {
+    if (smallest_untrackable > ~0ULL / 2)
+    {
+      bucket_count++;
+      break;
+    }
+    smallest_untrackable <<= 1;
+    bucket_count++;
+  }
+  percentile->size = (bucket_count + 1) * percentile->sub_bucket_half_count;
+
+  percentile->nshards = sb_globals.num_threads;
+  if (percentile->nshards < 1)
+    percentile->nshards = 1;
+  else if (percentile->nshards > SB_PERCENTILE_MAX_SHARDS)
+    percentile->nshards = SB_PERCENTILE_MAX_SHARDS;
+
+  percentile->phase = 0;
+  percentile->shards = (unsigned long long **)
+    calloc(percentile->nshards, sizeof(unsigned long long *));
+  percentile->interval = (unsigned long long *)
+    calloc(percentile->size, sizeof(unsigned long long));
+  percentile->cumulative = (unsigned long long *)
+    calloc(percentile->size, sizeof(unsigned long long));
+  if (percentile->shards == NULL || percentile->interval == NULL ||
+      percentile->cumulative == NULL)
+  {
+    log_text(LOG_FATAL, "Cannot allocate values array, size = %u",
+             percentile->size);
+    return 1;
+  }
 
   pthread_mutex_init(&percentile->mutex, NULL);
 
   return 0;
 }
 
-void sb_percentile_update(sb_percentile_t *percentile, double value)
+/* Get the shard for the current thread, allocate it on first use */
+
+static unsigned long long *get_shard(sb_percentile_t *percentile)
 {
-  unsigned int n;
+  unsigned int       idx;
+  unsigned long long *shard;
 
-  if (value < percentile->range_min)
-    value= percentile->range_min;
-  else if (value > percentile->range_max)
-    value= percentile->range_max;
+  /* Non-worker threads share the first shard */
+  idx = sb_thread_id < 0 ? 0 : (unsigned int) sb_thread_id % percentile->nshards;
 
-  n = floor((log(value) - percentile->range_deduct) * percentile->range_mult
-            + 0.5);
+  shard = (unsigned long long *)
+    sb_atomic_load_ptr_acquire((void **) &percentile->shards[idx]);
+  if (shard != NULL)
+    return shard;
 
   pthread_mutex_lock(&percentile->mutex);
-  percentile->total++;
-  percentile->values[n]++;
+  shard = percentile->shards[idx];
+  if (shard == NULL)
+  {
+    shard = (unsigned long long *)
+      calloc(2 * percentile->size, sizeof(unsigned long long));
+    if (shard == NULL)
+      log_text(LOG_FATAL, "Cannot allocate values array, size = %u",
+               percentile->size);
+    else
+      sb_atomic_store_ptr_release((void **) &percentile->shards[idx], shard);
+  }
   pthread_mutex_unlock(&percentile->mutex);
+
+  return shard;
 }
 
-double sb_percentile_calculate(sb_percentile_t *percentile, double percent)
+void sb_percentile_update(sb_percentile_t *percentile,
+                          unsigned long long value)
 {
-  unsigned long long ncur, nmax;
-  unsigned int       i;
+  unsigned long long *shard;
 
-  pthread_mutex_lock(&percentile->mutex);
+  if (value > percentile->max_value)
+    value = percentile->max_value;
 
-  if (percentile->total == 0)
+  shard = get_shard(percentile);
+  if (shard != NULL)
   {
-    pthread_mutex_unlock(&percentile->mutex);
-    return 0.0;
+    shard += (sb_atomic_load_u64(&percentile->phase) & 1) * percentile->size;
+    sb_atomic_add_u64(&shard[counts_index(percentile, value)], 1);
   }
+}
 
-  memcpy(percentile->tmp, percentile->values,
-         percentile->size * sizeof(unsigned long long));
-  nmax = floor(percentile->total * percent / 100 + 0.5);
+/*
+  Flip the active halves of shards and move all counters to the interval and
+  cumulative histograms. Must be called with mutex locked.
+*/
 
-  pthread_mutex_unlock(&percentile->mutex);
+static void drain_shards(sb_percentile_t *percentile)
+{
+  unsigned long long *shard;
+  unsigned long long phase;
+  unsigned long long cnt;
+  unsigned int       i, j, h;
 
-  ncur = percentile->tmp[0];
-  for (i = 1; i < percentile->size; i++)
+  phase = sb_atomic_load_u64(&percentile->phase);
+  sb_atomic_store_u64(&percentile->phase, phase + 1);
+
+  for (j = 0; j < percentile->nshards; j++)
   {
-    ncur += percentile->tmp[i];
-    if (ncur >= nmax)
-      break;
+    if ((shard = percentile->shards[j]) == NULL)
+      continue;
+
+    /* Drain the previously active half first, then the new one */
+    for (h = 0; h < 2; h++)
+    {
+      unsigned long long *counts =
+        shard + ((phase + h) & 1) * percentile->size;
+
+      for (i = 0; i < percentile->size; i++)
+      {
+        if (sb_atomic_load_u64(&counts[i]) == 0)
+          continue;
+        cnt = sb_atomic_exchange_u64(&counts[i], 0);
+        percentile->interval[i] += cnt;
+        percentile->cumulative[i] += cnt;
+      }
+    }
+  }
+}
+
+/*
+  Number of values at or below the specified percentile: the smallest count
+  covering 'percent' percent of all values, but at least one value
+*/
+
+static inline unsigned long long rank_count(unsigned long long total,
+                                            double percent)
+{
+  double n = ceil(total * percent / 100);
+
+  return n >= 1 ? (unsigned long long) n : 1;
+}
+
+/* Calculate percentiles from a merged histogram */
+
+static unsigned long long calculate_counts(sb_percentile_t *percentile,
+                                           const unsigned long long *counts,
+                                           const double *percents,
+                                           double *values,
+                                           unsigned int n,
+                                           double *max)
+{
+  unsigned long long ncur, nmax, total;
+  unsigned int       i, k, last;
+
+  total = 0;
+  for (i = 0; i < percentile->size; i++)
+    total += counts[i];
+
+  if (total == 0)
+  {
+    for (k = 0; k < n; k++)
+      values[k] = 0.0;
+    if (max != NULL)
+      *max = 0.0;
+    return 0;
+  }
+
+  /* Walk the prefix sums once, resolving percentiles in ascending order */
+  k = 0;
+  nmax = rank_count(total, percents[0]);
+  ncur = 0;
+  for (i = 0; i < percentile->size && k < n; i++)
+  {
+    ncur += counts[i];
+    while (k < n && ncur >= nmax)
+    {
+      values[k++] = counts_value(percentile, i);
+      if (k < n)
+        nmax = rank_count(total, percents[k]);
+    }
+  }
+
+  /* Percentiles not reached due to rounding map to the last bucket */
+  for (; k < n; k++)
+    values[k] = counts_value(percentile, percentile->size - 1);
+
+  if (max != NULL)
+  {
+    for (last = percentile->size - 1; last > 0; last--)
+      if (counts[last] > 0)
+        break;
+    *max = counts_value(percentile, last);
   }
 
-  return exp((i) / percentile->range_mult + percentile->range_deduct);
+  return total;
+}
+
+double sb_percentile_calculate(sb_percentile_t *percentile, double percent)
+{
+  double value;
+
+  if (sb_percentile_calculate_multi(percentile, &percent, &value, 1, NULL) == 0)
+    return 0.0;
+
+  return value;
+}
+
+unsigned long long sb_percentile_calculate_multi(sb_percentile_t *percentile,
+                                                 const double *percents,
+                                                 double *values,
+                                                 unsigned int n,
+                                                 double *max)
+{
+  unsigned long long total;
+
+  pthread_mutex_lock(&percentile->mutex);
+
+  drain_shards(percentile);
+  total = calculate_counts(percentile, percentile->cumulative, percents,
+                           values, n, max);
+
+  pthread_mutex_unlock(&percentile->mutex);
+
+  return total;
+}
+
+unsigned long long sb_percentile_calculate_interval(sb_percentile_t *percentile,
+                                                    const double *percents,
+                                                    double *values,
+                                                    unsigned int n,
+                                                    double *max)
+{
+  unsigned long long total;
+
+  pthread_mutex_lock(&percentile->mutex);
+
+  drain_shards(percentile);
+  total = calculate_counts(percentile, percentile->interval, percents,
+                           values, n, max);
+  memset(percentile->interval, 0,
+         percentile->size * sizeof(unsigned long long));
+
+  pthread_mutex_unlock(&percentile->mutex);
+
+  return total;
+}
+
+void sb_percentile_foreach(sb_percentile_t *percentile, sb_percentile_cb *cb,
+                           void *arg)
+{
+  unsigned int i;
+
+  pthread_mutex_lock(&percentile->mutex);
+
+  drain_shards(percentile);
+  for (i = 0; i < percentile->size; i++)
+    if (percentile->cumulative[i] > 0)
+      cb(counts_value(percentile, i), percentile->cumulative[i], arg);
+
+  pthread_mutex_unlock(&percentile->mutex);
+}
+
+void sb_percentile_clamp(double *values, unsigned int n, double max)
+{
+  unsigned int i;
+
+  for (i = 0; i < n; i++)
+    if (values[i] > max)
+      values[i] = max;
 }
 
 void sb_percentile_reset(sb_percentile_t *percentile)
 {
   pthread_mutex_lock(&percentile->mutex);
-  percentile->total = 0;
-  memset(percentile->values, 0, percentile->size * sizeof(unsigned long long));
+
+  drain_shards(percentile);
+  memset(percentile->interval, 0,
+         percentile->size * sizeof(unsigned long long));
+  memset(percentile->cumulative, 0,
+         percentile->size * sizeof(unsigned long long));
+
+  pthread_mutex_unlock(&percentile->mutex);
+}
+
+void sb_percentile_reset_cumulative(sb_percentile_t *percentile)
+{
+  pthread_mutex_lock(&percentile->mutex);
+
+  drain_shards(percentile);
+  memset(percentile->cumulative, 0,
+         percentile->size * sizeof(unsigned long long));
+
   pthread_mutex_unlock(&percentile->mutex);
 }
 
 void sb_percentile_done(sb_percentile_t *percentile)
 {
+  unsigned int i;
+
   pthread_mutex_destroy(&percentile->mutex);
-  free(percentile->values);
-  free(percentile->tmp);
+  for (i = 0; i < percentile->nshards; i++)
+    free(percentile->shards[i]);
+  free(percentile->shards);
+  free(percentile->interval);
+  free(percentile->cumulative);
 }
@@ -22,27 +22,95 @@
 # include <pthread.h>
 #endif
 
+/*
+  Maximum number of histogram shards. Worker threads are mapped to shards by
+  their IDs, so each thread updates its own shard unless there are more
+  threads than shards.
+*/
+#define SB_PERCENTILE_MAX_SHARDS 64
+
+/* Range of supported numbers of significant decimal digits */
+#define SB_PERCENTILE_MIN_DIGITS 1
+#define SB_PERCENTILE_MAX_DIGITS 4
+
+/*
+  Log-linear histogram: values are split into power-of-2 buckets, each of
+  which is linearly divided into a fixed number of sub-buckets, so that any
+  recorded value is represented with the configured number of significant
+  decimal digits.
+*/
+
 typedef struct {
-  unsigned long long  *values;
-  unsigned long long  *tmp;
-  unsigned long long  total;
-  unsigned int        size;
-  double              range_min;
-  double              range_max;
-  double              range_deduct;
-  double              range_mult;
-  pthread_mutex_t     mutex;
+  unsigned long long  **shards;    /* per-thread histograms, allocated lazily */
+  unsigned int        nshards;
+  unsigned long long  phase;       /* selects the active half of shards */
+  unsigned long long  *interval;   /* merged counts since the last interval */
+  unsigned long long  *cumulative; /* merged counts since the last reset */
+  unsigned int        size;        /* number of counters in a histogram */
+  unsigned int        sub_bucket_half_count_magnitude;
+  unsigned int        sub_bucket_half_count;
+  unsigned long long  sub_bucket_mask;
+  unsigned long long  max_value;   /* larger values are truncated */
+  pthread_mutex_t     mutex;       /* protects shard allocation and merging */
 } sb_percentile_t;
 
-int sb_percentile_init(sb_percentile_t *percentile,
-                       unsigned int size, double range_min, double range_max);
+/*
+  Initialize a histogram for values in the range [0, max_value] with the
+  specified number of significant decimal digits.
+*/
+int sb_percentile_init(sb_percentile_t *percentile, unsigned int digits,
+                       unsigned long long max_value);
 
-void sb_percentile_update(sb_percentile_t *percentile, double value);
+void sb_percentile_update(sb_percentile_t *percentile,
+                          unsigned long long value);
 
+/* Calculate a percentile of values recorded since the last reset */
 double sb_percentile_calculate(sb_percentile_t *percentile, double percent);
 
+/*
+  Calculate several percentiles of values recorded since the last reset in a
+  single pass over the merged histogram.
+  'percents' must be sorted in ascending order. If 'max' is not NULL, it is set
+  to the value of the highest non-empty bucket. Returns the total number of
+  values in the histogram.
+*/
+unsigned long long sb_percentile_calculate_multi(sb_percentile_t *percentile,
+                                                 const double *percents,
+                                                 double *values,
+                                                 unsigned int n,
+                                                 double *max);
+
+/*
+  Same as sb_percentile_calculate_multi(), but for values recorded since the
+  previous call. Does not affect the cumulative histogram.
+*/
+unsigned long long sb_percentile_calculate_interval(sb_percentile_t *percentile,
+                                                    const double *percents,
+                                                    double *values,
+                                                    unsigned int n,
+                                                    double *max);
+
+/*
+  Histogram buckets are reported by their upper bounds, so percentiles may
+  exceed the largest recorded value. Clamp 'n' percentile values to the exact
+  maximum 'max' when the caller tracks it.
+*/
+void sb_percentile_clamp(double *values, unsigned int n, double max);
+
+/* Callback for sb_percentile_foreach(), called for each non-empty bucket */
+typedef void sb_percentile_cb(double value, unsigned long long count,
+                              void *arg);
+
+/* Iterate over non-empty buckets of the cumulative histogram */
+void sb_percentile_foreach(sb_percentile_t *percentile, sb_percentile_cb *cb,
+                           void *arg);
+
+/* Reset both the interval and the cumulative histograms */
 void sb_percentile_reset(sb_percentile_t *percentile);
 
+/* Reset the cumulative histogram only */
+void sb_percentile_reset_cumulative(sb_percentile_t *percentile);
+
 void sb_percentile_done(sb_percentile_t *percentile);
 
 #endif
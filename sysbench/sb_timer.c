@@ -26,16 +26,120 @@
 #ifdef HAVE_STRING_H
 # include <string.h>
 #endif
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
 
 #include "sb_logger.h"
 #include "sb_timer.h"
 
+/* Time spent calibrating TSC against CLOCK_MONOTONIC, in microseconds */
+#define TSC_CALIBRATION_TIME 50000
+
+sb_timer_source_t sb_timer_source = SB_TIMER_MONOTONIC;
+double            sb_timer_tsc_ns;
+
+#ifdef HAVE_CLOCK_GETTIME
+clockid_t         sb_timer_clock_id = CLOCK_MONOTONIC;
+#endif
+
+#ifdef SB_HAVE_TSC
+static int tsc_calibrate(void);
+#endif
+
+/* Select the clock source for event timing */
+
+
+int sb_timer_source_init(const char *name)
+{
+  if (name == NULL || !strcmp(name, "monotonic"))
+    sb_timer_source = SB_TIMER_MONOTONIC;
+  else if (!strcmp(name, "monotonic_raw"))
+  {
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC_RAW)
+    sb_timer_source = SB_TIMER_MONOTONIC_RAW;
+    sb_timer_clock_id = CLOCK_MONOTONIC_RAW;
+#else
+    log_text(LOG_FATAL, "--timer=monotonic_raw is not supported on this "
+             "platform");
+    return 1;
+#endif
+  }
+  else if (!strcmp(name, "tsc"))
+  {
+#ifdef SB_HAVE_TSC
+    if (tsc_calibrate())
+      return 1;
+    sb_timer_source = SB_TIMER_TSC;
+#else
+    log_text(LOG_FATAL, "--timer=tsc is not supported on this platform");
+    return 1;
+#endif
+  }
+  else
+  {
+    log_text(LOG_FATAL, "Invalid value for --timer: '%s'", name);
+    return 1;
+  }
+
+  return 0;
+}
+
+
+#ifdef SB_HAVE_TSC
+/*
+  Measure the TSC frequency against the monotonic clock. Timestamps are taken
+  on different CPUs over the test run, so TSC is only usable if it is
+  invariant, i.e. ticks at a constant rate synchronized across cores.
+*/
+
+
+static int tsc_calibrate(void)
+{
+  unsigned int       eax, ebx, ecx, edx;
+  sb_time_t          ns0, ns1;
+  unsigned long long tsc0, tsc1;
+
+  __asm__ __volatile__ ("cpuid" : "=a" (eax), "=b" (ebx), "=c" (ecx),
+                        "=d" (edx) : "a" (0x80000000));
+  if (eax >= 0x80000007)
+    __asm__ __volatile__ ("cpuid" : "=a" (eax), "=b" (ebx), "=c" (ecx),
+                          "=d" (edx) : "a" (0x80000007));
+  else
+    edx = 0;
+  if (!(edx & (1 << 8)))
+    log_text(LOG_WARNING, "TSC is not invariant on this CPU, timings "
+             "reported with --timer=tsc may be inaccurate");
+
+  ns0 = sb_timer_now();
+  tsc0 = sb_rdtsc();
+  usleep(TSC_CALIBRATION_TIME);
+  ns1 = sb_timer_now();
+  tsc1 = sb_rdtsc();
+
+  if (tsc1 <= tsc0 || ns1 <= ns0)
+  {
+    log_text(LOG_FATAL, "Failed to calibrate TSC");
+    return 1;
+  }
+  sb_timer_tsc_ns = (double) (ns1 - ns0) / (tsc1 - tsc0);
+
+  log_text(LOG_DEBUG, "TSC frequency: %.2f MHz", 1e3 / sb_timer_tsc_ns);
+
+  return 0;
+}
+#endif /* SB_HAVE_TSC */
+
 /* Some functions for simple time operations */
 
 static inline void sb_timer_update(sb_timer_t *t)
 {
-  SB_GETTIME(&t->time_end);
-  t->elapsed = TIMESPEC_DIFF(t->time_end, t->time_start);
+  long long delta;
+
+  t->time_end = sb_timer_now();
+  delta = sb_time_diff(t->time_end, t->time_start);
+  /* TSC may be slightly out of sync if the thread has migrated */
+  t->elapsed = delta > 0 ? delta : 0;
 }
 
 /* initialize timer */
@@ -43,9 +147,9 @@ static inline void sb_timer_update(sb_timer_t *t)
 
 void sb_timer_init(sb_timer_t *t)
 {
-  memset(&t->time_start, 0, sizeof(struct timespec));
-  memset(&t->time_end, 0, sizeof(struct timespec));
-  memset(&t->time_split, 0, sizeof(struct timespec));
+  t->time_start = 0;
+  t->time_end = 0;
+  t->time_split = 0;
   sb_timer_reset(t);
   t->state = TIMER_INITIALIZED;
 }
@@ -85,7 +189,19 @@ void sb_timer_start(sb_timer_t *t)
       abort();
   }
   
-  SB_GETTIME(&t->time_start);
+  t->time_start = sb_timer_now();
+  t->time_split = t->time_start;
+  t->state = TIMER_RUNNING;
+}
+
+
+/* restart a running timer from the current time, discarding its counters */
+
+
+void sb_timer_restart(sb_timer_t *t)
+{
+  sb_timer_reset(t);
+  t->time_start = sb_timer_now();
   t->time_split = t->time_start;
   t->state = TIMER_RUNNING;
 }
@@ -155,7 +271,7 @@ unsigned long long  sb_timer_value(sb_timer_t *t)
 
 unsigned long long sb_timer_split(sb_timer_t *t)
 {
-  struct timespec    tmp;
+  sb_time_t          tmp;
   unsigned long long res;
 
   switch (t->state) {
@@ -163,7 +279,7 @@ unsigned long long sb_timer_split(sb_timer_t *t)
       log_text(LOG_WARNING, "timer was never started");
       return 0;
     case TIMER_STOPPED:
-      res = TIMESPEC_DIFF(t->time_end, t->time_split);
+      res = sb_time_diff(t->time_end, t->time_split);
       t->time_split = t->time_end;
       if (res)
         return res;
@@ -179,9 +295,9 @@ unsigned long long sb_timer_split(sb_timer_t *t)
       abort();
   }
 
-  SB_GETTIME(&tmp);
-  t->elapsed = TIMESPEC_DIFF(tmp, t->time_start);
-  res = TIMESPEC_DIFF(tmp, t->time_split);
+  tmp = sb_timer_now();
+  t->elapsed = sb_time_diff(tmp, t->time_start);
+  res = sb_time_diff(tmp, t->time_split);
   t->time_split = tmp;
 
   return res;
@@ -252,30 +368,3 @@ sb_timer_t merge_timers(sb_timer_t *t1, sb_timer_t *t2)
   return t;       
 }
 
-
-/* Add a number of nanoseconds to a struct timespec */
-
-
-void add_ns_to_timespec(struct timespec *dest, long long delta)
-{
-  long long x;
-
-  x = dest->tv_nsec + delta;
-  if (x > 1000000000)
-  {
-    /* Future second */
-    dest->tv_sec += x / 1000000000;
-    dest->tv_nsec = x % 1000000000;
-  }
-  else if (x < 0)
-  {
-    /* Past second */
-    dest->tv_sec = dest->tv_sec - 1 + (x / 1000000000);
-    dest->tv_nsec = (x % 1000000000) + 1000000000;
-  }
-  else
-  {
-    /* Within the same second */
-    dest->tv_nsec = x;
-  }
-}
@@ -49,7 +49,7 @@
 #define TIMESPEC_DIFF(a,b) (SEC2NS(a.tv_sec - b.tv_sec) + \
 			    (a.tv_nsec - b.tv_nsec))
 
-/* Wrapper over various *gettime* functions */
+/* Wrapper over various *gettime* functions, returns the wall clock time */
 #ifdef HAVE_CLOCK_GETTIME
 # define SB_GETTIME(tsp) clock_gettime(CLOCK_REALTIME, tsp)
 #else
@@ -62,6 +62,95 @@
   } while (0)
 #endif
 
+/* TSC is only supported on x86 with GCC-compatible compilers */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define SB_HAVE_TSC
+#endif
+
+/* Clock sources for event timing, selected with --timer */
+typedef enum
+{
+  SB_TIMER_MONOTONIC,
+  SB_TIMER_MONOTONIC_RAW,
+  SB_TIMER_TSC
+} sb_timer_source_t;
+
+/*
+  Raw timestamp of the selected clock source: nanoseconds for clock_gettime()
+  based sources, CPU cycles for TSC. Timestamps are only meaningful relative
+  to each other and are converted to nanoseconds with sb_time_diff().
+*/
+typedef unsigned long long sb_time_t;
+
+extern sb_timer_source_t sb_timer_source;
+
+/* Nanoseconds per TSC tick, calibrated by sb_timer_source_init() */
+extern double sb_timer_tsc_ns;
+
+#ifdef HAVE_CLOCK_GETTIME
+extern clockid_t sb_timer_clock_id;
+#endif
+
+#ifdef SB_HAVE_TSC
+static inline unsigned long long sb_rdtsc(void)
+{
+  unsigned int lo, hi;
+
+  __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+
+  return ((unsigned long long) hi << 32) | lo;
+}
+#endif
+
+/* Get the current timestamp of the selected clock source */
+static inline sb_time_t sb_timer_now(void)
+{
+#ifdef HAVE_CLOCK_GETTIME
+  struct timespec ts;
+#else
+  struct timeval  tv;
+#endif
+
+#ifdef SB_HAVE_TSC
+  if (sb_timer_source == SB_TIMER_TSC)
+    return sb_rdtsc();
+#endif
+
+#ifdef HAVE_CLOCK_GETTIME
+  clock_gettime(sb_timer_clock_id, &ts);
+  return SEC2NS((unsigned long long) ts.tv_sec) + ts.tv_nsec;
+#else
+  gettimeofday(&tv, NULL);
+  return SEC2NS((unsigned long long) tv.tv_sec) + tv.tv_usec * 1000ULL;
+#endif
+}
+
+/* Difference between two timestamps in nanoseconds */
+static inline long long sb_time_diff(sb_time_t a, sb_time_t b)
+{
+  long long delta = (long long) (a - b);
+
+  if (sb_timer_source == SB_TIMER_TSC)
+    return (long long) (delta * sb_timer_tsc_ns);
+
+  return delta;
+}
+
+/* Convert a number of nanoseconds to a timestamp delta */
+static inline sb_time_t sb_ns_to_time(long long ns)
+{
+  if (sb_timer_source == SB_TIMER_TSC)
+    return (sb_time_t) (long long) (ns / sb_timer_tsc_ns);
+
+  return (sb_time_t) ns;
+}
+
+/*
+  Select the clock source by name {monotonic,monotonic_raw,tsc} and calibrate
+  TSC if required.
+*/
+int sb_timer_source_init(const char *name);
+
 typedef enum {TIMER_UNINITIALIZED, TIMER_INITIALIZED, TIMER_STOPPED, \
               TIMER_RUNNING} timer_state_t;
 
@@ -69,9 +158,9 @@ typedef enum {TIMER_UNINITIALIZED, TIMER_INITIALIZED, TIMER_STOPPED, \
 
 typedef struct
 {
-  struct timespec    time_start;
-  struct timespec    time_end;
-  struct timespec    time_split;
+  sb_time_t          time_start;
+  sb_time_t          time_end;
+  sb_time_t          time_split;
   unsigned long long elapsed;
   unsigned long long min_time;
   unsigned long long max_time;
@@ -98,6 +187,9 @@ void sb_timer_start(sb_timer_t *);
 /* stop timer */
 void sb_timer_stop(sb_timer_t *);
 
+/* restart a running timer from the current time, discarding its counters */
+void sb_timer_restart(sb_timer_t *);
+
 /* get the current timer value in nanoseconds */
 unsigned long long sb_timer_value(sb_timer_t *);
 
@@ -123,7 +215,4 @@ unsigned long long  get_max_time(sb_timer_t *);
 /* sum data from two timers. used in summing data from multiple threads */
 sb_timer_t merge_timers(sb_timer_t *, sb_timer_t *);
 
-/* add a number of nanoseconds to a struct timespec */
-void add_ns_to_timespec(struct timespec *dest, long long delta);
-
 #endif /* SB_TIMER_H */
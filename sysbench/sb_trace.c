@@ -0,0 +1,676 @@
+/* Copyright (C) 2011 Alexey Kopytov.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+#ifdef _WIN32
+#include "sb_win.h"
+#endif
+
+#ifdef STDC_HEADERS
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+#endif
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifdef HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
+#ifdef HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
+
+#include "sysbench.h"
+#include "sb_trace.h"
+#include "sb_atomic.h"
+#include "sb_logger.h"
+#include "sb_options.h"
+#include "sb_percentile.h"
+
+/* How often the background writer flushes ring buffers, in microseconds */
+#define TRACE_FLUSH_INTERVAL 10000
+
+/* Number of records read at once by the 'trace' command */
+#define TRACE_READ_BATCH 4096
+
+/* Upper bound for durations in the 'trace' command histogram, ns */
+#define TRACE_MAX_VALUE 1E13
+
+/*
+  Single-producer/single-consumer ring of trace records. 'head' is only
+  updated by the owning worker thread, 'tail' only by the background writer.
+  They are kept on separate cache lines so that the writer does not steal
+  the line the worker writes on each event.
+*/
+
+typedef struct
+{
+  sb_trace_record_t  *records;
+  unsigned long long head;
+  unsigned long long tail_cache;  /* last observed value of 'tail' */
+  unsigned long long dropped;
+  char               pad1[SB_CACHELINE_SIZE - sizeof(void *) -
+                          3 * sizeof(unsigned long long)];
+  unsigned long long tail;
+  char               pad2[SB_CACHELINE_SIZE - sizeof(unsigned long long)];
+} trace_ring_t;
+
+int sb_trace_enabled;
+
+SB_THREAD_LOCAL unsigned short sb_trace_req_type;
+SB_THREAD_LOCAL unsigned short sb_trace_op;
+
+static trace_ring_t       *rings;
+static unsigned int       num_rings;
+static unsigned long long ring_size;   /* records per ring, a power of 2 */
+static size_t             ring_bytes;
+static int                rings_mapped;
+
+static FILE               *trace_file;
+static char               *trace_name;
+static sb_trace_header_t  trace_header;
+static sb_time_t          trace_start;
+
+static pthread_t          writer_thread;
+static volatile int       writer_stop;
+
+/* Names of request types in the CSV output, indexed by sb_request_type_t */
+static const char *req_type_names[] =
+{
+  "null", "cpu", "memory", "file", "sql", "threads", "mutex", "script"
+};
+
+static void *trace_writer_proc(void *arg);
+static int flush_rings(void);
+static void *alloc_ring(size_t size);
+static void free_ring(void *ptr, size_t size);
+
+
+int sb_trace_init(const char *testname)
+{
+  unsigned long long size;
+  unsigned int       i;
+  struct timespec    wall_time;
+
+  trace_name = sb_get_value_string("event-trace");
+  if (trace_name == NULL || *trace_name == '\0')
+    return 0;
+
+  size = sb_get_value_size("event-trace-buffer") / sizeof(sb_trace_record_t);
+  if (size < 2)
+  {
+    log_text(LOG_FATAL, "Invalid value for --event-trace-buffer: must be at "
+             "least %u bytes", (unsigned int) (2 * sizeof(sb_trace_record_t)));
+    return 1;
+  }
+  /* Round down to a power of 2 so that positions can be masked */
+  for (ring_size = 1; ring_size * 2 <= size; ring_size *= 2)
+    ;
+  ring_bytes = ring_size * sizeof(sb_trace_record_t);
+
+  trace_file = fopen(trace_name, "wb");
+  if (trace_file == NULL)
+  {
+    log_errno(LOG_FATAL, "Cannot open trace file '%s'", trace_name);
+    return 1;
+  }
+
+  num_rings = sb_globals.num_threads;
+  rings = (trace_ring_t *) calloc(num_rings, sizeof(trace_ring_t));
+  if (rings == NULL)
+  {
+    log_text(LOG_FATAL, "Memory allocation failure");
+    return 1;
+  }
+  for (i = 0; i < num_rings; i++)
+  {
+    rings[i].records = (sb_trace_record_t *) alloc_ring(ring_bytes);
+    if (rings[i].records == NULL)
+    {
+      log_errno(LOG_FATAL, "Cannot allocate %llu bytes for the trace buffer",
+                (unsigned long long) ring_bytes);
+      return 1;
+    }
+  }
+
+  SB_GETTIME(&wall_time);
+  trace_start = sb_timer_now();
+
+  memset(&trace_header, 0, sizeof(trace_header));
+  memcpy(trace_header.magic, SB_TRACE_MAGIC, sizeof(SB_TRACE_MAGIC));
+  trace_header.version = SB_TRACE_VERSION;
+  trace_header.record_size = sizeof(sb_trace_record_t);
+  trace_header.num_threads = num_rings;
+  trace_header.start_time = SEC2NS((unsigned long long) wall_time.tv_sec) +
+    wall_time.tv_nsec;
+  snprintf(trace_header.test, sizeof(trace_header.test), "%s", testname);
+
+  if (fwrite(&trace_header, sizeof(trace_header), 1, trace_file) != 1)
+  {
+    log_errno(LOG_FATAL, "Cannot write to trace file '%s'", trace_name);
+    return 1;
+  }
+
+  writer_stop = 0;
+  if (pthread_create(&writer_thread, NULL, trace_writer_proc, NULL))
+  {
+    log_errno(LOG_FATAL, "pthread_create() for the trace writer failed");
+    return 1;
+  }
+
+  sb_trace_enabled = 1;
+
+  return 0;
+}
+
+
+/*
+  Append a record to the ring of the calling thread. This is executed for
+  each event, so it only touches the thread's own cache lines unless the ring
+  looks full.
+*/
+
+void sb_trace_event(int thread_id, sb_time_t start,
+                    unsigned long long duration)
+{
+  trace_ring_t       *ring = &rings[thread_id];
+  sb_trace_record_t  *rec;
+  unsigned long long head = ring->head;
+  long long          offset;
+
+  if (head - ring->tail_cache >= ring_size)
+  {
+    ring->tail_cache = sb_atomic_load_u64_acquire(&ring->tail);
+    if (head - ring->tail_cache >= ring_size)
+    {
+      ring->dropped++;
+      return;
+    }
+  }
+
+  offset = sb_time_diff(start, trace_start);
+
+  rec = &ring->records[head & (ring_size - 1)];
+  rec->start = offset > 0 ? (unsigned long long) offset : 0;
+  rec->duration = duration;
+  rec->thread_id = (unsigned int) thread_id;
+  rec->req_type = sb_trace_req_type;
+  rec->op = sb_trace_op;
+
+  sb_atomic_store_u64_release(&ring->head, head + 1);
+}
+
+
+void sb_trace_done(void)
+{
+  unsigned int i;
+
+  if (!sb_trace_enabled)
+    return;
+
+  writer_stop = 1;
+  pthread_join(writer_thread, NULL);
+  sb_trace_enabled = 0;
+
+  /* Worker threads are done at this point, pick up whatever is left */
+  flush_rings();
+
+  for (i = 0; i < num_rings; i++)
+  {
+    trace_header.dropped += rings[i].dropped;
+    free_ring(rings[i].records, ring_bytes);
+  }
+  free(rings);
+  rings = NULL;
+
+  if (fseek(trace_file, 0, SEEK_SET) ||
+      fwrite(&trace_header, sizeof(trace_header), 1, trace_file) != 1)
+    log_errno(LOG_FATAL, "Cannot write to trace file '%s'", trace_name);
+  fclose(trace_file);
+  trace_file = NULL;
+
+  log_text(LOG_NOTICE, "Event trace: %llu records written to '%s', "
+           "%llu dropped", trace_header.records, trace_name,
+           trace_header.dropped);
+  if (trace_header.dropped > 0)
+    log_text(LOG_WARNING, "Some events were not traced, consider increasing "
+             "--event-trace-buffer");
+}
+
+
+/* Background writer, periodically moves records from rings to the file */
+
+static void *trace_writer_proc(void *arg)
+{
+  (void) arg; /* unused */
+
+  while (!writer_stop)
+  {
+    usleep(TRACE_FLUSH_INTERVAL);
+    if (flush_rings())
+      break;
+  }
+
+  return NULL;
+}
+
+
+/* Write all published records to the trace file */
+
+static int flush_rings(void)
+{
+  trace_ring_t       *ring;
+  unsigned long long head;
+  unsigned long long tail;
+  unsigned long long n;
+  unsigned int       i;
+
+  for (i = 0; i < num_rings; i++)
+  {
+    ring = &rings[i];
+    head = sb_atomic_load_u64_acquire(&ring->head);
+    tail = ring->tail;
+
+    while (tail < head)
+    {
+      /* Write up to the end of the buffer, wrap around on the next pass */
+      n = ring_size - (tail & (ring_size - 1));
+      if (n > head - tail)
+        n = head - tail;
+
+      if (fwrite(ring->records + (tail & (ring_size - 1)),
+                 sizeof(sb_trace_record_t), n, trace_file) != n)
+      {
+        log_errno(LOG_FATAL, "Cannot write to trace file '%s'", trace_name);
+        return 1;
+      }
+      tail += n;
+      trace_header.records += n;
+      sb_atomic_store_u64_release(&ring->tail, tail);
+    }
+  }
+
+  return 0;
+}
+
+
+/*
+  Allocate a ring buffer. Anonymous mappings are prefaulted when possible so
+  that workers do not take page faults on their first pass over the ring.
+*/
+
+static void *alloc_ring(size_t size)
+{
+#if defined(HAVE_SYS_MMAN_H) && defined(MAP_ANONYMOUS)
+  void *ptr;
+  int  flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+# ifdef MAP_POPULATE
+  flags |= MAP_POPULATE;
+# endif
+  ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, -1, 0);
+  if (ptr != MAP_FAILED)
+  {
+    rings_mapped = 1;
+    return ptr;
+  }
+  return NULL;
+#else
+  return calloc(1, size);
+#endif
+}
+
+
+static void free_ring(void *ptr, size_t size)
+{
+  if (ptr == NULL)
+    return;
+#if defined(HAVE_SYS_MMAN_H) && defined(MAP_ANONYMOUS)
+  if (rings_mapped)
+  {
+    munmap(ptr, size);
+    return;
+  }
+#else
+  (void) size; /* unused */
+#endif
+  free(ptr);
+}
+
+
+/* Statistics collected by the 'trace' command */
+
+typedef struct
+{
+  unsigned long long events;
+  unsigned long long sum;
+  unsigned long long min;
+  unsigned long long max;
+  unsigned long long first;   /* earliest event start */
+  unsigned long long last;    /* latest event end */
+  unsigned long long span;    /* sum of time spans of merged runs */
+} trace_stats_t;
+
+
+static void stats_init(trace_stats_t *stats)
+{
+  memset(stats, 0, sizeof(trace_stats_t));
+  stats->min = (unsigned long long) -1;
+  stats->first = (unsigned long long) -1;
+}
+
+
+static void stats_update(trace_stats_t *stats, const sb_trace_record_t *rec)
+{
+  stats->events++;
+  stats->sum += rec->duration;
+  if (rec->duration < stats->min)
+    stats->min = rec->duration;
+  if (rec->duration > stats->max)
+    stats->max = rec->duration;
+  if (rec->start < stats->first)
+    stats->first = rec->start;
+  if (rec->start + rec->duration > stats->last)
+    stats->last = rec->start + rec->duration;
+}
+
+
+static void stats_merge(trace_stats_t *to, const trace_stats_t *from)
+{
+  if (from->events == 0)
+    return;
+  /* Runs have independent time bases, so only their durations add up */
+  to->span += from->last - from->first;
+  to->events += from->events;
+  to->sum += from->sum;
+  if (from->min < to->min)
+    to->min = from->min;
+  if (from->max > to->max)
+    to->max = from->max;
+  if (from->first < to->first)
+    to->first = from->first;
+  if (from->last > to->last)
+    to->last = from->last;
+}
+
+
+static void print_trace_stats(const char *title, trace_stats_t *stats,
+                              sb_percentile_t *hist)
+{
+  double       values[MAX_PERCENTILES];
+  double       span;
+  unsigned int i;
+  char         label[32];
+
+  log_text(LOG_NOTICE, "%s", title);
+  log_text(LOG_NOTICE, "    events:                              %llu",
+           stats->events);
+  if (stats->events == 0)
+    return;
+
+  span = NS2SEC((double) (stats->span > 0 ? stats->span :
+                          stats->last - stats->first));
+  log_text(LOG_NOTICE, "    time span:                           %.4fs", span);
+  if (span > 0)
+    log_text(LOG_NOTICE, "    events per second:                   %.2f",
+             stats->events / span);
+  log_text(LOG_NOTICE, "    min:                            %10.2fms",
+           NS2MS((double) stats->min));
+  log_text(LOG_NOTICE, "    avg:                            %10.2fms",
+           NS2MS((double) stats->sum / stats->events));
+  log_text(LOG_NOTICE, "    max:                            %10.2fms",
+           NS2MS((double) stats->max));
+
+  sb_percentile_calculate_multi(hist, sb_globals.percentiles, values,
+                                sb_globals.n_percentiles, NULL);
+  sb_percentile_clamp(values, sb_globals.n_percentiles, (double) stats->max);
+  for (i = 0; i < sb_globals.n_percentiles; i++)
+  {
+    snprintf(label, sizeof(label), "%g%%", sb_globals.percentiles[i]);
+    log_text(LOG_NOTICE, "    approx. %6s percentile:      %10.2fms",
+             label, NS2MS(values[i]));
+  }
+}
+
+
+/* Parse --trace-window into a range of offsets from the trace start, ns */
+
+static int parse_window(unsigned long long *from, unsigned long long *to)
+{
+  sb_list_t      *list;
+  sb_list_item_t *pos;
+  value_t        *val;
+  double         bounds[2];
+  unsigned int   n = 0;
+
+  *from = 0;
+  *to = (unsigned long long) -1;
+
+  list = sb_get_value_list("trace-window");
+  SB_LIST_FOR_EACH(pos, list)
+  {
+    char *endptr;
+
+    val = SB_LIST_ENTRY(pos, value_t, listitem);
+    if (n == 2)
+    {
+      log_text(LOG_FATAL, "Invalid value for --trace-window: expected "
+               "<from>,<to>");
+      return 1;
+    }
+    bounds[n] = strtod(val->data, &endptr);
+    if (*endptr != '\0' || bounds[n] < 0)
+    {
+      log_text(LOG_FATAL, "Invalid value for --trace-window: '%s'",
+               val->data);
+      return 1;
+    }
+    n++;
+  }
+
+  if (n > 0)
+    *from = (unsigned long long) (bounds[0] * 1E9);
+  if (n > 1)
+  {
+    if (bounds[1] <= bounds[0])
+    {
+      log_text(LOG_FATAL, "Invalid value for --trace-window: the end of the "
+               "window must be greater than its start");
+      return 1;
+    }
+    *to = (unsigned long long) (bounds[1] * 1E9);
+  }
+
+  return 0;
+}
+
+
+/* Read a trace file, update statistics and write CSV rows for each record */
+
+static int read_trace(const char *name, unsigned int run, FILE *csv,
+                      unsigned long long from, unsigned long long to,
+                      trace_stats_t *stats, sb_percentile_t *run_hist,
+                      sb_percentile_t *all_hist)
+{
+  FILE               *fp;
+  sb_trace_header_t  header;
+  sb_trace_record_t  *recs;
+  size_t             n, i;
+  unsigned long long nread = 0;
+  const char         *type;
+  int                rc = 1;
+
+  fp = fopen(name, "rb");
+  if (fp == NULL)
+  {
+    log_errno(LOG_FATAL, "Cannot open trace file '%s'", name);
+    return 1;
+  }
+
+  if (fread(&header, sizeof(header), 1, fp) != 1 ||
+      memcmp(header.magic, SB_TRACE_MAGIC, sizeof(SB_TRACE_MAGIC)))
+  {
+    log_text(LOG_FATAL, "'%s' is not a sysbench trace file", name);
+    goto end;
+  }
+  if (header.version != SB_TRACE_VERSION ||
+      header.record_size != sizeof(sb_trace_record_t))
+  {
+    log_text(LOG_FATAL, "Unsupported format of trace file '%s' "
+             "(version %u, record size %u)", name, header.version,
+             header.record_size);
+    goto end;
+  }
+  header.test[sizeof(header.test) - 1] = '\0';
+
+  recs = (sb_trace_record_t *) malloc(TRACE_READ_BATCH * sizeof(*recs));
+  if (recs == NULL)
+  {
+    log_text(LOG_FATAL, "Memory allocation failure");
+    goto end;
+  }
+
+  while ((n = fread(recs, sizeof(*recs), TRACE_READ_BATCH, fp)) > 0)
+  {
+    nread += n;
+    for (i = 0; i < n; i++)
+    {
+      if (recs[i].start < from || recs[i].start >= to)
+        continue;
+
+      stats_update(stats, recs + i);
+      sb_percentile_update(run_hist, recs[i].duration);
+      sb_percentile_update(all_hist, recs[i].duration);
+
+      if (csv == NULL)
+        continue;
+      type = recs[i].req_type <
+        sizeof(req_type_names) / sizeof(req_type_names[0]) ?
+        req_type_names[recs[i].req_type] : "unknown";
+      fprintf(csv, "%u,%u,%s,%u,%llu,%llu\n", run, recs[i].thread_id, type,
+              (unsigned int) recs[i].op, recs[i].start, recs[i].duration);
+    }
+  }
+  free(recs);
+
+  if (ferror(fp))
+  {
+    log_errno(LOG_FATAL, "Cannot read trace file '%s'", name);
+    goto end;
+  }
+
+  log_text(LOG_NOTICE, "Run %u: '%s', test: %s, threads: %u, records: %llu, "
+           "dropped: %llu", run, name, header.test, header.num_threads,
+           nread, header.dropped);
+  if (nread != header.records)
+    log_text(LOG_WARNING, "'%s' contains %llu records, %llu expected. "
+             "The trace may be truncated", name, nread, header.records);
+
+  rc = 0;
+
+end:
+  fclose(fp);
+
+  return rc;
+}
+
+
+int sb_trace_report(void)
+{
+  sb_list_t          *list;
+  sb_list_item_t     *pos;
+  value_t            *val;
+  char               *csv_name;
+  FILE               *csv = NULL;
+  sb_percentile_t    run_hist;
+  sb_percentile_t    all_hist;
+  trace_stats_t      run_stats;
+  trace_stats_t      all_stats;
+  unsigned long long from, to;
+  unsigned int       run = 0;
+  char               title[64];
+  int                rc = 1;
+
+  list = sb_get_value_list("trace-files");
+  if (SB_LIST_IS_EMPTY(list))
+  {
+    log_text(LOG_FATAL, "Missing required argument: --trace-files");
+    return 1;
+  }
+
+  if (parse_window(&from, &to))
+    return 1;
+
+  csv_name = sb_get_value_string("trace-csv");
+  if (csv_name != NULL && *csv_name != '\0')
+  {
+    if (!strcmp(csv_name, "-"))
+      csv = stdout;
+    else if ((csv = fopen(csv_name, "w")) == NULL)
+    {
+      log_errno(LOG_FATAL, "Cannot open CSV file '%s'", csv_name);
+      return 1;
+    }
+    fprintf(csv, "run,thread_id,req_type,op,start_ns,duration_ns\n");
+  }
+
+  if (sb_percentile_init(&run_hist, sb_globals.histogram_digits,
+                         TRACE_MAX_VALUE))
+    goto end;
+  if (sb_percentile_init(&all_hist, sb_globals.histogram_digits,
+                         TRACE_MAX_VALUE))
+  {
+    sb_percentile_done(&run_hist);
+    goto end;
+  }
+
+  stats_init(&all_stats);
+
+  SB_LIST_FOR_EACH(pos, list)
+  {
+    val = SB_LIST_ENTRY(pos, value_t, listitem);
+
+    stats_init(&run_stats);
+    sb_percentile_reset(&run_hist);
+    if (read_trace(val->data, ++run, csv, from, to, &run_stats, &run_hist,
+                   &all_hist))
+      goto end_hist;
+
+    snprintf(title, sizeof(title), "Run %u statistics:", run);
+    print_trace_stats(title, &run_stats, &run_hist);
+    log_text(LOG_NOTICE, "");
+    stats_merge(&all_stats, &run_stats);
+  }
+
+  if (run > 1)
+    print_trace_stats("Merged statistics:", &all_stats, &all_hist);
+
+  rc = 0;
+
+end_hist:
+  sb_percentile_done(&run_hist);
+  sb_percentile_done(&all_hist);
+
+end:
+  if (csv != NULL && csv != stdout)
+    fclose(csv);
+
+  return rc;
+}
@@ -0,0 +1,97 @@
+/* Copyright (C) 2011 Alexey Kopytov.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+#ifndef SB_TRACE_H
+#define SB_TRACE_H
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "sysbench.h"
+
+/*
+  Per-event binary trace (--event-trace). Worker threads append fixed-size
+  records to their own ring buffers, a background thread writes them to the
+  trace file. Records are dropped rather than blocking a worker when its ring
+  is full, the number of dropped records is stored in the file header.
+*/
+
+#define SB_TRACE_MAGIC   "SBTRACE"
+#define SB_TRACE_VERSION 1
+
+/* Trace file header */
+typedef struct
+{
+  char               magic[8];
+  unsigned int       version;
+  unsigned int       record_size;
+  unsigned int       num_threads;
+  unsigned int       reserved;
+  unsigned long long start_time;  /* trace start, ns since the Epoch */
+  unsigned long long records;     /* number of records in the file */
+  unsigned long long dropped;     /* number of records lost on overflows */
+  char               test[32];    /* test name */
+} sb_trace_header_t;
+
+/* Trace record, one per event */
+typedef struct
+{
+  unsigned long long start;       /* event start, ns since the trace start */
+  unsigned long long duration;    /* event duration, ns */
+  unsigned int       thread_id;
+  unsigned short     req_type;    /* sb_request_type_t of the event */
+  unsigned short     op;          /* test-specific operation type */
+} sb_trace_record_t;
+
+/* Non-zero if tracing is enabled */
+extern int sb_trace_enabled;
+
+/* Types of the event being executed by the current thread */
+extern SB_THREAD_LOCAL unsigned short sb_trace_req_type;
+extern SB_THREAD_LOCAL unsigned short sb_trace_op;
+
+/* Set the request type of events executed by the current thread */
+#define SB_TRACE_SET_TYPE(type)    \
+  do                               \
+  {                                \
+    sb_trace_req_type = (type);    \
+    sb_trace_op = 0;               \
+  } while (0)
+
+/* Set the test-specific operation type of the current event */
+#define SB_TRACE_SET_OP(op) sb_trace_op = (op)
+
+/*
+  Open the trace file specified with --event-trace and start the background
+  writer. Does nothing if tracing is not requested.
+*/
+int sb_trace_init(const char *testname);
+
+/*
+  Record an event of a worker thread which started at 'start' and took
+  'duration' nanoseconds.
+*/
+void sb_trace_event(int thread_id, sb_time_t start,
+                    unsigned long long duration);
+
+/* Flush all pending records and close the trace file */
+void sb_trace_done(void);
+
+/* Implementation of the 'trace' command, reads and analyzes trace files */
+int sb_trace_report(void);
+
+#endif /* SB_TRACE_H */
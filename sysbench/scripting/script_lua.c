@@ -88,18 +88,22 @@ typedef struct {
 
 static lua_State **states;
 
-/* Event counter */
-static unsigned int nevents;
+/* Name of the loaded script, used to create per-thread states */
+static const char *script_name;
+
+/* Whether the script defines the thread_init() function */
+static int has_thread_init;
 
 /* Lua test operations */
 
 static int sb_lua_init(void);
 static int sb_lua_done(void);
-static sb_request_t sb_lua_get_request(void);
+static sb_request_t sb_lua_get_request(int);
 static int sb_lua_op_execute_request(sb_request_t *, int);
 static int sb_lua_op_thread_init(int);
 static int sb_lua_op_thread_done(int);
 static void sb_lua_op_print_stats(sb_stat_t type);
+static void sb_lua_op_reset_stats(void);
 
 static sb_operations_t lua_ops = {
    &sb_lua_init,
@@ -111,7 +115,8 @@ static sb_operations_t lua_ops = {
    NULL,
    NULL,
    NULL,
-   &sb_lua_done
+   &sb_lua_done,
+   &sb_lua_op_reset_stats
 };
 
 /* Main (global) interpreter state */
@@ -171,8 +176,6 @@ unsigned int sb_lua_table_size(lua_State *, int);
 
 int script_load_lua(const char *testname, sb_test_t *test)
 {
-  unsigned int i;
-
   /* Initialize global interpreter state */
   gstate = sb_lua_new_state(testname, -1);
   if (gstate == NULL)
@@ -195,9 +198,10 @@ int script_load_lua(const char *testname, sb_test_t *test)
   /* Test operations */
   test->ops = lua_ops;
 
+  /* Per-thread states are created by worker threads in thread_init */
   lua_getglobal(gstate, THREAD_INIT_FUNC);
-  if (!lua_isnil(gstate, -1))
-    test->ops.thread_init = &sb_lua_op_thread_init;
+  has_thread_init = !lua_isnil(gstate, -1);
+  test->ops.thread_init = &sb_lua_op_thread_init;
 
   lua_getglobal(gstate, THREAD_DONE_FUNC);
   if (!lua_isnil(gstate, -1))
@@ -206,51 +210,45 @@ int script_load_lua(const char *testname, sb_test_t *test)
 
   test->ops.print_stats = &sb_lua_op_print_stats;
   
-  /* Initialize per-thread interpreters */
-  states = (lua_State **)calloc(sb_globals.num_threads, sizeof(lua_State *));
-  if (states == NULL)
-    goto error;
-  for (i = 0; i < sb_globals.num_threads; i++)
-  {
-    states[i] = sb_lua_new_state(testname, i);
-    if (states[i] == NULL)
-      goto error;
-  }
+  script_name = testname;
   
   return 0;
 
  error:
 
   sb_lua_close_state(gstate);
-  if (states != NULL)
-  {
-    for (i = 0; i < sb_globals.num_threads; i++)
-      sb_lua_close_state(states[i]);
-    free(states);
-  }
   
   return 1;
 }
 
-/* Initialize Lua script */
+/*
+  Initialize Lua script. Per-thread states are created by worker threads in
+  sb_lua_op_thread_init() and destroyed in sb_lua_done().
+*/
 
 int sb_lua_init(void)
 {
+  states = (lua_State **)calloc(sb_globals.num_threads, sizeof(lua_State *));
+  if (states == NULL)
+  {
+    log_text(LOG_FATAL, "Memory allocation failure.");
+    return 1;
+  }
+
   return 0;
 }
 
-sb_request_t sb_lua_get_request(void)
+sb_request_t sb_lua_get_request(int thread_id)
 {
   sb_request_t req;
 
-  if (sb_globals.max_requests != 0 && nevents >= sb_globals.max_requests)
+  if (!sb_more_requests(thread_id))
   {
     req.type = SB_REQ_TYPE_NULL;
     return req;
   }
 
   req.type = SB_REQ_TYPE_SCRIPT;
-  nevents++;
   
   return req;
 }
@@ -299,8 +297,6 @@ int sb_lua_op_execute_request(sb_request_t *sb_req, int thread_id)
       
   LOG_EVENT_STOP(msg, thread_id);
 
-  sb_percentile_update(&local_percentile, sb_timer_value(&timers[thread_id]));
-
   return 0;
 }
 
@@ -308,6 +304,17 @@ int sb_lua_op_thread_init(int thread_id)
 {
   sb_lua_ctxt_t *ctxt;
 
+  /*
+    Create the interpreter state from the worker thread, so that its memory
+    is placed according to the thread's CPU affinity and NUMA policy
+  */
+  states[thread_id] = sb_lua_new_state(script_name, thread_id);
+  if (states[thread_id] == NULL)
+    return 1;
+
+  if (!has_thread_init)
+    return 0;
+
   ctxt = sb_lua_get_context(states[thread_id]);
 
   if (ctxt->con == NULL)
@@ -346,14 +353,23 @@ void sb_lua_op_print_stats(sb_stat_t type)
     db_print_stats(type);
 }
 
+void sb_lua_op_reset_stats(void)
+{
+  /* check if db driver has been initialized */
+  if (db_driver != NULL)
+    db_reset_stats();
+}
+
 int sb_lua_done(void)
 {
   unsigned int i;
 
   for (i = 0; i < sb_globals.num_threads; i++)
-    lua_close(states[i]);
+    if (states[i] != NULL)
+      lua_close(states[i]);
 
   free(states);
+  states = NULL;
   
   return 0;
 }
@@ -65,6 +65,10 @@
 
 #include "sysbench.h"
 #include "sb_options.h"
+#include "sb_atomic.h"
+#include "sb_affinity.h"
+#include "sb_output.h"
+#include "sb_trace.h"
 #include "scripting/sb_script.h"
 #include "db_driver.h"
 
@@ -73,14 +77,45 @@
 /* Large prime number to generate unique random IDs */
 #define LARGE_PRIME 2147483647
 
+/* Maximum number of pending transactions in the open-loop dispatcher queue */
+#define TX_QUEUE_SIZE 65536
+
+/* Transaction arrival distributions for --tx-rate */
+typedef enum
+{
+  TX_DIST_CONSTANT,
+  TX_DIST_POISSON
+} tx_dist_t;
+
 /* Random numbers distributions */
 typedef enum
 {
   DIST_TYPE_UNIFORM,
   DIST_TYPE_GAUSSIAN,
-  DIST_TYPE_SPECIAL
+  DIST_TYPE_SPECIAL,
+  DIST_TYPE_ZIPFIAN,
+  DIST_TYPE_PARETO,
+  DIST_TYPE_HOTSPOT,
+  DIST_TYPE_LATEST
 } rand_dist_t;
 
+/* Random numbers distributions available with --rand-type */
+static struct {
+  const char     *name;
+  rand_dist_t    type;
+  sb_rand_func_t func;
+} rand_dists[] =
+{
+  {"uniform", DIST_TYPE_UNIFORM, &sb_rand_uniform},
+  {"gaussian", DIST_TYPE_GAUSSIAN, &sb_rand_gaussian},
+  {"special", DIST_TYPE_SPECIAL, &sb_rand_special},
+  {"zipfian", DIST_TYPE_ZIPFIAN, &sb_rand_zipfian},
+  {"pareto", DIST_TYPE_PARETO, &sb_rand_pareto},
+  {"hotspot", DIST_TYPE_HOTSPOT, &sb_rand_hotspot},
+  {"latest", DIST_TYPE_LATEST, &sb_rand_latest},
+  {NULL, DIST_TYPE_UNIFORM, NULL}
+};
+
 /* If we should initialize random numbers generator */
 static int rand_init;
 static rand_dist_t rand_type;
@@ -88,28 +123,92 @@ static int (*rand_func)(int, int); /* pointer to random numbers generator */
 static unsigned int rand_iter;
 static unsigned int rand_pct;
 static unsigned int rand_res;
+static double zipf_exp;
+static double pareto_power;
+static unsigned int hotspot_pct;
+static unsigned int hotspot_ops;
+
+/*
+  Constants for zipfian numbers generation. They only depend on the range
+  size, and are cached per thread for the most recently used range.
+*/
+typedef struct
+{
+  unsigned int n;          /* range size */
+  double       h_x1;       /* H(1.5) - 1 */
+  double       h_n;        /* H(n + 0.5) */
+  double       s;          /* rejection threshold */
+} zipf_state_t;
+
+static SB_THREAD_LOCAL zipf_state_t zipf_state;
 static int rand_seed; /* optional seed set on the command line */
 
-/* Random seed used to generate unique random numbers */
-static unsigned long long rnd_seed;
-/* Mutex to protect random seed */
-static pthread_mutex_t    rnd_mutex;
+/* Seed for per-thread random numbers generators */
+static unsigned long long rng_base_seed;
+/* Next ID for generators of non-worker threads */
+static unsigned long long rng_next_id;
+
+/* Counter used to generate unique random numbers */
+static unsigned long long rnd_uniq_counter;
+
+/* Per-thread cache of the sb_rand_uniq() multiplier for the last used range */
+static SB_THREAD_LOCAL unsigned int uniq_range;
+static SB_THREAD_LOCAL unsigned long long uniq_mult;
 
 /* Stack size for each thread */
 static int thread_stack_size;
 
+/* Distribution of transaction arrivals in open-loop mode */
+static tx_dist_t tx_dist;
+
+/*
+  Queue of intended start times for transactions generated by the
+  open-loop dispatcher (--tx-rate) and consumed by worker threads.
+*/
+static struct
+{
+  sb_time_t       *items;     /* ring buffer of pending transactions */
+  unsigned int    head;       /* index of the oldest item */
+  unsigned int    count;      /* number of queued items */
+  int             done;       /* set when the dispatcher must terminate */
+  pthread_mutex_t mutex;
+  pthread_cond_t  not_empty;
+  pthread_cond_t  not_full;
+} tx_queue;
+
+/* Maximum number of requests a thread can claim from the limit at once */
+#define REQUEST_CHUNK_MAX 64
+
+/* Per-thread request accounting slots */
+static sb_thread_acct_t   *thread_acct;
+/* Limit for the total number of requests (0 - unlimited) */
+static unsigned long long request_limit;
+/* Number of requests claimed by all threads */
+static unsigned long long requests_claimed;
+/* Counter values at the moment of the last sb_counters_reset() call */
+static unsigned long long counters_base[SB_CNT_MAX];
+
 /* General options */
 sb_arg_t general_args[] =
 {
   {"num-threads", "number of threads to use", SB_ARG_TYPE_INT, "1"},
   {"max-requests", "limit for total number of requests", SB_ARG_TYPE_INT, "10000"},
   {"max-time", "limit for total execution time in seconds", SB_ARG_TYPE_INT, "0"},
+  {"warmup-time", "run the test for this many seconds before collecting "
+   "statistics. --max-time and --max-requests apply after the warmup",
+   SB_ARG_TYPE_INT, "0"},
   {"forced-shutdown", "amount of time to wait after --max-time before forcing shutdown",
    SB_ARG_TYPE_STRING, "off"},
   {"thread-stack-size", "size of stack per thread", SB_ARG_TYPE_SIZE, "64K"},
+  {"timer", "clock source for event timing {monotonic,monotonic_raw,tsc}. "
+   "tsc reads the CPU time stamp counter calibrated against the monotonic "
+   "clock at startup, which is cheaper for very short events",
+   SB_ARG_TYPE_STRING, "monotonic"},
   {"tx-rate", "target transaction rate (tps)", SB_ARG_TYPE_INT, "0"},
   {"tx-jitter", "target transaction variation, in microseconds",
     SB_ARG_TYPE_INT, "0"},
+  {"tx-dist", "distribution of transaction arrivals with --tx-rate "
+   "{constant,poisson}", SB_ARG_TYPE_STRING, "constant"},
   {"report-interval", "periodically report intermediate statistics "
    "with a specified interval in seconds. 0 disables intermediate reports",
     SB_ARG_TYPE_INT, "0"},
@@ -118,20 +217,52 @@ sb_arg_t general_args[] =
    "representing the amount of time in seconds elapsed from start of test "
    "when report checkpoint(s) must be performed. Report checkpoints are off by "
    "default.", SB_ARG_TYPE_LIST, ""},
+  {"output-format", "format of machine-readable reports written in addition "
+   "to the text output {text,json,csv}. json writes one object per line, "
+   "csv writes one 'type,source,time,name,value' row per value",
+   SB_ARG_TYPE_STRING, "text"},
+  {"output-file", "file for machine-readable reports (standard output by "
+   "default)", SB_ARG_TYPE_STRING, NULL},
+  {"threads-sweep", "run the test with each number of threads from a list of "
+   "comma-separated values, e.g. 1,2,4,8, and report scalability of all steps. "
+   "--num-threads is ignored in this mode", SB_ARG_TYPE_LIST, ""},
+  {"event-trace", "write a binary record of every event to the specified "
+   "file. Use the 'trace' command to analyze it", SB_ARG_TYPE_STRING, NULL},
+  {"event-trace-buffer", "size of the per-thread ring buffer for "
+   "--event-trace. Events are dropped when a buffer overflows",
+   SB_ARG_TYPE_SIZE, "4M"},
+  {"trace-files", "comma-separated list of trace files to analyze with the "
+   "'trace' command. Statistics of multiple files are also reported merged",
+   SB_ARG_TYPE_LIST, ""},
+  {"trace-csv", "convert analyzed traces to CSV and write them to the "
+   "specified file ('-' for standard output)", SB_ARG_TYPE_STRING, NULL},
+  {"trace-window", "only analyze events started within <from>,<to> seconds "
+   "since the start of each trace. <to> may be omitted", SB_ARG_TYPE_LIST, ""},
   {"test", "test to run", SB_ARG_TYPE_STRING, NULL},
   {"debug", "print more debugging info", SB_ARG_TYPE_FLAG, "off"},
   {"validate", "perform validation checks where possible", SB_ARG_TYPE_FLAG, "off"},
   {"help", "print help and exit", SB_ARG_TYPE_FLAG, NULL},
   {"version", "print version and exit", SB_ARG_TYPE_FLAG, "off"},
   {"rand-init", "initialize random number generator", SB_ARG_TYPE_FLAG, "off"},
-  {"rand-type", "random numbers distribution {uniform,gaussian,special}", SB_ARG_TYPE_STRING,
-   "special"},
+  {"rand-type", "random numbers distribution {uniform,gaussian,special,zipfian,pareto,hotspot,latest}",
+   SB_ARG_TYPE_STRING, "special"},
   {"rand-spec-iter", "number of iterations used for numbers generation", SB_ARG_TYPE_INT, "12"},
   {"rand-spec-pct", "percentage of values to be treated as 'special' (for special distribution)",
    SB_ARG_TYPE_INT, "1"},
   {"rand-spec-res", "percentage of 'special' values to use (for special distribution)",
    SB_ARG_TYPE_INT, "75"},
+  {"rand-zipfian-exp", "exponent for zipfian and latest distributions", SB_ARG_TYPE_FLOAT,
+   "0.8"},
+  {"rand-pareto-h", "parameter h for pareto distribution", SB_ARG_TYPE_FLOAT, "0.2"},
+  {"rand-hotspot-pct", "percentage of values in the hot set (for hotspot distribution)",
+   SB_ARG_TYPE_INT, "10"},
+  {"rand-hotspot-ops", "percentage of numbers drawn from the hot set (for hotspot distribution)",
+   SB_ARG_TYPE_INT, "90"},
   {"rand-seed", "seed for random number generator, ignored when 0", SB_ARG_TYPE_INT, "0"},
+  {"thread-affinity", "placement of worker threads on CPUs "
+   "{none,compact,scatter,node,<list of CPUs, e.g. 0-3,8>}", SB_ARG_TYPE_STRING, "none"},
+  {"numa-policy", "memory allocation policy of worker threads "
+   "{default,local,interleave,bind}", SB_ARG_TYPE_STRING, "default"},
   {NULL, NULL, SB_ARG_TYPE_NULL, NULL}
 };
 
@@ -143,12 +274,19 @@ sb_list_t        tests;
 
 /* Global variables */
 sb_globals_t     sb_globals;
+SB_THREAD_LOCAL int sb_thread_id = -1;
+SB_THREAD_LOCAL sb_rng_t sb_rng;
 sb_test_t        *current_test;
 
+/* Non-zero while the warmup phase is in progress */
+static volatile int warmup_running;
+
 /* Mutexes */
 
 /* used to start test with all threads ready */
 static pthread_mutex_t thread_start_mutex;
+/* serializes intermediate reports with the end of the test */
+static pthread_mutex_t report_mutex;
 static pthread_attr_t  thread_attr;
 
 static void print_header(void);
@@ -179,10 +317,9 @@ static void sigalrm_handler(int sig)
 static sb_request_t get_request(sb_test_t *test, int thread_id)
 { 
   sb_request_t r;
-  (void)thread_id; /* unused */
 
   if (test->ops.get_request != NULL)
-    r = test->ops.get_request();
+    r = test->ops.get_request(thread_id);
   else
   { 
     log_text(LOG_ALERT, "Unsupported mode! Creating NULL request.");
@@ -261,7 +398,7 @@ void print_usage(void)
     printf("  %s - %s\n", test->sname, test->lname);
   }
   printf("\n");
-  printf("Commands: prepare run cleanup help version\n\n");
+  printf("Commands: prepare run cleanup help version trace\n\n");
   printf("See 'sysbench --test=<name> help' for a list of options for each test.\n\n");
 }
 
@@ -278,6 +415,8 @@ static sb_cmd_t parse_command(char *cmd)
     return SB_COMMAND_CLEANUP;
   else if (!strcmp(cmd, "version"))
     return SB_COMMAND_VERSION;
+  else if (!strcmp(cmd, "trace"))
+    return SB_COMMAND_TRACE;
 
   return SB_COMMAND_NULL;
 }
@@ -357,12 +496,22 @@ void print_run_mode(sb_test_t *test)
 {
   log_text(LOG_NOTICE, "Running the test with following options:");
   log_text(LOG_NOTICE, "Number of threads: %d", sb_globals.num_threads);
+  sb_affinity_print_mode();
+
+  if (sb_globals.warmup_time > 0)
+    log_text(LOG_NOTICE, "Warmup time: %u seconds (excluded from statistics)",
+             sb_globals.warmup_time);
 
   if (sb_globals.tx_rate > 0)
   {
     log_text(LOG_NOTICE,
-            "Target transaction rate: %d/sec, with jitter %d usec",
-             sb_globals.tx_rate, sb_globals.tx_jitter);
+             "Target transaction rate: %d/sec, %s arrivals, "
+             "with jitter %d usec",
+             sb_globals.tx_rate,
+             tx_dist == TX_DIST_POISSON ? "poisson" : "constant",
+             sb_globals.tx_jitter);
+    log_text(LOG_NOTICE, "Response time is measured from the intended "
+             "start of each transaction");
   }
 
   if (sb_globals.report_interval)
@@ -399,15 +548,11 @@ void print_run_mode(sb_test_t *test)
     log_text(LOG_NOTICE, "Additional request validation enabled.\n");
 
   if (rand_init)
-  {
     log_text(LOG_NOTICE, "Initializing random number generator from timer.\n");
-    sb_srnd(time(NULL));
-  }
 
   if (rand_seed)
   {
     log_text(LOG_NOTICE, "Initializing random number generator from seed (%d).\n", rand_seed);
-    sb_srnd(rand_seed);
   }
   else
   {
@@ -425,6 +570,128 @@ void print_run_mode(sb_test_t *test)
 }
 
 
+/* Get the interval before the next transaction arrival in nanoseconds */
+
+
+static long long tx_next_interval(void)
+{
+  const double period_ns = 1e9 / sb_globals.tx_rate;
+  double       u;
+  long long    jitter_ns;
+
+  if (tx_dist == TX_DIST_POISSON)
+  {
+    /* Exponentially distributed inter-arrival times */
+    u = (sb_rnd() + 1.0) / (SB_MAX_RND + 1.0);
+    return (long long) (-log(u) * period_ns + 0.5);
+  }
+
+  if (sb_globals.tx_jitter > 0)
+  {
+    jitter_ns = sb_globals.tx_jitter * 1000LL;
+    return (long long) (period_ns + 0.5) - jitter_ns / 2 +
+      (long long) (sb_rnd() % (jitter_ns + 1));
+  }
+
+  return (long long) (period_ns + 0.5);
+}
+
+
+/*
+  Open-loop transaction dispatcher. Generates transaction arrivals at the
+  rate specified by --tx-rate regardless of how fast they are processed by
+  worker threads. Arrival times are derived from the schedule rather than the
+  current time, so a stall of the system under test does not shift the
+  schedule and is accounted for in response times.
+*/
+
+
+static void *tx_dispatcher_proc(void *arg)
+{
+  sb_time_t       next_tv;
+  long long       pause_ns;
+
+  (void)arg; /* unused */
+
+  log_text(LOG_DEBUG, "Transaction dispatcher thread started");
+
+  sb_rand_thread_init(sb_globals.num_threads + 1);
+
+  pthread_mutex_lock(&thread_start_mutex);
+  pthread_mutex_unlock(&thread_start_mutex);
+
+  next_tv = sb_timer_now();
+
+  pthread_mutex_lock(&tx_queue.mutex);
+  while (!tx_queue.done)
+  {
+    pause_ns = sb_time_diff(next_tv, sb_timer_now());
+    if (pause_ns >= 1000)
+    {
+      pthread_mutex_unlock(&tx_queue.mutex);
+      usleep(pause_ns / 1000);
+      pthread_mutex_lock(&tx_queue.mutex);
+      continue;
+    }
+
+    while (tx_queue.count == TX_QUEUE_SIZE && !tx_queue.done)
+      pthread_cond_wait(&tx_queue.not_full, &tx_queue.mutex);
+    if (tx_queue.done)
+      break;
+
+    tx_queue.items[(tx_queue.head + tx_queue.count) % TX_QUEUE_SIZE] = next_tv;
+    tx_queue.count++;
+    pthread_cond_signal(&tx_queue.not_empty);
+
+    next_tv += sb_ns_to_time(tx_next_interval());
+  }
+  pthread_mutex_unlock(&tx_queue.mutex);
+
+  return NULL;
+}
+
+
+/*
+  Get the intended start time of the next transaction from the dispatcher
+  queue. Returns 1 if the dispatcher has terminated.
+*/
+
+
+static int tx_queue_pop(sb_time_t *tv)
+{
+  pthread_mutex_lock(&tx_queue.mutex);
+  while (tx_queue.count == 0 && !tx_queue.done)
+    pthread_cond_wait(&tx_queue.not_empty, &tx_queue.mutex);
+
+  if (tx_queue.count == 0)
+  {
+    pthread_mutex_unlock(&tx_queue.mutex);
+    return 1;
+  }
+
+  *tv = tx_queue.items[tx_queue.head];
+  tx_queue.head = (tx_queue.head + 1) % TX_QUEUE_SIZE;
+  tx_queue.count--;
+  pthread_cond_signal(&tx_queue.not_full);
+  pthread_mutex_unlock(&tx_queue.mutex);
+
+  return 0;
+}
+
+
+/* Stop the dispatcher and wake up all threads waiting on its queue */
+
+
+static void tx_queue_done(void)
+{
+  pthread_mutex_lock(&tx_queue.mutex);
+  tx_queue.done = 1;
+  pthread_cond_broadcast(&tx_queue.not_empty);
+  pthread_cond_broadcast(&tx_queue.not_full);
+  pthread_mutex_unlock(&tx_queue.mutex);
+}
+
+
 /* Main runner test thread */
 
 
@@ -434,14 +701,19 @@ static void *runner_thread(void *arg)
   sb_thread_ctxt_t *ctxt;
   sb_test_t        *test;
   unsigned int     thread_id;
-  long long        period_ns = 0;
-  long long        jitter_ns = 0;
-  long long        pause_ns;
-  struct timespec  target_tv, now_tv;
+  sb_time_t        origin_tv;
   
   ctxt = (sb_thread_ctxt_t *)arg;
   test = ctxt->test;
   thread_id = ctxt->id;
+  sb_thread_id = thread_id;
+
+  if (sb_affinity_thread_init(thread_id))
+  {
+    sb_globals.error = 1;
+    return NULL;
+  }
+  sb_rand_thread_init(thread_id);
   
   log_text(LOG_DEBUG, "Runner thread started (%d)!", thread_id);
   if (test->ops.thread_init != NULL && test->ops.thread_init(thread_id) != 0)
@@ -450,17 +722,6 @@ static void *runner_thread(void *arg)
     return NULL; /* thread initialization failed  */
   }
 
-  if (sb_globals.tx_rate > 0)
-  {
-    /* initialize tx_rate variables */
-    period_ns = floor(1e9 / sb_globals.tx_rate * sb_globals.num_threads + 0.5);
-    if (sb_globals.tx_jitter > 0)
-      jitter_ns = sb_globals.tx_jitter * 1000;
-    else
-      /* Default jitter is 1/10th of the period */
-      jitter_ns = period_ns / 10;
-  }
- 
   /* 
     We do this to make sure all threads get to this barrier 
     about the same time 
@@ -469,44 +730,35 @@ static void *runner_thread(void *arg)
   sb_globals.num_running++;
   pthread_mutex_unlock(&thread_start_mutex);
 
-  if (sb_globals.tx_rate > 0)
-  {
-    /* we are time-rating transactions */
-    SB_GETTIME(&target_tv);
-    /* For the first transaction - ramp up */
-    pause_ns = period_ns / sb_globals.num_threads * thread_id;
-    add_ns_to_timespec(&target_tv, period_ns);
-    usleep(pause_ns / 1000);
-  }
-
   do
   {
+    /*
+      When time-rating transactions, wait for the dispatcher to generate the
+      next arrival and measure the response time from its intended start
+    */
+    if (sb_globals.tx_rate > 0)
+    {
+      if (tx_queue_pop(&origin_tv))
+        break;
+      log_event_origin(thread_id, origin_tv);
+    }
+
     request = get_request(test, thread_id);
     /* check if we shall execute it */
     if (request.type != SB_REQ_TYPE_NULL)
     {
+      SB_TRACE_SET_TYPE(request.type);
       if (execute_request(test, &request, thread_id))
         break; /* break if error returned (terminates only one thread) */
+      sb_counter_add(thread_id, SB_CNT_EVENTS, 1);
     }
     /* Check if we have a time limit */
-    if (sb_globals.max_time != 0 &&
+    if (sb_globals.max_time != 0 && !warmup_running &&
         sb_timer_value(&sb_globals.exec_timer) >= SEC2NS(sb_globals.max_time))
     {
       log_text(LOG_INFO, "Time limit exceeded, exiting...");
       break;
     }
-
-    /* check if we are time-rating transactions and need to pause */
-    if (sb_globals.tx_rate > 0)
-    {
-      add_ns_to_timespec(&target_tv, period_ns);
-      SB_GETTIME(&now_tv);
-      pause_ns = TIMESPEC_DIFF(target_tv, now_tv) - (jitter_ns / 2) +
-	(sb_rnd() % jitter_ns);
-      if (pause_ns > 5000)
-        usleep(pause_ns / 1000);
-    }
-
   } while ((request.type != SB_REQ_TYPE_NULL) && (!sb_globals.error) );
 
   if (test->ops.thread_done != NULL)
@@ -529,6 +781,7 @@ static void *report_thread_proc(void *arg)
   unsigned long long       next_ns;
   unsigned long long       curr_ns;
   const unsigned long long interval_ns = SEC2NS(sb_globals.report_interval);
+  int                      in_warmup;
 
   (void)arg; /* unused */
 
@@ -546,15 +799,30 @@ static void *report_thread_proc(void *arg)
 
   pause_ns = interval_ns;
   prev_ns = sb_timer_value(&sb_globals.exec_timer) + interval_ns;
+  in_warmup = warmup_running;
   for (;;)
   {
     usleep(pause_ns / 1000);
-    /*
-      sb_globals.report_interval may be set to 0 by the master thread
-      to silence report at the end of the test
-    */
-    if (sb_globals.report_interval > 0)
-      current_test->ops.print_stats(SB_STAT_INTERMEDIATE);
+    if (in_warmup && !warmup_running)
+    {
+      /*
+        exec_timer and statistics were reset at the end of warmup, skip the
+        partial report and restart the schedule from the reset
+      */
+      in_warmup = 0;
+      prev_ns = 0;
+    }
+    else
+    {
+      /*
+        sb_globals.report_interval may be set to 0 by the master thread
+        to silence report at the end of the test
+      */
+      pthread_mutex_lock(&report_mutex);
+      if (sb_globals.report_interval > 0)
+        current_test->ops.print_stats(SB_STAT_INTERMEDIATE);
+      pthread_mutex_unlock(&report_mutex);
+    }
     curr_ns = sb_timer_value(&sb_globals.exec_timer);
     do
     {
@@ -587,9 +855,18 @@ static void *checkpoints_thread_proc(void *arg)
 
   log_text(LOG_DEBUG, "Checkpoints report thread started");
 
+  sb_output_thread_checkpoints();
+
   pthread_mutex_lock(&thread_start_mutex);
   pthread_mutex_unlock(&thread_start_mutex);
 
+  /*
+    Checkpoints are relative to the end of warmup, when exec_timer is
+    restarted and statistics are reset
+  */
+  while (warmup_running)
+    usleep(100000);
+
   for (i = 0; i < sb_globals.n_checkpoints; i++)
   {
     next_ns = SEC2NS(sb_globals.checkpoints[i]);
@@ -597,13 +874,16 @@ static void *checkpoints_thread_proc(void *arg)
     if (next_ns <= curr_ns)
       continue;
 
-    pause_ns = next_ns - curr_ns;
-    usleep(pause_ns / 1000);
-    /*
-      Just to update elapsed time in timer which is alter used by
-      log_timestamp.
-    */
-    curr_ns = sb_timer_value(&sb_globals.exec_timer);
+    do
+    {
+      pause_ns = next_ns - curr_ns;
+      usleep(pause_ns / 1000);
+      /*
+        Just to update elapsed time in timer which is alter used by
+        log_timestamp.
+      */
+      curr_ns = sb_timer_value(&sb_globals.exec_timer);
+    } while (curr_ns < next_ns);
 
     SB_THREAD_MUTEX_LOCK();
     log_timestamp(LOG_NOTICE, &sb_globals.exec_timer, "Checkpoint report:");
@@ -615,6 +895,47 @@ static void *checkpoints_thread_proc(void *arg)
   return NULL;
 }
 
+/*
+  Let worker threads run for --warmup-time seconds, then discard all
+  statistics collected so far, so that results do not include cold caches
+  and other start-up effects
+*/
+
+
+static void warmup(sb_test_t *test)
+{
+  unsigned long long end_ns = SEC2NS(sb_globals.warmup_time);
+  unsigned long long curr_ns;
+  unsigned long long pause_ns;
+
+  /* Sleep in short intervals to notice errors in worker threads */
+  while (!sb_globals.error &&
+         (curr_ns = sb_timer_value(&sb_globals.exec_timer)) < end_ns)
+  {
+    pause_ns = end_ns - curr_ns;
+    if (pause_ns > SEC2NS(1) / 10)
+      pause_ns = SEC2NS(1) / 10;
+    usleep(pause_ns / 1000);
+  }
+
+  SB_THREAD_MUTEX_LOCK();
+
+  if (test->ops.reset_stats != NULL)
+    test->ops.reset_stats();
+  log_reset_stats();
+  sb_counters_reset();
+
+  sb_timer_restart(&sb_globals.exec_timer);
+  sb_timer_restart(&sb_globals.cumulative_timer1);
+  sb_timer_restart(&sb_globals.cumulative_timer2);
+  warmup_running = 0;
+
+  SB_THREAD_MUTEX_UNLOCK();
+
+  log_text(LOG_NOTICE, "Warmup finished, statistics reset\n");
+}
+
+
 /* 
   Main test function. Start threads. 
   Wait for them to complete and measure time 
@@ -627,8 +948,10 @@ static int run_test(sb_test_t *test)
   int          err;
   pthread_t    report_thread;
   pthread_t    checkpoints_thread;
+  pthread_t    dispatcher_thread;
   int          report_thread_created = 0;
   int          checkpoints_thread_created = 0;
+  int          dispatcher_thread_created = 0;
 
   /* initialize test */
   if (test->ops.init != NULL && test->ops.init() != 0)
@@ -655,6 +978,7 @@ static int run_test(sb_test_t *test)
 
   /* start mutex used for barrier */
   pthread_mutex_init(&thread_start_mutex,NULL);    
+  pthread_mutex_init(&report_mutex, NULL);
   pthread_mutex_lock(&thread_start_mutex);
   sb_globals.num_running = 0;
 
@@ -670,9 +994,15 @@ static int run_test(sb_test_t *test)
   thr_setconcurrency(sb_globals.num_threads);
 #endif
   
-  /* Initialize random seed  */
-  rnd_seed = LARGE_PRIME;
-  pthread_mutex_init(&rnd_mutex, NULL);
+  /* Reset request accounting */
+  requests_claimed = 0;
+  memset(thread_acct, 0, sb_globals.num_threads * sizeof(sb_thread_acct_t));
+  memset(counters_base, 0, sizeof(counters_base));
+
+  /* Reset unique random numbers counter */
+  rnd_uniq_counter = 0;
+
+  warmup_running = sb_globals.warmup_time > 0;
 
   if (sb_globals.report_interval > 0)
   {
@@ -699,6 +1029,32 @@ static int run_test(sb_test_t *test)
     checkpoints_thread_created = 1;
   }
 
+  if (sb_globals.tx_rate > 0)
+  {
+    tx_queue.items = (sb_time_t *)malloc(TX_QUEUE_SIZE * sizeof(sb_time_t));
+    if (tx_queue.items == NULL)
+    {
+      log_text(LOG_FATAL, "Memory allocation failure.");
+      return 1;
+    }
+    tx_queue.head = 0;
+    tx_queue.count = 0;
+    tx_queue.done = 0;
+    pthread_mutex_init(&tx_queue.mutex, NULL);
+    pthread_cond_init(&tx_queue.not_empty, NULL);
+    pthread_cond_init(&tx_queue.not_full, NULL);
+
+    /* Create a thread to generate transaction arrivals */
+    if ((err = pthread_create(&dispatcher_thread, &thread_attr,
+                              &tx_dispatcher_proc, NULL)) != 0)
+    {
+      log_errno(LOG_FATAL, "pthread_create() for the dispatcher thread "
+                "failed.");
+      return 1;
+    }
+    dispatcher_thread_created = 1;
+  }
+
   /* Starting the test threads */
   for(i = 0; i < sb_globals.num_threads; i++)
   {
@@ -719,24 +1075,44 @@ static int run_test(sb_test_t *test)
 #ifdef HAVE_ALARM
   /* Set the alarm to force shutdown */
   if (sb_globals.force_shutdown)
-    alarm(sb_globals.max_time + sb_globals.timeout);
+    alarm(sb_globals.warmup_time + sb_globals.max_time + sb_globals.timeout);
 #endif
   
   pthread_mutex_unlock(&thread_start_mutex);
   
   log_text(LOG_NOTICE, "Threads started!\n");  
+
+  if (warmup_running)
+    warmup(test);
   for(i = 0; i < sb_globals.num_threads; i++)
   {
     if((err = pthread_join(threads[i].thread, NULL)) != 0)
       log_errno(LOG_FATAL, "pthread_join() for thread #%d failed.", i);
   }
 
+  if (dispatcher_thread_created)
+  {
+    tx_queue_done();
+    if (pthread_join(dispatcher_thread, NULL))
+      log_errno(LOG_FATAL, "pthread_join() for the dispatcher thread failed.");
+
+    pthread_mutex_destroy(&tx_queue.mutex);
+    pthread_cond_destroy(&tx_queue.not_empty);
+    pthread_cond_destroy(&tx_queue.not_full);
+    free(tx_queue.items);
+  }
+
   sb_timer_stop(&sb_globals.exec_timer);
   sb_timer_stop(&sb_globals.cumulative_timer1);
   sb_timer_stop(&sb_globals.cumulative_timer2);
 
-  /* Silence periodic reports if they were on */
+  /*
+    Silence periodic reports if they were on. Wait for a report in progress, so
+    that it does not access test data being freed below.
+  */
+  pthread_mutex_lock(&report_mutex);
   sb_globals.report_interval = 0;
+  pthread_mutex_unlock(&report_mutex);
 
 #ifdef HAVE_ALARM
   alarm(0);
@@ -752,8 +1128,6 @@ static int run_test(sb_test_t *test)
   if (test->ops.print_stats != NULL && !sb_globals.error)
     test->ops.print_stats(SB_STAT_CUMULATIVE);
 
-  pthread_mutex_destroy(&rnd_mutex);
-
   pthread_mutex_destroy(&sb_globals.exec_mutex);
 
   pthread_mutex_destroy(&thread_start_mutex);
@@ -775,10 +1149,80 @@ static int run_test(sb_test_t *test)
       log_errno(LOG_FATAL, "Terminating the checkpoint thread failed.");
   }
 
+  pthread_mutex_destroy(&report_mutex);
+
   return sb_globals.error != 0;
 }
 
 
+/*
+  Run the test once for each number of threads in --threads-sweep and print
+  a consolidated scalability report. Per-thread structures are allocated for
+  the largest step, test initialization and cleanup are performed for every
+  step, so the test data prepared beforehand is reused by all steps.
+*/
+
+
+static int run_sweep(sb_test_t *test)
+{
+  unsigned int       i;
+  unsigned int       nsteps;
+  unsigned int       max_threads = sb_globals.num_threads;
+  unsigned int       report_interval = sb_globals.report_interval;
+  unsigned long long events[MAX_SWEEP_STEPS];
+  double             seconds[MAX_SWEEP_STEPS];
+  double             p50[MAX_SWEEP_STEPS];
+  double             p99[MAX_SWEEP_STEPS];
+  double             tps;
+  double             base_tps = 0;
+
+  for (nsteps = 0; nsteps < sb_globals.n_sweep_steps; nsteps++)
+  {
+    sb_globals.num_threads = sb_globals.sweep_threads[nsteps];
+    /* run_test() silences periodic reports at the end of each run */
+    sb_globals.report_interval = report_interval;
+
+    log_text(LOG_NOTICE, "Threads sweep step %u/%u: %u threads\n", nsteps + 1,
+             sb_globals.n_sweep_steps, sb_globals.num_threads);
+
+    if (run_test(test))
+      break;
+
+    events[nsteps] = log_get_events();
+    seconds[nsteps] = NS2SEC(sb_timer_value(&sb_globals.exec_timer));
+    p50[nsteps] = log_get_percentile(50);
+    p99[nsteps] = log_get_percentile(99);
+
+    /* Print and reset statistics of this step */
+    print_global_stats();
+  }
+
+  if (nsteps > 0)
+  {
+    log_text(LOG_NOTICE, "Threads sweep results:");
+    log_text(LOG_NOTICE, "    %8s %14s %12s %12s %11s", "threads",
+             "events/sec", "p50 (ms)", "p99 (ms)", "efficiency");
+    for (i = 0; i < nsteps; i++)
+    {
+      tps = seconds[i] > 0 ? events[i] / seconds[i] : 0;
+      /* Throughput per thread relative to the first step */
+      if (i == 0)
+        base_tps = tps / sb_globals.sweep_threads[0];
+
+      log_text(LOG_NOTICE, "    %8u %14.2f %12.2f %12.2f %10.2f%%",
+               sb_globals.sweep_threads[i], tps, NS2MS(p50[i]), NS2MS(p99[i]),
+               base_tps > 0 ?
+               tps / sb_globals.sweep_threads[i] / base_tps * 100 : 0.0);
+    }
+    log_text(LOG_NOTICE, "");
+  }
+
+  sb_globals.num_threads = max_threads;
+
+  return sb_globals.error != 0 || nsteps < sb_globals.n_sweep_steps;
+}
+
+
 static sb_test_t *find_test(char *name)
 {
   sb_list_item_t *pos;
@@ -810,9 +1254,15 @@ static int init(void)
   char     *s;
   char     *tmp;
   sb_list_t         *checkpoints_list;
+  sb_list_t         *sweep_list;
   sb_list_item_t    *pos_val;
   value_t           *val;
   long              res;
+  unsigned int      i;
+  double            h;
+
+  if (sb_timer_source_init(sb_get_value_string("timer")))
+    return 1;
 
   sb_globals.num_threads = sb_get_value_int("num-threads");
   if (sb_globals.num_threads <= 0)
@@ -820,7 +1270,39 @@ static int init(void)
     log_text(LOG_FATAL, "Invalid value for --num-threads: %d.\n", sb_globals.num_threads);
     return 1;
   }
+
+  sweep_list = sb_get_value_list("threads-sweep");
+  SB_LIST_FOR_EACH(pos_val, sweep_list)
+  {
+    char *endptr;
+
+    val = SB_LIST_ENTRY(pos_val, value_t, listitem);
+    res = strtol(val->data, &endptr, 10);
+    if (*endptr != '\0' || res <= 0 || res > INT_MAX)
+    {
+      log_text(LOG_FATAL, "Invalid value for --threads-sweep: '%s'",
+               val->data);
+      return 1;
+    }
+    if (++sb_globals.n_sweep_steps > MAX_SWEEP_STEPS)
+    {
+      log_text(LOG_FATAL, "Too many steps in --threads-sweep "
+               "(up to %d can be defined)", MAX_SWEEP_STEPS);
+      return 1;
+    }
+    sb_globals.sweep_threads[sb_globals.n_sweep_steps - 1] = (unsigned int) res;
+  }
+
+  /* Allocate per-thread structures for the largest sweep step */
+  if (sb_globals.n_sweep_steps > 0)
+  {
+    sb_globals.num_threads = sb_globals.sweep_threads[0];
+    for (i = 1; i < sb_globals.n_sweep_steps; i++)
+      if (sb_globals.sweep_threads[i] > sb_globals.num_threads)
+        sb_globals.num_threads = sb_globals.sweep_threads[i];
+  }
   sb_globals.max_requests = sb_get_value_int("max-requests");
+  request_limit = sb_globals.max_requests;
   sb_globals.max_time = sb_get_value_int("max-time");
   if (!sb_globals.max_requests && !sb_globals.max_time)
     log_text(LOG_WARNING, "WARNING: Both max-requests and max-time are 0, running endless test");
@@ -861,6 +1343,14 @@ static int init(void)
     return 1;
   }
 
+  thread_acct = (sb_thread_acct_t *)calloc(sb_globals.num_threads,
+                                           sizeof(sb_thread_acct_t));
+  if (thread_acct == NULL)
+  {
+    log_text(LOG_FATAL, "Memory allocation failure.\n");
+    return 1;
+  }
+
   thread_stack_size = sb_get_value_size("thread-stack-size");
   if (thread_stack_size <= 0)
   {
@@ -879,6 +1369,9 @@ static int init(void)
   
   sb_globals.validate = sb_get_value_flag("validate");
 
+  if (sb_affinity_init())
+    return 1;
+
   rand_init = sb_get_value_flag("rand-init"); 
   rand_seed = sb_get_value_int("rand-seed"); 
   if (rand_init && rand_seed)
@@ -887,35 +1380,72 @@ static int init(void)
     return 1;
   }
 
+  if (rand_init)
+    rng_base_seed = (unsigned long long) time(NULL);
+  else
+    rng_base_seed = (unsigned int) rand_seed;
+
+  /*
+    Generators of worker threads use IDs in the [0, num_threads) range, the
+    main thread uses num_threads and the dispatcher thread num_threads + 1.
+  */
+  rng_next_id = sb_globals.num_threads + 2;
+  sb_rand_thread_init(sb_globals.num_threads);
+
   s = sb_get_value_string("rand-type");
-  if (!strcmp(s, "uniform"))
+  for (i = 0; rand_dists[i].name != NULL; i++)
+    if (!strcmp(s, rand_dists[i].name))
+      break;
+  if (rand_dists[i].name == NULL)
   {
-    rand_type = DIST_TYPE_UNIFORM;
-    rand_func = &sb_rand_uniform;
+    log_text(LOG_FATAL, "Invalid random numbers distribution: %s.", s);
+    return 1;
   }
-  else if (!strcmp(s, "gaussian"))
+  rand_type = rand_dists[i].type;
+  rand_func = rand_dists[i].func;
+
+  rand_iter = sb_get_value_int("rand-spec-iter");
+  rand_pct = sb_get_value_int("rand-spec-pct");
+  rand_res = sb_get_value_int("rand-spec-res");
+
+  zipf_exp = sb_get_value_float("rand-zipfian-exp");
+  if (zipf_exp <= 0)
   {
-    rand_type = DIST_TYPE_GAUSSIAN;
-    rand_func = &sb_rand_gaussian;
+    log_text(LOG_FATAL, "--rand-zipfian-exp must be greater than 0");
+    return 1;
   }
-  else if (!strcmp(s, "special"))
+
+  h = sb_get_value_float("rand-pareto-h");
+  if (h <= 0 || h >= 1)
   {
-    rand_type = DIST_TYPE_SPECIAL;
-    rand_func = &sb_rand_special;
+    log_text(LOG_FATAL, "--rand-pareto-h must be in the (0, 1) range");
+    return 1;
   }
-  else
+  pareto_power = log(h) / log(1.0 - h);
+
+  hotspot_pct = sb_get_value_int("rand-hotspot-pct");
+  hotspot_ops = sb_get_value_int("rand-hotspot-ops");
+  if (hotspot_pct < 1 || hotspot_pct > 100 || hotspot_ops > 100)
   {
-    log_text(LOG_FATAL, "Invalid random numbers distribution: %s.", s);
+    log_text(LOG_FATAL, "Invalid --rand-hotspot-pct or --rand-hotspot-ops value");
     return 1;
   }
 
-  rand_iter = sb_get_value_int("rand-spec-iter");
-  rand_pct = sb_get_value_int("rand-spec-pct");
-  rand_res = sb_get_value_int("rand-spec-res");
-
   sb_globals.tx_rate = sb_get_value_int("tx-rate");
   sb_globals.tx_jitter = sb_get_value_int("tx-jitter");
+
+  s = sb_get_value_string("tx-dist");
+  if (!strcmp(s, "constant"))
+    tx_dist = TX_DIST_CONSTANT;
+  else if (!strcmp(s, "poisson"))
+    tx_dist = TX_DIST_POISSON;
+  else
+  {
+    log_text(LOG_FATAL, "Invalid transaction arrivals distribution: %s.", s);
+    return 1;
+  }
   sb_globals.report_interval = sb_get_value_int("report-interval");
+  sb_globals.warmup_time = sb_get_value_int("warmup-time");
 
   sb_globals.n_checkpoints = 0;
   checkpoints_list = sb_get_value_list("report-checkpoints");
@@ -1026,6 +1556,10 @@ int main(int argc, char *argv[])
     exit(0);
   }
 
+  /* 'trace' command, does not need a test */
+  if (sb_globals.command == SB_COMMAND_TRACE)
+    exit(sb_trace_report());
+
   if (testname == NULL)
   {
     fprintf(stderr, "Missing required argument: --test.\n");
@@ -1070,15 +1604,60 @@ int main(int argc, char *argv[])
 #ifdef HAVE_ALARM
   signal(SIGALRM, sigalrm_handler);
 #endif
-  if (run_test(test))
+  if (sb_output_init(test->sname) || sb_trace_init(test->sname))
+    exit(1);
+  if (sb_globals.n_sweep_steps > 0 ? run_sweep(test) : run_test(test))
     exit(1);
 
+  sb_affinity_done();
+
+  sb_trace_done();
+
   /* Uninitialize logger */
   log_done();
+
+  sb_output_done();
   
   exit(0);
 }
 
+/* splitmix64 generator, used to initialize xoshiro256** state */
+
+static unsigned long long splitmix64(unsigned long long *x)
+{
+  unsigned long long z = (*x += 0x9E3779B97F4A7C15ULL);
+
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+
+  return z ^ (z >> 31);
+}
+
+
+/*
+  Seed the random numbers generator of the current thread. The state is
+  derived from the global seed and the generator ID, so each thread gets an
+  independent and reproducible sequence.
+*/
+
+void sb_rand_thread_init(int id)
+{
+  unsigned long long x;
+  unsigned int       i;
+
+  if (id < 0)
+    x = sb_atomic_add_u64(&rng_next_id, 1);
+  else
+    x = (unsigned long long) id;
+
+  x = rng_base_seed ^ ((x + 1) * 0xD1342543DE82EF95ULL);
+  for (i = 0; i < 4; i++)
+    sb_rng.s[i] = splitmix64(&x);
+
+  sb_rng.initialized = 1;
+}
+
+
 /*
   Return random number in specified range with distribution specified
   with the --rand-type command line option
@@ -1156,19 +1735,202 @@ int sb_rand_special(int a, int b)
 }
 
 
-/* Generate unique random id */
+/*
+  Helpers for zipfian numbers generation, see "Rejection-inversion to
+  generate variates from monotone discrete distributions" by W. Hormann and
+  G. Derflinger. H(x) is the integral of h(x) = x^(-exp), computed in a way
+  that is numerically stable for exponents close to 1.
+*/
+
+static double zipf_helper1(double x)
+{
+  if (fabs(x) > 1e-8)
+    return log1p(x) / x;
+  return 1 - x * (0.5 - x * (1.0 / 3 - 0.25 * x));
+}
+
+
+static double zipf_helper2(double x)
+{
+  if (fabs(x) > 1e-8)
+    return expm1(x) / x;
+  return 1 + x * 0.5 * (1 + x / 3 * (1 + 0.25 * x));
+}
+
+
+static double zipf_h(double x)
+{
+  return exp(-zipf_exp * log(x));
+}
+
+
+static double zipf_h_integral(double x)
+{
+  double log_x = log(x);
+
+  return zipf_helper2((1 - zipf_exp) * log_x) * log_x;
+}
+
+
+static double zipf_h_integral_inv(double x)
+{
+  double t = x * (1 - zipf_exp);
+
+  if (t < -1)
+    t = -1;
+  return exp(zipf_helper1(t) * x);
+}
+
+
+/* Return zipfian-distributed rank in the [1, n] range */
+
+static unsigned int zipf_rank(unsigned int n)
+{
+  zipf_state_t *z = &zipf_state;
+  double       u, x;
+  unsigned int k;
+
+  if (z->n != n)
+  {
+    z->n = n;
+    z->h_x1 = zipf_h_integral(1.5) - 1;
+    z->h_n = zipf_h_integral(n + 0.5);
+    z->s = 2 - zipf_h_integral_inv(zipf_h_integral(2.5) - zipf_h(2));
+  }
+
+  for (;;)
+  {
+    u = z->h_n + sb_rand_double() * (z->h_x1 - z->h_n);
+    x = zipf_h_integral_inv(u);
+    k = (unsigned int) (x + 0.5);
+    if (k < 1)
+      k = 1;
+    else if (k > n)
+      k = n;
+    if (k - x <= z->s || u >= zipf_h_integral(k + 0.5) - zipf_h(k))
+      return k;
+  }
+}
+
+
+/* zipfian distribution, lower values are more frequent */
+
+int sb_rand_zipfian(int a, int b)
+{
+  if (a >= b)
+    return a;
+
+  return a + (int) zipf_rank((unsigned int) (b - a + 1)) - 1;
+}
+
+
+/* 'latest' distribution, zipfian with higher values being more frequent */
+
+int sb_rand_latest(int a, int b)
+{
+  if (a >= b)
+    return a;
+
+  return b - (int) zipf_rank((unsigned int) (b - a + 1)) + 1;
+}
+
+
+/* pareto distribution */
+
+int sb_rand_pareto(int a, int b)
+{
+  if (a >= b)
+    return a;
+
+  return a + (int) ((b - a + 1) * pow(sb_rand_double(), pareto_power));
+}
+
+
+/*
+  'hotspot' distribution: --rand-hotspot-ops percent of numbers are taken
+  uniformly from the first --rand-hotspot-pct percent of the range, the rest
+  uniformly from the remaining values
+*/
+
+int sb_rand_hotspot(int a, int b)
+{
+  unsigned int t;
+  unsigned int hot;
+
+  if (a >= b)
+    return a;
+
+  t = b - a + 1;
+  hot = (unsigned int) ((unsigned long long) t * hotspot_pct / 100);
+  if (hot < 1)
+    hot = 1;
+
+  if (hot >= t || (unsigned int) (sb_rnd() % 100) < hotspot_ops)
+    return a + sb_rnd() % hot;
+
+  return a + hot + sb_rnd() % (t - hot);
+}
+
+
+/* Return the random numbers generator for a distribution name, or NULL */
+
+sb_rand_func_t sb_rand_get_func(const char *name)
+{
+  unsigned int i;
+
+  for (i = 0; rand_dists[i].name != NULL; i++)
+    if (!strcmp(name, rand_dists[i].name))
+      return rand_dists[i].func;
+
+  return NULL;
+}
+
+
+static unsigned long long gcd(unsigned long long a, unsigned long long b)
+{
+  unsigned long long t;
+
+  while (b != 0)
+  {
+    t = a % b;
+    a = b;
+    b = t;
+  }
+
+  return a;
+}
+
+
+/*
+  Generate unique random id. The N-th call returns (N * LARGE_PRIME) mod range
+  which is a permutation of the range as long as the multiplier is coprime
+  with the range size, so no values are repeated until the range is
+  exhausted. The call number is obtained with an atomic increment, so
+  concurrent callers never block each other.
+*/
 
 
 int sb_rand_uniq(int a, int b)
 {
-  int res;
+  unsigned long long n;
+  unsigned long long c;
 
-  pthread_mutex_lock(&rnd_mutex);
-  res = (unsigned int) (rnd_seed % (b - a + 1)) ;
-  rnd_seed += LARGE_PRIME;
-  pthread_mutex_unlock(&rnd_mutex);
+  n = (unsigned int) (b - a + 1);
+  if (n <= 1)
+    return a;
 
-  return res + a;
+  if (uniq_range != n)
+  {
+    /* Find the closest multiplier coprime with the range size */
+    for (uniq_mult = LARGE_PRIME % n; gcd(uniq_mult, n) != 1;
+         uniq_mult = (uniq_mult + 1) % n)
+      ;
+    uniq_range = (unsigned int) n;
+  }
+
+  c = sb_atomic_add_u64(&rnd_uniq_counter, 1) + 1;
+
+  return a + (int) ((c % n) * uniq_mult % n);
 }
 
 
@@ -1189,3 +1951,119 @@ void sb_rand_str(const char *fmt, char *buf)
       buf[i] = fmt[i];
   }
 }
+
+
+/*
+  Set the limit for the total number of requests executed by all threads.
+  Used by tests which define the amount of work in their own terms.
+*/
+
+void sb_set_request_limit(unsigned long long limit)
+{
+  request_limit = limit;
+}
+
+
+/*
+  Check if the thread is allowed to execute one more request, i.e. the limit
+  on the total number of requests has not been reached yet. Requests are
+  claimed from the global limit in chunks, so the shared counter is only
+  modified once per chunk rather than on every request.
+*/
+
+int sb_more_requests(int thread_id)
+{
+  sb_thread_acct_t   *acct = &thread_acct[thread_id];
+  unsigned long long claimed;
+  unsigned long long chunk;
+
+  /* Requests executed during warmup do not count towards the limit */
+  if (request_limit > 0 && !warmup_running)
+  {
+    if (acct->quota == 0)
+    {
+      claimed = sb_atomic_load_u64(&requests_claimed);
+      if (claimed >= request_limit)
+        return 0;
+
+      /* Use smaller chunks close to the limit so all threads finish together */
+      chunk = (request_limit - claimed) / (sb_globals.num_threads * 2);
+      if (chunk < 1)
+        chunk = 1;
+      else if (chunk > REQUEST_CHUNK_MAX)
+        chunk = REQUEST_CHUNK_MAX;
+
+      claimed = sb_atomic_add_u64(&requests_claimed, chunk);
+      if (claimed >= request_limit)
+        return 0;
+      if (chunk > request_limit - claimed)
+        chunk = request_limit - claimed;
+
+      acct->quota = chunk;
+    }
+    acct->quota--;
+  }
+
+  sb_atomic_store_u64(&acct->requests, acct->requests + 1);
+
+  return 1;
+}
+
+
+/* Get the number of requests granted to a thread by sb_more_requests() */
+
+unsigned long long sb_thread_requests(int thread_id)
+{
+  return sb_atomic_load_u64(&thread_acct[thread_id].requests);
+}
+
+
+/*
+  Add value to a per-thread statistic counter. Must only be called by the
+  thread owning the counter.
+*/
+
+void sb_counter_add(int thread_id, sb_counter_t counter,
+                    unsigned long long value)
+{
+  unsigned long long *ptr = &thread_acct[thread_id].counters[counter];
+
+  sb_atomic_store_u64(ptr, *ptr + value);
+}
+
+
+static unsigned long long counter_sum(sb_counter_t counter)
+{
+  unsigned int       i;
+  unsigned long long sum = 0;
+
+  for (i = 0; i < sb_globals.num_threads; i++)
+    sum += sb_atomic_load_u64(&thread_acct[i].counters[counter]);
+
+  return sum;
+}
+
+
+/*
+  Get the value of a statistic counter summed over all threads since the last
+  sb_counters_reset() call
+*/
+
+unsigned long long sb_counter_value(sb_counter_t counter)
+{
+  return counter_sum(counter) - counters_base[counter];
+}
+
+
+/*
+  Reset all statistic counters. Per-thread counters are never modified by
+  other threads, so we just remember their current values.
+*/
+
+void sb_counters_reset(void)
+{
+  unsigned int i;
+
+  for (i = 0; i < SB_CNT_MAX; i++)
+    counters_base[i] = counter_sum((sb_counter_t) i);
+}
@@ -55,15 +55,23 @@
 /* Maximum number of elements in --report-checkpoints list */
 #define MAX_CHECKPOINTS 256
 
-/* random() is not thread-safe on most platforms, use lrand48() if available */
-#ifdef HAVE_LRAND48
-#define sb_rnd() (lrand48() % SB_MAX_RND)
-#define sb_srnd(seed) srand48(seed)
+/* Maximum number of steps in --threads-sweep */
+#define MAX_SWEEP_STEPS 64
+
+/* Maximum number of response time percentiles reported */
+#define MAX_PERCENTILES 16
+
+/* CPU cache line size, used to pad per-thread data */
+#define SB_CACHELINE_SIZE 64
+
+/* Thread-local storage class specifier */
+#ifdef _WIN32
+# define SB_THREAD_LOCAL __declspec(thread)
 #else
-#define sb_rnd() (random() % SB_MAX_RND)
-#define sb_srnd(seed) srandom((unsigned int)seed)
+# define SB_THREAD_LOCAL __thread
 #endif
 
+
 /* Sysbench commands */
 typedef enum
 {
@@ -72,7 +80,8 @@ typedef enum
   SB_COMMAND_RUN,
   SB_COMMAND_CLEANUP,
   SB_COMMAND_HELP,
-  SB_COMMAND_VERSION
+  SB_COMMAND_VERSION,
+  SB_COMMAND_TRACE
 } sb_cmd_t;
 
 /* Request types definition */
@@ -128,12 +137,13 @@ typedef int sb_op_init(void);
 typedef int sb_op_prepare(void);
 typedef int sb_op_thread_init(int);
 typedef void sb_op_print_mode(void);
-typedef sb_request_t sb_op_get_request(void);
+typedef sb_request_t sb_op_get_request(int);
 typedef int sb_op_execute_request(sb_request_t *, int);
 typedef void sb_op_print_stats(sb_stat_t);
 typedef int sb_op_thread_done(int);
 typedef int sb_op_cleanup(void);
 typedef int sb_op_done(void);
+typedef void sb_op_reset_stats(void);
 
 /* Test commands structure definitions */
 
@@ -162,6 +172,8 @@ typedef struct
   sb_op_cleanup         *cleanup;         /* called after exit from thread,
                                              but before timers stop */ 
   sb_op_done            *done;            /* finalize function */
+  sb_op_reset_stats     *reset_stats;     /* discard statistics collected so
+                                             far (called after warmup) */
 } sb_operations_t;
 
 /* Test structure definition */
@@ -187,6 +199,33 @@ typedef struct
 } sb_thread_ctxt_t;
 
 
+/* Per-thread statistic counters maintained by tests */
+
+typedef enum
+{
+  SB_CNT_EVENTS,        /* number of executed events */
+  SB_CNT_READ,          /* number of read operations */
+  SB_CNT_WRITE,         /* number of write operations */
+  SB_CNT_OTHER,         /* number of other operations (e.g. fsync) */
+  SB_CNT_BYTES_READ,    /* number of bytes read */
+  SB_CNT_BYTES_WRITTEN, /* number of bytes written */
+  SB_CNT_MAX
+} sb_counter_t;
+
+/*
+  Per-thread request accounting. Each slot is only modified by its owning
+  thread and is padded to avoid false sharing between threads.
+*/
+
+typedef struct
+{
+  unsigned long long requests;             /* requests granted to thread */
+  unsigned long long quota;                /* requests claimed in advance */
+  unsigned long long counters[SB_CNT_MAX]; /* statistic counters */
+  char               pad[SB_CACHELINE_SIZE];
+} sb_thread_acct_t;
+
+
 /* sysbench global variables */
 
 typedef struct
@@ -202,13 +241,21 @@ typedef struct
   unsigned int     num_running;    /* number of threads currently active */
   unsigned int     report_interval;/* intermediate reports interval */
   unsigned int     percentile_rank;/* percentile rank for response time stats */
+  /* sorted list of reported response time percentiles */
+  double           percentiles[MAX_PERCENTILES];
+  unsigned int     n_percentiles;  /* number of reported percentiles */
+  unsigned int     histogram_digits; /* significant digits in histograms */
   /* array of report checkpoints */
   unsigned int     checkpoints[MAX_CHECKPOINTS];
   unsigned int     n_checkpoints;  /* number of checkpoints */
+  /* numbers of threads for each step of --threads-sweep */
+  unsigned int     sweep_threads[MAX_SWEEP_STEPS];
+  unsigned int     n_sweep_steps;  /* number of sweep steps */
   unsigned int     tx_rate;        /* target transaction rate */
   unsigned int     tx_jitter;      /* target transaction variation (us) */
   unsigned int     max_requests;   /* maximum number of requests */
   unsigned int     max_time;       /* total execution time limit */
+  unsigned int     warmup_time;    /* warmup time excluded from stats */
   unsigned char    debug;          /* debug flag */
   int              force_shutdown; /* whether we must force test shutdown */
   unsigned int     timeout;        /* forced shutdown timeout */
@@ -218,12 +265,84 @@ typedef struct
 
 extern sb_globals_t sb_globals;
 
+/* ID of the current worker thread, -1 for other threads */
+extern SB_THREAD_LOCAL int sb_thread_id;
+
+/*
+  Per-thread state of the pseudo-random numbers generator (xoshiro256**).
+  Each thread has its own generator, so generating random numbers requires no
+  synchronization between threads.
+*/
+typedef struct
+{
+  unsigned long long s[4];
+  int                initialized;
+} sb_rng_t;
+
+extern SB_THREAD_LOCAL sb_rng_t sb_rng;
+
+/*
+  Seed the generator of the current thread. Worker threads use their IDs as
+  'id' to get reproducible sequences for a given --rand-seed, other threads
+  are assigned unique IDs automatically if 'id' is negative.
+*/
+void sb_rand_thread_init(int id);
+
+static inline unsigned long long sb_rotl64(unsigned long long x, int k)
+{
+  return (x << k) | (x >> (64 - k));
+}
+
+/* Get the next 64-bit random number from the current thread's generator */
+static inline unsigned long long sb_rand_u64(void)
+{
+  unsigned long long *s = sb_rng.s;
+  unsigned long long result;
+  unsigned long long t;
+
+  if (!sb_rng.initialized)
+    sb_rand_thread_init(-1);
+
+  result = sb_rotl64(s[1] * 5, 7) * 9;
+  t = s[1] << 17;
+
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3] = sb_rotl64(s[3], 45);
+
+  return result;
+}
+
+/* Random number in the [0, SB_MAX_RND] range */
+#define sb_rnd() ((int) (sb_rand_u64() >> 34))
+
+/* Random number in the [0, 1) range */
+#define sb_rand_double() ((double) (sb_rand_u64() >> 11) * (1.0 / 9007199254740992.0))
+
+typedef int (*sb_rand_func_t)(int, int);
+
 /* Random number generators */
 int sb_rand(int, int);
 int sb_rand_uniform(int, int);
 int sb_rand_gaussian(int, int);
 int sb_rand_special(int, int);
+int sb_rand_zipfian(int, int);
+int sb_rand_pareto(int, int);
+int sb_rand_hotspot(int, int);
+int sb_rand_latest(int, int);
+sb_rand_func_t sb_rand_get_func(const char *);
 int sb_rand_uniq(int a, int b);
 void sb_rand_str(const char *, char *);
 
+/* Request accounting */
+void sb_set_request_limit(unsigned long long);
+int sb_more_requests(int);
+unsigned long long sb_thread_requests(int);
+void sb_counter_add(int, sb_counter_t, unsigned long long);
+unsigned long long sb_counter_value(sb_counter_t);
+void sb_counters_reset(void);
+
 #endif
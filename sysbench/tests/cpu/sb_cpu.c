@@ -38,9 +38,8 @@ static sb_arg_t cpu_args[] =
 /* CPU test operations */
 static int cpu_init(void);
 static void cpu_print_mode(void);
-static sb_request_t cpu_get_request(void);
+static sb_request_t cpu_get_request(int);
 static int cpu_execute_request(sb_request_t *, int);
-static int cpu_done(void);
 
 static sb_test_t cpu_test =
 {
@@ -56,7 +55,8 @@ static sb_test_t cpu_test =
     NULL,
     NULL,
     NULL,
-    cpu_done
+    NULL,
+    NULL
   },
   {
     NULL,NULL,NULL,NULL
@@ -67,10 +67,6 @@ static sb_test_t cpu_test =
 
 /* Upper limit for primes */
 static unsigned int    max_prime;
-/* Request counter */
-static unsigned int    req_performed;
-/* Counter mutex */
-static pthread_mutex_t request_mutex;
 
 int register_test_cpu(sb_list_t * tests)
 {
@@ -89,27 +85,20 @@ int cpu_init(void)
   }
   max_prime= (unsigned int)prime_option;
 
-  req_performed = 0;
-
-  pthread_mutex_init(&request_mutex, NULL);
-  
   return 0;
 }
 
 
-sb_request_t cpu_get_request(void)
+sb_request_t cpu_get_request(int thread_id)
 {
   sb_request_t req;
   
-  if (req_performed >= sb_globals.max_requests)
+  if (!sb_more_requests(thread_id))
   {
     req.type = SB_REQ_TYPE_NULL;
     return req;
   }
   req.type = SB_REQ_TYPE_CPU;
-  pthread_mutex_lock(&request_mutex);
-  req_performed++;
-  pthread_mutex_unlock(&request_mutex);
 
   return req;
 }
@@ -153,9 +142,3 @@ void cpu_print_mode(void)
   log_text(LOG_NOTICE, "Primer numbers limit: %d\n", max_prime);
 }
 
-int cpu_done(void)
-{
-  pthread_mutex_destroy(&request_mutex);
-
-  return 0;
-}
@@ -0,0 +1,328 @@
+/* Copyright (C) 2011 Alexey Kopytov.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#ifdef HAVE_STRING_H
+# include <string.h>
+#endif
+
+#include "crc32c.h"
+
+/* The SSE4.2 crc32 instruction is only used with GCC-compatible compilers */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define CRC32C_HAVE_SSE42
+# include <nmmintrin.h>
+#endif
+
+/* Reflected Castagnoli polynomial */
+#define CRC32C_POLY 0x82F63B78U
+
+typedef unsigned int crc32c_func_t(unsigned int, const unsigned char *, size_t);
+
+/* Slicing-by-8 lookup tables, built by crc32c_init() */
+static unsigned int crc32c_table[8][256];
+
+static unsigned int crc32c_sw(unsigned int, const unsigned char *, size_t);
+#ifdef CRC32C_HAVE_SSE42
+/*
+  The crc32 instruction has a latency of 3 cycles and a throughput of 1 per
+  cycle, so the SSE4.2 implementation computes CRCs of 3 adjacent chunks in
+  parallel and combines them with tables that shift a CRC over a chunk of
+  zeros.
+*/
+#define CRC32C_LONG  8192
+#define CRC32C_SHORT 256
+
+static unsigned int crc32c_long[4][256];
+static unsigned int crc32c_short[4][256];
+
+static void crc32c_zeros(unsigned int zeros[][256], size_t len);
+static int cpu_has_sse42(void);
+static unsigned int crc32c_sse42(unsigned int, const unsigned char *, size_t);
+#endif
+
+static crc32c_func_t *crc32c_impl = crc32c_sw;
+static const char    *crc32c_name = "slicing-by-8";
+
+
+void crc32c_init(void)
+{
+  unsigned int crc;
+  unsigned int i, j;
+
+  for (i = 0; i < 256; i++)
+  {
+    crc = i;
+    for (j = 0; j < 8; j++)
+      crc = (crc >> 1) ^ (CRC32C_POLY & (0U - (crc & 1)));
+    crc32c_table[0][i] = crc;
+  }
+
+  for (i = 0; i < 256; i++)
+  {
+    crc = crc32c_table[0][i];
+    for (j = 1; j < 8; j++)
+    {
+      crc = crc32c_table[0][crc & 0xFF] ^ (crc >> 8);
+      crc32c_table[j][i] = crc;
+    }
+  }
+
+#ifdef CRC32C_HAVE_SSE42
+  if (cpu_has_sse42())
+  {
+    crc32c_zeros(crc32c_long, CRC32C_LONG);
+    crc32c_zeros(crc32c_short, CRC32C_SHORT);
+    crc32c_impl = crc32c_sse42;
+    crc32c_name = "SSE4.2";
+  }
+#endif
+}
+
+
+const char *crc32c_impl_name(void)
+{
+  return crc32c_name;
+}
+
+
+unsigned int crc32c(unsigned int crc, const unsigned char *buf, size_t len)
+{
+  return ~crc32c_impl(~crc, buf, len);
+}
+
+
+/* Process 8 bytes per iteration using 8 lookup tables */
+
+
+static unsigned int crc32c_sw(unsigned int crc, const unsigned char *buf,
+                              size_t len)
+{
+  unsigned int lo;
+  unsigned int hi;
+
+  while (len >= 8)
+  {
+    /* Assemble words from bytes, so that the result is endian-independent */
+    lo = crc ^ ((unsigned int) buf[0] | (unsigned int) buf[1] << 8 |
+                (unsigned int) buf[2] << 16 | (unsigned int) buf[3] << 24);
+    hi = (unsigned int) buf[4] | (unsigned int) buf[5] << 8 |
+      (unsigned int) buf[6] << 16 | (unsigned int) buf[7] << 24;
+
+    crc = crc32c_table[7][lo & 0xFF] ^ crc32c_table[6][(lo >> 8) & 0xFF] ^
+      crc32c_table[5][(lo >> 16) & 0xFF] ^ crc32c_table[4][lo >> 24] ^
+      crc32c_table[3][hi & 0xFF] ^ crc32c_table[2][(hi >> 8) & 0xFF] ^
+      crc32c_table[1][(hi >> 16) & 0xFF] ^ crc32c_table[0][hi >> 24];
+
+    buf += 8;
+    len -= 8;
+  }
+
+  while (len-- > 0)
+    crc = crc32c_table[0][(crc ^ *buf++) & 0xFF] ^ (crc >> 8);
+
+  return crc;
+}
+
+
+#ifdef CRC32C_HAVE_SSE42
+/* Multiply a vector by a 32x32 matrix over GF(2) */
+
+
+static unsigned int gf2_matrix_times(const unsigned int *mat, unsigned int vec)
+{
+  unsigned int sum = 0;
+
+  while (vec)
+  {
+    if (vec & 1)
+      sum ^= *mat;
+    vec >>= 1;
+    mat++;
+  }
+
+  return sum;
+}
+
+
+static void gf2_matrix_square(unsigned int *square, const unsigned int *mat)
+{
+  unsigned int n;
+
+  for (n = 0; n < 32; n++)
+    square[n] = gf2_matrix_times(mat, mat[n]);
+}
+
+
+/*
+  Build tables to shift a CRC over 'len' zero bytes, 'len' must be a power of
+  two. The operator for one zero bit is squared until it covers 'len' bytes.
+*/
+
+
+static void crc32c_zeros(unsigned int zeros[][256], size_t len)
+{
+  unsigned int even[32];
+  unsigned int odd[32];
+  unsigned int row;
+  unsigned int n;
+
+  odd[0] = CRC32C_POLY;
+  row = 1;
+  for (n = 1; n < 32; n++)
+  {
+    odd[n] = row;
+    row <<= 1;
+  }
+
+  /* 2 and 4 zero bits */
+  gf2_matrix_square(even, odd);
+  gf2_matrix_square(odd, even);
+
+  /* The first iteration gets the operator for one zero byte */
+  for (;;)
+  {
+    gf2_matrix_square(even, odd);
+    len >>= 1;
+    if (len == 0)
+      break;
+    gf2_matrix_square(odd, even);
+    len >>= 1;
+    if (len == 0)
+    {
+      memcpy(even, odd, sizeof(even));
+      break;
+    }
+  }
+
+  for (n = 0; n < 256; n++)
+  {
+    zeros[0][n] = gf2_matrix_times(even, n);
+    zeros[1][n] = gf2_matrix_times(even, n << 8);
+    zeros[2][n] = gf2_matrix_times(even, n << 16);
+    zeros[3][n] = gf2_matrix_times(even, n << 24);
+  }
+}
+
+
+/* Shift a CRC over the number of zero bytes the tables were built for */
+
+static inline unsigned int crc32c_shift(unsigned int zeros[][256],
+                                        unsigned int crc)
+{
+  return zeros[0][crc & 0xFF] ^ zeros[1][(crc >> 8) & 0xFF] ^
+    zeros[2][(crc >> 16) & 0xFF] ^ zeros[3][crc >> 24];
+}
+
+
+/* Check CPUID.01H:ECX.SSE4_2[bit 20] */
+
+
+static int cpu_has_sse42(void)
+{
+  unsigned int eax, ebx, ecx, edx;
+
+  __asm__ __volatile__ ("cpuid" : "=a" (eax), "=b" (ebx), "=c" (ecx),
+                        "=d" (edx) : "a" (1));
+
+  return (ecx >> 20) & 1;
+}
+
+
+#ifdef __x86_64__
+/* Compute CRCs of 3 adjacent chunks of 'chunk' bytes each in parallel */
+
+__attribute__((target("sse4.2")))
+static inline unsigned int crc32c_sse42_3way(unsigned int crc,
+                                             const unsigned char *buf,
+                                             size_t chunk,
+                                             unsigned int zeros[][256])
+{
+  unsigned long long crc0 = crc;
+  unsigned long long crc1 = 0;
+  unsigned long long crc2 = 0;
+  unsigned long long w0, w1, w2;
+  const unsigned char *end = buf + chunk;
+
+  do
+  {
+    memcpy(&w0, buf, sizeof(w0));
+    memcpy(&w1, buf + chunk, sizeof(w1));
+    memcpy(&w2, buf + 2 * chunk, sizeof(w2));
+    crc0 = _mm_crc32_u64(crc0, w0);
+    crc1 = _mm_crc32_u64(crc1, w1);
+    crc2 = _mm_crc32_u64(crc2, w2);
+    buf += 8;
+  } while (buf < end);
+
+  crc = crc32c_shift(zeros, (unsigned int) crc0) ^ (unsigned int) crc1;
+  return crc32c_shift(zeros, crc) ^ (unsigned int) crc2;
+}
+#endif
+
+
+__attribute__((target("sse4.2")))
+static unsigned int crc32c_sse42(unsigned int crc, const unsigned char *buf,
+                                 size_t len)
+{
+  unsigned int word32;
+#ifdef __x86_64__
+  unsigned long long crc64;
+  unsigned long long word;
+
+  while (len >= 3 * CRC32C_LONG)
+  {
+    crc = crc32c_sse42_3way(crc, buf, CRC32C_LONG, crc32c_long);
+    buf += 3 * CRC32C_LONG;
+    len -= 3 * CRC32C_LONG;
+  }
+
+  while (len >= 3 * CRC32C_SHORT)
+  {
+    crc = crc32c_sse42_3way(crc, buf, CRC32C_SHORT, crc32c_short);
+    buf += 3 * CRC32C_SHORT;
+    len -= 3 * CRC32C_SHORT;
+  }
+
+  crc64 = crc;
+  while (len >= 8)
+  {
+    memcpy(&word, buf, sizeof(word));
+    crc64 = _mm_crc32_u64(crc64, word);
+    buf += 8;
+    len -= 8;
+  }
+  crc = (unsigned int) crc64;
+#endif
+
+  while (len >= 4)
+  {
+    memcpy(&word32, buf, sizeof(word32));
+    crc = _mm_crc32_u32(crc, word32);
+    buf += 4;
+    len -= 4;
+  }
+
+  while (len-- > 0)
+    crc = _mm_crc32_u8(crc, *buf++);
+
+  return crc;
+}
+#endif /* CRC32C_HAVE_SSE42 */
@@ -0,0 +1,45 @@
+/* Copyright (C) 2011 Alexey Kopytov.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stddef.h>
+
+/*
+  CRC-32C (Castagnoli) checksums used to validate fileio blocks. The SSE4.2
+  crc32 instruction is used when the CPU supports it, otherwise a table-driven
+  slicing-by-8 implementation.
+*/
+
+/* Select the implementation and build lookup tables. Not thread-safe */
+void crc32c_init(void);
+
+/* Name of the implementation selected by crc32c_init() */
+const char *crc32c_impl_name(void);
+
+/*
+  Update 'crc' with 'len' bytes from 'buf'. Start with crc = 0 to get the
+  checksum of a single buffer.
+*/
+unsigned int crc32c(unsigned int crc, const unsigned char *buf, size_t len);
+
+#endif /* CRC32C_H */
@@ -57,13 +57,20 @@
 #endif
 
 #include "sysbench.h"
-#include "crc32.h"
+#include "sb_atomic.h"
+#include "sb_output.h"
 #include "sb_percentile.h"
+#include "sb_trace.h"
+#include "crc32c.h"
+#include "sb_uring.h"
 
 /* Lengths of the checksum and the offset fields in a block */
 #define FILE_CHECKSUM_LENGTH sizeof(int)
 #define FILE_OFFSET_LENGTH sizeof(long)
 
+/* Weyl sequence increment of the splitmix64 generator */
+#define SPLITMIX64_GAMMA 0x9E3779B97F4A7C15ULL
+
 #ifdef _WIN32
 typedef HANDLE FILE_DESCRIPTOR;
 #define VALID_FILE(fd) (fd != INVALID_HANDLE_VALUE)
@@ -108,9 +115,25 @@ typedef enum
 {
   FILE_IO_MODE_SYNC,
   FILE_IO_MODE_ASYNC,
-  FILE_IO_MODE_MMAP
+  FILE_IO_MODE_MMAP,
+  FILE_IO_MODE_IO_URING
 } file_io_mode_t;
 
+/* How test files are created by 'prepare' */
+typedef enum
+{
+  PREPARE_MODE_WRITE,
+  PREPARE_MODE_FALLOCATE,
+  PREPARE_MODE_SPARSE
+} file_prepare_mode_t;
+
+/* How sequential requests are distributed among threads */
+typedef enum
+{
+  SEQ_STREAMS_SHARED,
+  SEQ_STREAMS_PER_THREAD
+} file_seq_streams_t;
+
 typedef enum {
   SB_FILE_FLAG_NORMAL,
   SB_FILE_FLAG_SYNC,
@@ -119,23 +142,63 @@ typedef enum {
 } file_flags_t;
 
 #ifdef HAVE_LIBAIO
+/* Async I/O operation */
+typedef struct
+{
+  struct iocb   iocb; 
+  sb_time_t     start;  /* submission time */
+  sb_file_op_t  type;
+  unsigned int  file_id;
+  ssize_t       len;
+  long long     pos;
+  void          *buf;
+  unsigned long long write_gen; /* writes started to the block(s) of a read */
+  int           overlap;        /* read started while a write was in flight */
+} sb_aio_oper_t;
+
 /* Per-thread async I/O context */
 typedef struct
 {
   io_context_t    io_ctxt;      /* AIO context */
   unsigned int    nrequests;    /* Current number of queued I/O requests */
   struct io_event *events;      /* Array of events */
+  sb_aio_oper_t   *opers;       /* preallocated operations */
+  unsigned int    *free_opers;  /* stack of unused operations */
+  unsigned int    nfree;        /* number of unused operations */
+  struct iocb     **pending;    /* operations not yet passed to io_submit() */
+  unsigned int    npending;     /* number of pending operations */
 } sb_aio_context_t;
 
-/* Async I/O operation */
+static sb_aio_context_t *aio_ctxts;
+#endif
+
+#ifdef HAVE_IO_URING
+/* io_uring operation in flight */
 typedef struct
 {
-  struct iocb   iocb; 
-  sb_file_op_t  type;
-  ssize_t       len;
-} sb_aio_oper_t;
-
-static sb_aio_context_t *aio_ctxts;
+  sb_time_t       start;      /* submission time */
+  sb_file_op_t    type;
+  unsigned int    file_id;
+  ssize_t         len;
+  long long       pos;
+  void            *buf;
+  unsigned long long write_gen; /* writes started to the block(s) of a read */
+  int             overlap;    /* read started while a write was in flight */
+} sb_uring_oper_t;
+
+/* Per-thread io_uring context */
+typedef struct
+{
+  sb_uring_t      ring;
+  sb_uring_oper_t *opers;      /* operations indexed by slot number */
+  unsigned int    *free_slots; /* stack of unused slots */
+  unsigned int    nfree;       /* number of unused slots */
+  unsigned int    *nwrites;    /* writes in flight per file */
+  char            pad[SB_CACHELINE_SIZE];
+} sb_uring_context_t;
+
+static sb_uring_context_t *uring_ctxts;
+static unsigned int       uring_nctxts;
 #endif
 
 /* Test options */
@@ -149,32 +212,100 @@ static int               file_fsync_all;
 static int               file_fsync_end;
 static file_fsync_mode_t file_fsync_mode;
 static float             file_rw_ratio;
+static char              *file_rand_type;
+static sb_rand_func_t    file_rand_func;
+static int               file_rand_blocks;  /* number of blocks for random IO */
 static int               file_merged_requests;
 static long long         file_max_request_size;
 static file_io_mode_t    file_io_mode;
 #ifdef HAVE_LIBAIO
 static unsigned int      file_async_backlog;
+static unsigned int      file_async_batch;
+#endif
+#ifdef HAVE_IO_URING
+static unsigned int      file_uring_depth;
+static int               file_uring_fixed;
+static int               file_uring_sqpoll;
 #endif
 
+/*
+  Per-directory operation counters, indexed by sb_file_op_t. Each thread has
+  its own set, only written by that thread.
+*/
+typedef struct
+{
+  unsigned long long ops[FILE_OP_TYPE_FSYNC + 1];
+  unsigned long long bytes[FILE_OP_TYPE_FSYNC + 1];
+} file_dir_stats_t;
+
+/* Per-thread request generation state */
+typedef struct
+{
+  unsigned int       fsynced_file;   /* file number to be fsynced (periodic) */
+  int                is_dirty;       /* any writes after last fsync series ? */
+  unsigned long long real_read_ops;  /* reads done by thread, never reset */
+  unsigned long long real_write_ops; /* writes done by thread, never reset */
+  sb_file_request_t  prev_req;       /* previous request needed for validation */
+  /* Sequential stream owned by the thread with --file-seq-streams=per-thread */
+  unsigned long long seq_first;      /* first request number of the stream */
+  unsigned long long seq_last;       /* last request number + 1 */
+  unsigned long long seq_next;       /* next request number */
+  unsigned int       seq_first_file; /* first file touched by the stream */
+  unsigned int       seq_num_files;  /* number of files touched by the stream */
+  void               *buffers;       /* I/O buffers, one per request slot */
+  file_dir_stats_t   *dir_stats;     /* per-directory counters, --file-dirs */
+  char               pad[SB_CACHELINE_SIZE];
+} sb_file_thread_t;
+
+static sb_file_thread_t *file_threads;
+
 /* statistical and other "local" variables */
-static long long       position;      /* current position in file */
-static unsigned int    current_file;  /* current file */
-static unsigned int    fsynced_file;  /* file number to be fsynced (periodic) */
-static unsigned int    fsynced_file2; /* fsyncing in the end */
-
-static int is_dirty;               /* any writes after last fsync series ? */
-static int read_ops;
-static int real_read_ops;
-static int write_ops;
-static int real_write_ops;
-static int other_ops;
-static int last_other_ops;
-static unsigned int req_performed; /* number of requests done */
-static unsigned long long bytes_read;
+static file_seq_streams_t file_seq_streams;
+static unsigned long long seq_req_num;   /* next sequential request number */
+static unsigned long long seq_reqs_per_file; /* sequential requests per file */
+static unsigned long long fsynced_file2; /* fsyncing in the end */
+
+static unsigned long long last_other_ops;
 static unsigned long long last_bytes_read;
-static unsigned long long bytes_written;
 static unsigned long long last_bytes_written;
 
+/* Largest recorded latency in nanoseconds, larger values are truncated */
+#define OP_LATENCY_MAX_VALUE 1E13
+
+/*
+  Latency histograms per operation type, indexed by sb_file_op_t. Requests
+  executed asynchronously are recorded when their completions are reaped.
+*/
+static sb_percentile_t op_latency[FILE_OP_TYPE_FSYNC + 1];
+static const char      *op_names[FILE_OP_TYPE_FSYNC + 1] =
+  {NULL, "read", "write", "fsync"};
+
+/* Directories test files are striped across with --file-dirs */
+static char         **file_dirs;
+static unsigned int file_num_dirs;
+
+/* Counters as of the previous intermediate and cumulative reports */
+static file_dir_stats_t *dir_last_interval;
+static file_dir_stats_t *dir_last_cumulative;
+/* Latency histograms per directory */
+static sb_percentile_t  *dir_latency;
+
+/*
+  Number of writes started and completed per block, hashed into a fixed
+  number of buckets. With --validate in asynchronous modes, a read is only
+  validated if no write to any of its blocks was in flight while it was.
+  Hash collisions only cause some reads to be skipped.
+*/
+#define FILE_WRITE_BUCKETS 65536
+
+typedef struct
+{
+  unsigned long long started;
+  unsigned long long completed;
+} file_block_writes_t;
+
+static file_block_writes_t *file_block_writes;
+
 static const double megabyte = 1024.0 * 1024.0;
 
 #ifdef HAVE_MMAP
@@ -186,17 +317,43 @@ static unsigned long file_page_mask;
 /* Array of file descriptors */
 static FILE_DESCRIPTOR *files;
 
-/* Buffer for all I/O operations */
-static void *buffer;
+/*
+  Each thread has its own I/O buffer for every request it can have in flight
+  (one in synchronous modes), so that neither concurrent threads nor queued
+  asynchronous requests share memory. Buffers are aligned to the page size.
+*/
+static unsigned int file_buffer_slots;  /* buffers per thread */
+static size_t       file_buffer_size;   /* size of each buffer */
 
 /* test mode type */
 static file_test_mode_t test_mode;
 
-/* Previous request needed for validation */
-static sb_file_request_t prev_req;
+/* Work unit of a prepare thread, rounded to the block size */
+#define PREPARE_SEGMENT_SIZE (64 * 1024 * 1024)
+/* Size of writes in the 'write' prepare mode, rounded to the block size */
+#define PREPARE_WRITE_SIZE (1024 * 1024)
+/* Alignment of offsets and sizes required for direct I/O */
+#define PREPARE_DIRECT_ALIGN 4096
+
+#ifdef O_DIRECT
+# define PREPARE_O_DIRECT O_DIRECT
+#else
+# define PREPARE_O_DIRECT 0
+#endif
+
+static file_prepare_mode_t file_prepare_mode;
 
-/* Percentile stats for --report-interval */
-static sb_percentile_t local_percentile;
+/*
+  State shared by prepare threads. Each file is split into segments
+  ('units'), threads take units in order from a shared counter.
+*/
+static long long          *prepare_start;  /* offset to start each file at */
+static unsigned long long *prepare_units;  /* units in files up to each one */
+static unsigned long long prepare_next_unit;
+static unsigned long long prepare_written;
+static long long          prepare_segment;
+static long long          prepare_write_size;
+static volatile int       prepare_error;
 
 static sb_arg_t fileio_args[] = {
   {"file-num", "number of files to create", SB_ARG_TYPE_INT, "128"},
@@ -204,12 +361,33 @@ static sb_arg_t fileio_args[] = {
   {"file-total-size", "total size of files to create", SB_ARG_TYPE_SIZE, "2G"},
   {"file-test-mode", "test mode {seqwr, seqrewr, seqrd, rndrd, rndwr, rndrw}",
    SB_ARG_TYPE_STRING, NULL},
-  {"file-io-mode", "file operations mode {sync,async,fastmmap,slowmmap}", SB_ARG_TYPE_STRING, "sync"},
+  {"file-io-mode", "file operations mode {sync,async,mmap,io_uring}", SB_ARG_TYPE_STRING, "sync"},
 #ifdef HAVE_LIBAIO
   {"file-async-backlog", "number of asynchronous operatons to queue per thread", SB_ARG_TYPE_INT, "128"},
+  {"file-async-batch", "number of asynchronous operations to submit with a single io_submit() call",
+   SB_ARG_TYPE_INT, "1"},
+#endif
+#ifdef HAVE_IO_URING
+  {"file-uring-depth", "io_uring queue depth per thread", SB_ARG_TYPE_INT, "128"},
+  {"file-uring-fixed", "use registered files and buffers with io_uring",
+   SB_ARG_TYPE_FLAG, "on"},
+  {"file-uring-sqpoll", "use a kernel thread to poll io_uring submission queues",
+   SB_ARG_TYPE_FLAG, "off"},
 #endif
   {"file-extra-flags", "additional flags to use on opening files {sync,dsync,direct}",
    SB_ARG_TYPE_STRING, ""},
+  {"file-prepare-mode", "how to create files on 'prepare' {write,fallocate,"
+   "sparse}. write fills files with large direct I/O writes, fallocate only "
+   "reserves space, sparse only sets file sizes. Files are prepared by "
+   "--num-threads threads", SB_ARG_TYPE_STRING, "write"},
+  {"file-dirs", "comma-separated list of directories to stripe test files "
+   "across, e.g. one per device. File N is placed into directory N modulo the "
+   "number of directories, so requests are spread over directories along with "
+   "files. Statistics are also reported per directory", SB_ARG_TYPE_LIST, ""},
+  {"file-seq-streams", "how sequential requests are distributed among threads "
+   "{shared,per-thread}. shared makes all threads advance a single stream, "
+   "per-thread gives each thread its own files or file region with an "
+   "independent cursor", SB_ARG_TYPE_STRING, "shared"},
   {"file-fsync-freq", "do fsync() after this number of requests (0 - don't use fsync())",
    SB_ARG_TYPE_INT, "100"},
   {"file-fsync-all", "do fsync() after each write operation", SB_ARG_TYPE_FLAG, "off"},
@@ -219,6 +397,8 @@ static sb_arg_t fileio_args[] = {
   {"file-merged-requests", "merge at most this number of IO requests if possible (0 - don't merge)",
    SB_ARG_TYPE_INT, "0"},
   {"file-rw-ratio", "reads/writes ratio for combined test", SB_ARG_TYPE_FLOAT, "1.5"},
+  {"file-rand-type", "distribution of random IO offsets "
+   "{uniform,gaussian,special,zipfian,pareto,hotspot,latest}", SB_ARG_TYPE_STRING, "uniform"},
 
   {NULL, NULL, SB_ARG_TYPE_NULL, NULL}
 };
@@ -231,13 +411,15 @@ static int file_cmd_cleanup(void);
 static int file_init(void);
 static void file_print_mode(void);
 static int file_prepare(void);
-static sb_request_t file_get_request(void);
+static int file_thread_init(int);
+static sb_request_t file_get_request(int);
 static int file_execute_request(sb_request_t *, int);
-#ifdef HAVE_LIBAIO
+#if defined(HAVE_LIBAIO) || defined(HAVE_IO_URING)
 static int file_thread_done(int);
 #endif
 static int file_done(void);
 static void file_print_stats(sb_stat_t);
+static void file_reset_stats(void);
 
 static sb_test_t fileio_test =
 {
@@ -246,18 +428,19 @@ static sb_test_t fileio_test =
   {
     file_init,
     file_prepare,
-    NULL,
+    file_thread_init,
     file_print_mode,
     file_get_request,
     file_execute_request,
     file_print_stats,
-#ifdef HAVE_LIBAIO
+#if defined(HAVE_LIBAIO) || defined(HAVE_IO_URING)
      file_thread_done,
 #else
      NULL,
 #endif
     NULL,
-    file_done
+    file_done,
+    file_reset_stats
   },
   {
    NULL,
@@ -271,17 +454,43 @@ static sb_test_t fileio_test =
 
 
 static int create_files(void);
+static void *prepare_thread_proc(void *);
+static int prepare_range(unsigned int, long long, long long, char *);
+static int prepare_pwrite(int, const char *, size_t, long long);
 static int remove_files(void);
 static int parse_arguments(void);
+static int parse_file_dirs(void);
 static void clear_stats(void);
+static int op_latency_init(void);
+static void op_latency_done(void);
+static void file_op_record(int, unsigned int, sb_file_op_t, ssize_t,
+                           sb_time_t);
+static void file_get_name(unsigned int, char *, size_t);
+static int dir_stats_init(void);
+static void dir_stats_done(void);
+static void dir_stats_snapshot(file_dir_stats_t *);
+static void dir_stats_print(sb_stat_t, double, sb_output_record_t *);
+static unsigned int percentile_rank_index(void);
+static void op_latency_print_interval(char *, size_t, sb_output_record_t *);
+static void op_latency_print_cumulative(sb_output_record_t *);
 static void init_vars(void);
-static sb_request_t file_get_seq_request(void);
-static sb_request_t file_get_rnd_request(void);
+static void init_seq_streams(void);
+static sb_request_t file_get_seq_request(int);
+static sb_request_t file_get_rnd_request(int);
 static void check_seq_req(sb_file_request_t *, sb_file_request_t *);
 static const char *get_io_mode_str(file_io_mode_t mode);
 static const char *get_test_mode_str(file_test_mode_t mode);
+static int file_buffers_init(void);
+static void *file_get_buffer(int);
 static void file_fill_buffer(unsigned char *, unsigned int, size_t);
 static int file_validate_buffer(unsigned char  *, unsigned int, size_t);
+static int file_writes_init(void);
+static void file_writes_start(unsigned int, long long, ssize_t);
+static void file_writes_complete(unsigned int, long long, ssize_t);
+static unsigned long long file_writes_gen(unsigned int, long long, ssize_t,
+                                          int *);
+static int file_writes_overlap(unsigned int, long long, ssize_t,
+                               unsigned long long, int);
 
 /* File operation wrappers */
 static int file_fsync(unsigned int, int);
@@ -290,8 +499,18 @@ static ssize_t file_pwrite(unsigned int, void *, ssize_t, long long, int);
 #ifdef HAVE_LIBAIO
 static int file_async_init(void);
 static int file_async_done(void);
-static int file_submit_or_wait(struct iocb *, sb_file_op_t, ssize_t, int);
+static int file_submit_or_wait(struct iocb *, sb_file_op_t, unsigned int,
+                               ssize_t, long long, void *, int);
 static int file_wait(int, long);
+static int file_async_flush(int);
+#endif
+#ifdef HAVE_IO_URING
+static int file_uring_init(void);
+static int file_uring_thread_init(int);
+static int file_uring_done(void);
+static int file_uring_submit(int, sb_file_op_t, unsigned int, void *, ssize_t,
+                             long long);
+static int file_uring_wait(int, unsigned int);
 #endif
 #ifdef HAVE_MMAP
 static int file_mmap_prepare(void);
@@ -325,21 +544,94 @@ int file_init(void)
     return 1;
   }
 
+  file_threads = (sb_file_thread_t *)calloc(sb_globals.num_threads,
+                                            sizeof(sb_file_thread_t));
+  if (file_threads == NULL)
+  {
+    log_text(LOG_FATAL, "Memory allocation failure.");
+    return 1;
+  }
+
 #ifdef HAVE_LIBAIO
   if (file_async_init())
     return 1;
 #endif
 
+#ifdef HAVE_IO_URING
+  if (file_uring_init())
+    return 1;
+#endif
+
+  if (file_buffers_init() || file_writes_init())
+    return 1;
+
+  if (op_latency_init() || dir_stats_init())
+    return 1;
+
   init_vars();
   clear_stats();
 
-  if (sb_percentile_init(&local_percentile, 100000, 1.0, 1e13))
+  return 0;
+}
+
+
+/* Parse --file-dirs into the array of directories */
+
+
+int parse_file_dirs(void)
+{
+  sb_list_t      *list;
+  sb_list_item_t *pos;
+  value_t        *val;
+  unsigned int   n;
+
+  list = sb_get_value_list("file-dirs");
+
+  n = 0;
+  SB_LIST_FOR_EACH(pos, list)
+    n++;
+
+  free(file_dirs);
+  file_dirs = NULL;
+  file_num_dirs = 0;
+  if (n == 0)
+    return 0;
+
+  file_dirs = (char **) calloc(n, sizeof(char *));
+  if (file_dirs == NULL)
+  {
+    log_text(LOG_FATAL, "Memory allocation failure.");
     return 1;
+  }
+
+  SB_LIST_FOR_EACH(pos, list)
+  {
+    val = SB_LIST_ENTRY(pos, value_t, listitem);
+    if (val->data == NULL || val->data[0] == '\0')
+    {
+      log_text(LOG_FATAL, "Empty directory name in --file-dirs");
+      return 1;
+    }
+    file_dirs[file_num_dirs++] = val->data;
+  }
 
   return 0;
 }
 
 
+/* Get name of a test file, files are striped across --file-dirs */
+
+
+void file_get_name(unsigned int file_id, char *buf, size_t size)
+{
+  if (file_num_dirs > 0)
+    snprintf(buf, size, "%s/test_file.%u", file_dirs[file_id % file_num_dirs],
+             file_id);
+  else
+    snprintf(buf, size, "test_file.%u", file_id);
+}
+
+
 int file_prepare(void)
 {
   unsigned int  i;
@@ -347,7 +639,7 @@ int file_prepare(void)
 
   for (i=0; i < num_files; i++)
   {
-    snprintf(file_name, sizeof(file_name), "test_file.%d",i);
+    file_get_name(i, file_name, sizeof(file_name));
     /* remove test files for creation test if they exist */
     if (test_mode == MODE_WRITE)  
       unlink(file_name);
@@ -370,6 +662,33 @@ int file_prepare(void)
 }
 
 
+/*
+  Allocate I/O buffers from the thread itself, so that they are placed
+  according to the thread's CPU affinity and NUMA policy
+*/
+
+
+int file_thread_init(int thread_id)
+{
+  file_threads[thread_id].buffers = sb_memalign(file_buffer_slots *
+                                                file_buffer_size);
+  if (file_threads[thread_id].buffers == NULL)
+  {
+    log_text(LOG_FATAL, "Failed to allocate I/O buffers!");
+    return 1;
+  }
+  memset(file_threads[thread_id].buffers, 0,
+         file_buffer_slots * file_buffer_size);
+
+#ifdef HAVE_IO_URING
+  if (file_uring_thread_init(thread_id))
+    return 1;
+#endif
+
+  return 0;
+}
+
+
 int file_done(void)
 {
   unsigned int  i;
@@ -386,40 +705,54 @@ int file_done(void)
     return 1;
 #endif
 
+#ifdef HAVE_IO_URING
+  if (file_uring_done())
+    return 1;
+#endif
+
 #ifdef HAVE_MMAP
   if (file_mmap_done())
     return 1;
 #endif
 
-  if (buffer != NULL)
-    sb_free_memaligned(buffer);
+  for (i = 0; i < sb_globals.num_threads; i++)
+    if (file_threads[i].buffers != NULL)
+      sb_free_memaligned(file_threads[i].buffers);
+
+  free(file_threads);
+  free(files);
+  free(file_block_writes);
+  file_block_writes = NULL;
 
-  sb_percentile_done(&local_percentile);
+  op_latency_done();
+  dir_stats_done();
 
   return 0;
 }
 
-sb_request_t file_get_request(void)
+sb_request_t file_get_request(int thread_id)
 {
   if (test_mode == MODE_WRITE || test_mode == MODE_REWRITE ||
       test_mode == MODE_READ)
-    return file_get_seq_request();
+    return file_get_seq_request(thread_id);
   
   
-  return file_get_rnd_request();
+  return file_get_rnd_request(thread_id);
 }
 
 
 /* Get sequential read or write request */
 
 
-sb_request_t file_get_seq_request(void)
+sb_request_t file_get_seq_request(int thread_id)
 {
   sb_request_t         sb_req;
   sb_file_request_t    *file_req = &sb_req.u.file_request;
+  sb_file_thread_t     *ctxt = &file_threads[thread_id];
+  unsigned long long   req_num;
+  unsigned long long   file_num;
 
   sb_req.type = SB_REQ_TYPE_FILE;
-  SB_THREAD_MUTEX_LOCK();
   
   /* assume function is called with correct mode always */
   if (test_mode == MODE_WRITE || test_mode == MODE_REWRITE)
@@ -427,97 +760,95 @@ sb_request_t file_get_seq_request(void)
   else     
     file_req->operation = FILE_OP_TYPE_READ;
 
+  /* See whether it's time to fsync file(s) */
+  if (file_fsync_freq != 0 && file_req->operation == FILE_OP_TYPE_WRITE &&
+      ctxt->is_dirty && sb_thread_requests(thread_id) % file_fsync_freq == 0)
+  {
+    file_req->operation = FILE_OP_TYPE_FSYNC;
+    file_req->pos = 0;
+    file_req->size = 0;
+
+    /* Per-thread streams only fsync the files they have written to */
+    if (file_seq_streams == SEQ_STREAMS_PER_THREAD)
+    {
+      file_req->file_id = ctxt->seq_first_file + ctxt->fsynced_file;
+      ctxt->fsynced_file++;
+      if (ctxt->fsynced_file == ctxt->seq_num_files)
+      {
+        ctxt->fsynced_file = 0;
+        ctxt->is_dirty = 0;
+      }
+
+      return sb_req;
+    }
+
+    file_req->file_id = ctxt->fsynced_file;
+    ctxt->fsynced_file++;
+    if (ctxt->fsynced_file == num_files)
+    {
+      ctxt->fsynced_file = 0;
+      ctxt->is_dirty = 0;
+    }
+
+    return sb_req;
+  }
+
   /* Do final fsync on all files and quit if we are done */
-  if (sb_globals.max_requests > 0 && req_performed >= sb_globals.max_requests)
+  if (!sb_more_requests(thread_id))
   {
     /* no fsync for reads */
     if (file_fsync_end && file_req->operation == FILE_OP_TYPE_WRITE &&
-        fsynced_file2 < num_files)
+        (file_num = sb_atomic_add_u64(&fsynced_file2, 1)) < num_files)
     {
-      file_req->file_id = fsynced_file2;
+      file_req->file_id = (unsigned int) file_num;
       file_req->pos = 0;
       file_req->size = 0;
       file_req->operation = FILE_OP_TYPE_FSYNC;
-      fsynced_file2++;
     }
     else 
       sb_req.type = SB_REQ_TYPE_NULL;
 
-    SB_THREAD_MUTEX_UNLOCK();
-    return sb_req;
-  }
-
-  /* See whether it's time to fsync file(s) */
-  if (file_fsync_freq != 0 && file_req->operation == FILE_OP_TYPE_WRITE &&
-      is_dirty && req_performed % file_fsync_freq == 0)
-  {
-    file_req->operation = FILE_OP_TYPE_FSYNC;
-    file_req->file_id = fsynced_file;
-    file_req->pos = 0;
-    file_req->size = 0;
-    fsynced_file++;
-    if (fsynced_file == num_files)
-    {
-      fsynced_file = 0;
-      is_dirty = 0;
-    }
-
-    SB_THREAD_MUTEX_UNLOCK();
     return sb_req;
   }
 
-  req_performed++;
-
   if (file_req->operation == FILE_OP_TYPE_WRITE)
-    is_dirty = 1;
+    ctxt->is_dirty = 1;
 
-  /* Rewind to the first file if all files are processed */
-  if (current_file == num_files)
-  {
-    position= 0;
-    current_file= 0;
-  }
-  
-  if (file_merged_requests > 0)
+  /*
+    Sequential requests are numbered across all threads, the request number
+    defines the file and the position. Rewind to the first file if all files
+    are processed. With per-thread streams each thread walks its own range of
+    request numbers and rewinds to the start of that range.
+  */
+  if (file_seq_streams == SEQ_STREAMS_PER_THREAD)
   {
-    if (position + file_max_request_size <= file_size)
-      file_req->size = file_max_request_size;
-    else
-      file_req->size = file_size - position;
-    file_req->file_id = current_file;
-    file_req->pos = position;
+    req_num = ctxt->seq_next++;
+    if (ctxt->seq_next == ctxt->seq_last)
+      ctxt->seq_next = ctxt->seq_first;
+    /* Do not validate the jump back to the start of the stream */
+    if (req_num == ctxt->seq_first)
+      ctxt->prev_req.operation = FILE_OP_TYPE_NULL;
   }
   else
-  {
-    file_req->size = file_block_size;
-    file_req->file_id = current_file;
-    file_req->pos = position;
-  }
-
-  position += file_req->size;
-
-  /* scroll to the next file if not already out of bound */
-  if (position == file_size)
-  {
-    current_file++;
-    position=0;
-
-    if (sb_globals.validate)
-    {
-      check_seq_req(&prev_req, file_req);
-      prev_req = *file_req;
-    }
-    
-    SB_THREAD_MUTEX_UNLOCK(); 
-    return sb_req; /* This request is valid even for last file */
-  }      
-  
-  SB_THREAD_MUTEX_UNLOCK(); 
+    req_num = sb_atomic_add_u64(&seq_req_num, 1);
+  file_req->file_id = (unsigned int) ((req_num / seq_reqs_per_file) %
+                                      num_files);
+  file_req->pos = (long long) (req_num % seq_reqs_per_file) *
+    file_max_request_size;
+  if (file_req->pos + file_max_request_size <= file_size)
+    file_req->size = file_max_request_size;
+  else
+    file_req->size = file_size - file_req->pos;
 
-  if (sb_globals.validate)
+  /*
+    Requests are only expected to be sequential within a single thread, or
+    within each thread's own stream
+  */
+  if (sb_globals.validate && (sb_globals.num_threads == 1 ||
+                              file_seq_streams == SEQ_STREAMS_PER_THREAD))
   {
-    check_seq_req(&prev_req, file_req);
-    prev_req = *file_req;
+    check_seq_req(&ctxt->prev_req, file_req);
+    ctxt->prev_req = *file_req;
   }
   
   return sb_req;    
@@ -527,96 +858,89 @@ sb_request_t file_get_seq_request(void)
 /* Request generatior for random tests */
 
 
-sb_request_t file_get_rnd_request(void)
+sb_request_t file_get_rnd_request(int thread_id)
 {
   sb_request_t         sb_req;
   sb_file_request_t    *file_req = &sb_req.u.file_request;
-  unsigned int         randnum;
+  sb_file_thread_t     *ctxt = &file_threads[thread_id];
   unsigned long long   tmppos;
+  unsigned long long   file_num;
   int                  real_mode = test_mode;
   int                  mode = test_mode;
   
   sb_req.type = SB_REQ_TYPE_FILE;
-  SB_THREAD_MUTEX_LOCK(); 
   
   /*
-    Convert mode for combined tests. Locking to get consistent values
+    Convert mode for combined tests.
     We have to use "real" values for mixed test  
   */
   if (test_mode==MODE_RND_RW)
   {
-    if ((double)(real_read_ops + 1) / (real_write_ops + 1) < file_rw_ratio)
+    if ((double)(ctxt->real_read_ops + 1) / (ctxt->real_write_ops + 1) <
+        file_rw_ratio)
       mode=MODE_RND_READ;
     else
       mode=MODE_RND_WRITE;
   }
 
+  /*
+    is_dirty is only set if writes are done and cleared after all files
+    are synced
+  */
+  if (file_fsync_freq != 0 && ctxt->is_dirty)
+  {
+    if (sb_thread_requests(thread_id) % file_fsync_freq == 0)
+    {
+      file_req->operation = FILE_OP_TYPE_FSYNC;  
+      file_req->file_id = ctxt->fsynced_file;
+      file_req->pos = 0;
+      file_req->size = 0;
+      ctxt->fsynced_file++;
+      if (ctxt->fsynced_file == num_files)
+      {
+        ctxt->fsynced_file = 0;
+        ctxt->is_dirty = 0;
+      }
+
+      return sb_req;
+    }
+  }
+
   /* fsync all files (if requested by user) as soon as we are done */
-  if (sb_globals.max_requests > 0 && req_performed >= sb_globals.max_requests)
+  if (!sb_more_requests(thread_id))
   {
     if (file_fsync_end != 0 &&
         (real_mode == MODE_RND_WRITE || real_mode == MODE_RND_RW ||
          real_mode == MODE_MIXED))
     {
-      if(fsynced_file2 < num_files)
+      if((file_num = sb_atomic_add_u64(&fsynced_file2, 1)) < num_files)
       {
-        file_req->file_id = fsynced_file2;
+        file_req->file_id = (unsigned int) file_num;
         file_req->operation = FILE_OP_TYPE_FSYNC;
         file_req->pos = 0;
         file_req->size = 0;
-        fsynced_file2++;
 
-        SB_THREAD_MUTEX_UNLOCK();        
         return sb_req;
       }
     }
     sb_req.type = SB_REQ_TYPE_NULL;
 
-    SB_THREAD_MUTEX_UNLOCK();        
     return sb_req;
   }
 
-  /*
-    is_dirty is only set if writes are done and cleared after all files
-    are synced
-  */
-  if (file_fsync_freq != 0 && is_dirty)
-  {
-    if (req_performed % file_fsync_freq == 0)
-    {
-      file_req->operation = FILE_OP_TYPE_FSYNC;  
-      file_req->file_id = fsynced_file;
-      file_req->pos = 0;
-      file_req->size = 0;
-      fsynced_file++;
-      if (fsynced_file == num_files)
-      {
-        fsynced_file = 0;
-        is_dirty = 0;
-      }
-
-      SB_THREAD_MUTEX_UNLOCK();
-      return sb_req;
-    }
-  }
-
-  randnum=sb_rnd();
   if (mode==MODE_RND_WRITE) /* mode shall be WRITE or RND_WRITE only */
     file_req->operation = FILE_OP_TYPE_WRITE;
   else     
     file_req->operation = FILE_OP_TYPE_READ;
 
-  tmppos = (long long)((double)randnum / (double)SB_MAX_RND * (double)(total_size));
-  tmppos = tmppos - (tmppos % (long long)file_block_size);
+  tmppos = (unsigned long long) file_rand_func(0, file_rand_blocks - 1) * file_block_size;
   file_req->file_id = (int)(tmppos / (long long)file_size);
   file_req->pos = (long long)(tmppos % (long long)file_size);
   file_req->size = file_block_size;
 
-  req_performed++;
   if (file_req->operation == FILE_OP_TYPE_WRITE) 
-    is_dirty = 1;
+    ctxt->is_dirty = 1;
 
-  SB_THREAD_MUTEX_UNLOCK();        
   return sb_req;
 }
 
@@ -627,6 +951,21 @@ int file_execute_request(sb_request_t *sb_req, int thread_id)
   sb_file_request_t *file_req = &sb_req->u.file_request;
   log_msg_t          msg;
   log_msg_oper_t     op_msg;
+  void               *buf;
+  sb_time_t          start;
+  /* Asynchronously completed requests are timed when reaped */
+  const int          timed = file_io_mode != FILE_IO_MODE_IO_URING;
+  /*
+    Per-operation latencies and errors of asynchronous requests are handled
+    on reap. libaio only handles reads and writes, file_fsync() is
+    synchronous there.
+  */
+  const int          reaped = file_io_mode == FILE_IO_MODE_ASYNC ||
+    file_io_mode == FILE_IO_MODE_IO_URING;
+  const int          fsync_reaped = file_io_mode == FILE_IO_MODE_IO_URING;
+  /* Asynchronous reads are validated on completion */
+  const int          validate_now = sb_globals.validate &&
+    file_io_mode != FILE_IO_MODE_ASYNC && file_io_mode != FILE_IO_MODE_IO_URING;
 
   if (sb_globals.debug)
   {
@@ -651,6 +990,7 @@ int file_execute_request(sb_request_t *sb_req, int thread_id)
     return 1;
   }
   fd = files[file_req->file_id];
+  SB_TRACE_SET_OP(file_req->operation);
   /* Prepare log message */
   msg.type = LOG_MSG_TYPE_OPER;
   msg.data = &op_msg;
@@ -660,63 +1000,83 @@ int file_execute_request(sb_request_t *sb_req, int thread_id)
       log_text(LOG_FATAL, "Execute of NULL request called !, aborting");
       return 1;
     case FILE_OP_TYPE_WRITE:
+      if ((buf = file_get_buffer(thread_id)) == NULL)
+        return 1;
 
       /* Store checksum and offset in a buffer when in validation mode */
       if (sb_globals.validate)
-        file_fill_buffer(buffer, file_req->size, file_req->pos);
+        file_fill_buffer(buf, file_req->size, file_req->pos);
                          
-      LOG_EVENT_START(msg, thread_id);
-      if(file_pwrite(file_req->file_id, buffer, file_req->size, file_req->pos,
+      if (timed)
+        LOG_EVENT_START(msg, thread_id);
+      start = sb_timer_now();
+      if(file_pwrite(file_req->file_id, buf, file_req->size, file_req->pos,
                      thread_id)
          != (ssize_t)file_req->size)
       {
-        log_errno(LOG_FATAL, "Failed to write file! file: " FD_FMT " pos: %lld", 
-                  fd, (long long)file_req->pos);
+        if (!reaped)
+          log_errno(LOG_FATAL, "Failed to write file! file: " FD_FMT
+                    " pos: %lld", fd, (long long)file_req->pos);
         return 1;
       }
+      if (!reaped)
+        file_op_record(thread_id, file_req->file_id, FILE_OP_TYPE_WRITE,
+                       file_req->size, start);
 
       /* Check if we have to fsync each write operation */
       if (file_fsync_all)
       {
+        start = sb_timer_now();
         if (file_fsync(file_req->file_id, thread_id))
         {
-          log_errno(LOG_FATAL, "Failed to fsync file! file: " FD_FMT, fd);
+          if (!fsync_reaped)
+            log_errno(LOG_FATAL, "Failed to fsync file! file: " FD_FMT, fd);
           return 1;
         }
+        if (!fsync_reaped)
+          file_op_record(thread_id, file_req->file_id, FILE_OP_TYPE_FSYNC, 0,
+                         start);
       }
 
-      LOG_EVENT_STOP(msg, thread_id);
-
-      sb_percentile_update(&local_percentile,
-                           sb_timer_value(&timers[thread_id]));
+      if (timed)
+      {
+        LOG_EVENT_STOP(msg, thread_id);
+      }
 
-      SB_THREAD_MUTEX_LOCK();
-      write_ops++;
-      real_write_ops++;
-      bytes_written += file_req->size;
+      file_threads[thread_id].real_write_ops++;
+      sb_counter_add(thread_id, SB_CNT_WRITE, 1);
+      sb_counter_add(thread_id, SB_CNT_BYTES_WRITTEN, file_req->size);
       if (file_fsync_all)
-        other_ops++;
-      SB_THREAD_MUTEX_UNLOCK();
+        sb_counter_add(thread_id, SB_CNT_OTHER, 1);
 
       break;
     case FILE_OP_TYPE_READ:
-      LOG_EVENT_START(msg, thread_id);
-      if(file_pread(file_req->file_id, buffer, file_req->size, file_req->pos,
+      if ((buf = file_get_buffer(thread_id)) == NULL)
+        return 1;
+
+      if (timed)
+        LOG_EVENT_START(msg, thread_id);
+      start = sb_timer_now();
+      if(file_pread(file_req->file_id, buf, file_req->size, file_req->pos,
                     thread_id)
          != (ssize_t)file_req->size)
       {
-        log_errno(LOG_FATAL, "Failed to read file! file: " FD_FMT " pos: %lld",
-                  fd, (long long)file_req->pos);
+        if (!reaped)
+          log_errno(LOG_FATAL, "Failed to read file! file: " FD_FMT
+                    " pos: %lld", fd, (long long)file_req->pos);
         return 1;
       }
-      LOG_EVENT_STOP(msg, thread_id);
-
-      sb_percentile_update(&local_percentile,
-                           sb_timer_value(&timers[thread_id]));
+      if (!reaped)
+        file_op_record(thread_id, file_req->file_id, FILE_OP_TYPE_READ,
+                       file_req->size, start);
+      if (timed)
+      {
+        LOG_EVENT_STOP(msg, thread_id);
+      }
 
       /* Validate block if run with validation enabled */
-      if (sb_globals.validate &&
-          file_validate_buffer(buffer, file_req->size, file_req->pos))
+      if (validate_now &&
+          file_validate_buffer(buf, file_req->size, file_req->pos))
       {
         log_text(LOG_FATAL,
           "Validation failed on file " FD_FMT ", block offset 0x%x, exiting...",
@@ -724,28 +1084,28 @@ int file_execute_request(sb_request_t *sb_req, int thread_id)
         return 1;
       }
       
-      SB_THREAD_MUTEX_LOCK();
-      read_ops++;
-      real_read_ops++;
-      bytes_read += file_req->size;
-
-      SB_THREAD_MUTEX_UNLOCK();
+      file_threads[thread_id].real_read_ops++;
+      sb_counter_add(thread_id, SB_CNT_READ, 1);
+      sb_counter_add(thread_id, SB_CNT_BYTES_READ, file_req->size);
 
       break;
     case FILE_OP_TYPE_FSYNC:
       /* Ignore fsync requests if we are already fsync'ing each operation */
       if (file_fsync_all)
         break;
+      start = sb_timer_now();
       if(file_fsync(file_req->file_id, thread_id))
       {
-        log_errno(LOG_FATAL, "Failed to fsync file! id: %u fd: " FD_FMT,
-                  file_req->file_id, fd);
+        if (!fsync_reaped)
+          log_errno(LOG_FATAL, "Failed to fsync file! id: %u fd: " FD_FMT,
+                    file_req->file_id, fd);
         return 1;
       }
-    
-      SB_THREAD_MUTEX_LOCK();
-      other_ops++;
-      SB_THREAD_MUTEX_UNLOCK();
+      if (!fsync_reaped)
+        file_op_record(thread_id, file_req->file_id, FILE_OP_TYPE_FSYNC, 0,
+                       start);
+
+      sb_counter_add(thread_id, SB_CNT_OTHER, 1);
     
       break;         
     default:
@@ -765,6 +1125,9 @@ void file_print_mode(void)
   log_text(LOG_NOTICE, "Extra file open flags: %x", file_extra_flags);
   log_text(LOG_NOTICE, "%d files, %sb each", num_files,
            sb_print_value_size(sizestr, sizeof(sizestr), file_size));
+  if (file_num_dirs > 0)
+    log_text(LOG_NOTICE, "Files are striped across %u directories",
+             file_num_dirs);
   log_text(LOG_NOTICE, "%sb total file size",
            sb_print_value_size(sizestr, sizeof(sizestr),
                                file_size * num_files));
@@ -785,8 +1148,11 @@ void file_print_mode(void)
       log_text(LOG_NOTICE,
                "Read/Write ratio for combined random IO test: %2.2f",
                file_rw_ratio);
+      log_text(LOG_NOTICE, "Random IO offsets distribution: %s", file_rand_type);
       break;
     default:
+      if (file_seq_streams == SEQ_STREAMS_PER_THREAD)
+        log_text(LOG_NOTICE, "Using a separate sequential stream per thread");
       break;
   }
 
@@ -802,9 +1168,21 @@ void file_print_mode(void)
     log_text(LOG_NOTICE, "Calling fsync() after each write operation.");
 
   log_text(LOG_NOTICE, "Using %s I/O mode", get_io_mode_str(file_io_mode));
+#ifdef HAVE_LIBAIO
+  if (file_io_mode == FILE_IO_MODE_ASYNC)
+    log_text(LOG_NOTICE, "Async I/O backlog: %u, submission batch: %u",
+             file_async_backlog, file_async_batch);
+#endif
+#ifdef HAVE_IO_URING
+  if (file_io_mode == FILE_IO_MODE_IO_URING)
+    log_text(LOG_NOTICE, "io_uring queue depth: %u, fixed files and buffers: "
+             "%s, SQ polling: %s", file_uring_depth,
+             file_uring_fixed ? "on" : "off", file_uring_sqpoll ? "on" : "off");
+#endif
 
   if (sb_globals.validate)
-    log_text(LOG_NOTICE, "Using checksums validation.");
+    log_text(LOG_NOTICE, "Using checksums validation (CRC32C, %s).",
+             crc32c_impl_name());
   
   log_text(LOG_NOTICE, "Doing %s test", get_test_mode_str(test_mode));
 }
@@ -817,6 +1195,16 @@ void file_print_stats(sb_stat_t type)
 {
   double seconds;
   char   s1[16], s2[16], s3[16], s4[16];
+  char   pct_buf[256];
+  char   op_buf[256];
+  double pct_values[MAX_PERCENTILES];
+  double pct_max;
+  sb_output_record_t rec;
+  unsigned long long read_ops;
+  unsigned long long write_ops;
+  unsigned long long other_ops;
+  unsigned long long bytes_read;
+  unsigned long long bytes_written;
   unsigned long long diff_read;
   unsigned long long diff_written;
   unsigned long long diff_other_ops;
@@ -828,6 +1216,10 @@ void file_print_stats(sb_stat_t type)
 
       seconds = NS2SEC(sb_timer_split(&sb_globals.exec_timer));
 
+      bytes_read = sb_counter_value(SB_CNT_BYTES_READ);
+      bytes_written = sb_counter_value(SB_CNT_BYTES_WRITTEN);
+      other_ops = sb_counter_value(SB_CNT_OTHER);
+
       diff_read = bytes_read - last_bytes_read;
       diff_written = bytes_written - last_bytes_written;
       diff_other_ops = other_ops - last_other_ops;
@@ -838,17 +1230,36 @@ void file_print_stats(sb_stat_t type)
 
       SB_THREAD_MUTEX_UNLOCK();
 
+      log_get_interval_percentiles(pct_values, &pct_max);
+
+      if (SB_OUTPUT_ENABLED())
+      {
+        sb_output_begin(&rec, type, "fileio");
+        sb_output_add(&rec, "threads", sb_globals.num_threads);
+        sb_output_add(&rec, "read_mb_per_sec", diff_read / megabyte / seconds);
+        sb_output_add(&rec, "written_mb_per_sec",
+                      diff_written / megabyte / seconds);
+        sb_output_add(&rec, "fsyncs_per_sec", diff_other_ops / seconds);
+        sb_output_add_percentiles(&rec, "latency", pct_values, pct_max);
+      }
+
+      op_latency_print_interval(op_buf, sizeof(op_buf),
+                                SB_OUTPUT_ENABLED() ? &rec : NULL);
+
       log_timestamp(LOG_NOTICE, &sb_globals.exec_timer,
                     "reads: %4.2f MB/s writes: %4.2f MB/s fsyncs: %4.2f/s "
-                    "response time: %4.2fms (%u%%)",
+                    "response time: %s%s",
                     diff_read / megabyte / seconds,
                     diff_written / megabyte / seconds,
                     diff_other_ops / seconds,
-                    NS2MS(sb_percentile_calculate(&local_percentile,
-                                                  sb_globals.percentile_rank)),
-                    sb_globals.percentile_rank);
+                    log_format_percentiles(pct_values, pct_max, pct_buf,
+                                           sizeof(pct_buf)),
+                    op_buf);
 
-      sb_percentile_reset(&local_percentile);
+      dir_stats_print(type, seconds, SB_OUTPUT_ENABLED() ? &rec : NULL);
+
+      if (SB_OUTPUT_ENABLED())
+        sb_output_write(&rec);
 
       break;
     }
@@ -856,8 +1267,15 @@ void file_print_stats(sb_stat_t type)
   case SB_STAT_CUMULATIVE:
     seconds = NS2SEC(sb_timer_split(&sb_globals.cumulative_timer1));
 
+    read_ops = sb_counter_value(SB_CNT_READ);
+    write_ops = sb_counter_value(SB_CNT_WRITE);
+    other_ops = sb_counter_value(SB_CNT_OTHER);
+    bytes_read = sb_counter_value(SB_CNT_BYTES_READ);
+    bytes_written = sb_counter_value(SB_CNT_BYTES_WRITTEN);
+
     log_text(LOG_NOTICE,
-             "Operations performed:  %d reads, %d writes, %d Other = %d Total",
+             "Operations performed:  %llu reads, %llu writes, %llu Other = "
+             "%llu Total",
              read_ops, write_ops, other_ops, read_ops + write_ops + other_ops);
     log_text(LOG_NOTICE, "Read %sb  Written %sb  Total transferred %sb  "
              "(%sb/sec)",
@@ -868,6 +1286,26 @@ void file_print_stats(sb_stat_t type)
                                  (bytes_read + bytes_written) / seconds));
     log_text(LOG_NOTICE, "%8.2f Requests/sec executed",
              (read_ops + write_ops) / seconds);
+
+    if (SB_OUTPUT_ENABLED())
+    {
+      sb_output_begin(&rec, type, "fileio");
+      sb_output_add(&rec, "reads", read_ops);
+      sb_output_add(&rec, "writes", write_ops);
+      sb_output_add(&rec, "other", other_ops);
+      sb_output_add(&rec, "read_bytes", bytes_read);
+      sb_output_add(&rec, "written_bytes", bytes_written);
+      sb_output_add(&rec, "mb_per_sec",
+                    (bytes_read + bytes_written) / megabyte / seconds);
+      sb_output_add(&rec, "requests_per_sec", (read_ops + write_ops) / seconds);
+    }
+
+    op_latency_print_cumulative(SB_OUTPUT_ENABLED() ? &rec : NULL);
+    dir_stats_print(type, seconds, SB_OUTPUT_ENABLED() ? &rec : NULL);
+
+    if (SB_OUTPUT_ENABLED())
+      sb_output_write(&rec);
+
     clear_stats();
 
     break;
@@ -885,6 +1323,8 @@ const char *get_io_mode_str(file_io_mode_t mode)
       return "synchronous";
     case FILE_IO_MODE_ASYNC:
       return "asynchronous";
+    case FILE_IO_MODE_IO_URING:
+      return "io_uring";
     case FILE_IO_MODE_MMAP:
 #if SIZEOF_SIZE_T == 4
       return "slow mmaped";
@@ -933,12 +1373,15 @@ const char *get_test_mode_str(file_test_mode_t mode)
 int create_files(void)
 {
   unsigned int       i;
+  unsigned int       nthreads;
   int                fd;
   char               file_name[512];
   long long          offset;
-  long long          written = 0;
+  unsigned long long units;
   sb_timer_t         t;
   double             seconds;
+  pthread_t          *threads;
+  int                rc = 1;
 
   log_text(LOG_NOTICE, "%d files, %ldKb each, %ldMb total", num_files,
            (long)(file_size / 1024),
@@ -946,19 +1389,44 @@ int create_files(void)
   log_text(LOG_NOTICE, "Creating files for the test...");
   log_text(LOG_NOTICE, "Extra file open flags: %x", file_extra_flags);
 
-  sb_timer_init(&t);
-  sb_timer_start(&t);
-
-  for (i=0; i < num_files; i++)
+  /*
+    Split files into segments which are written by prepare threads in
+    parallel. Segments and writes are multiples of the block size, so that
+    validation checksums are placed the same way as in the test itself.
+  */
+  if (file_prepare_mode == PREPARE_MODE_WRITE)
   {
-    snprintf(file_name, sizeof(file_name), "test_file.%d",i);
+    prepare_segment = PREPARE_SEGMENT_SIZE / file_block_size * file_block_size;
+    if (prepare_segment == 0)
+      prepare_segment = file_block_size;
+    prepare_write_size = PREPARE_WRITE_SIZE / file_block_size *
+      file_block_size;
+    if (prepare_write_size == 0)
+      prepare_write_size = file_block_size;
+  }
+  else
+    prepare_segment = file_size;
 
-    fd = open(file_name, O_CREAT | O_WRONLY | file_extra_flags,
-              S_IRUSR | S_IWUSR);
+  prepare_start = (long long *) malloc(num_files * sizeof(long long));
+  prepare_units = (unsigned long long *) malloc(num_files *
+                                                sizeof(unsigned long long));
+  threads = (pthread_t *) malloc(sb_globals.num_threads * sizeof(pthread_t));
+  if (prepare_start == NULL || prepare_units == NULL || threads == NULL)
+  {
+    log_text(LOG_FATAL, "Memory allocation failure");
+    goto end;
+  }
+
+  units = 0;
+  for (i = 0; i < num_files; i++)
+  {
+    file_get_name(i, file_name, sizeof(file_name));
+
+    fd = open(file_name, O_CREAT | O_WRONLY, S_IRUSR | S_IWUSR);
     if (fd < 0)
     {
       log_errno(LOG_FATAL, "Can't open file");
-      return 1; 
+      goto end;
     }
 
 #ifndef _WIN32
@@ -966,6 +1434,7 @@ int create_files(void)
 #else
     offset = (long long) _lseeki64(fd, 0, SEEK_END);
 #endif
+    close(fd);
 
     if (offset >= file_size)
       log_text(LOG_NOTICE, "Reusing existing file %s", file_name);
@@ -974,48 +1443,280 @@ int create_files(void)
     else
       log_text(LOG_NOTICE, "Creating file %s", file_name);
 
-    for (; offset < file_size;
-         written += file_block_size, offset += file_block_size)
+    prepare_start[i] = offset;
+    if (offset < file_size)
+      units += (file_size - offset + prepare_segment - 1) / prepare_segment;
+    prepare_units[i] = units;
+  }
+
+  nthreads = sb_globals.num_threads;
+  if (nthreads > units)
+    nthreads = units;
+
+  prepare_next_unit = 0;
+  prepare_written = 0;
+  prepare_error = 0;
+
+  sb_timer_init(&t);
+  sb_timer_start(&t);
+
+  for (i = 0; i < nthreads; i++)
+  {
+    if (pthread_create(&threads[i], NULL, prepare_thread_proc, NULL))
     {
-      /*
-        If in validation mode, fill buffer with random values
-        and write checksum
-      */
-      if (sb_globals.validate)
-        file_fill_buffer(buffer, file_block_size, offset);
-                         
-      if (write(fd, buffer, file_block_size) < 0)
-        goto error;
+      log_errno(LOG_FATAL, "pthread_create() for a prepare thread failed");
+      prepare_error = 1;
+      nthreads = i;
+      break;
     }
-    
-    /* fsync files to prevent cache flush from affecting test results */
+  }
+  for (i = 0; i < nthreads; i++)
+    pthread_join(threads[i], NULL);
+
+  if (prepare_error)
+    goto end;
+
+  /* fsync files to prevent cache flush from affecting test results */
+  if (file_prepare_mode != PREPARE_MODE_SPARSE)
+  {
+    for (i = 0; i < num_files; i++)
+    {
+      if (prepare_start[i] >= file_size)
+        continue;
+      file_get_name(i, file_name, sizeof(file_name));
+      fd = open(file_name, O_WRONLY);
+      if (fd < 0)
+      {
+        log_errno(LOG_FATAL, "Can't open file");
+        goto end;
+      }
 #ifndef _WIN32
-    fsync(fd);
+      fsync(fd);
 #else
-    _commit(fd);
+      _commit(fd);
 #endif
-    close(fd);
+      close(fd);
+    }
   }
 
   sb_timer_stop(&t);
   seconds = NS2SEC(sb_timer_value(&t));
 
-  if (written > 0)
-    log_text(LOG_NOTICE, "%llu bytes written in %.2f seconds (%.2f MB/sec).",
-             written, seconds,
-             (double) (written / megabyte) / seconds);
+  if (prepare_written > 0)
+    log_text(LOG_NOTICE, "%llu bytes %s in %.2f seconds (%.2f MB/sec).",
+             prepare_written,
+             file_prepare_mode == PREPARE_MODE_WRITE ? "written" : "allocated",
+             seconds, (double) (prepare_written / megabyte) / seconds);
   else
     log_text(LOG_NOTICE, "No bytes written.");
 
+  rc = 0;
+
+ end:
+  free(threads);
+  free(prepare_start);
+  free(prepare_units);
+  prepare_start = NULL;
+  prepare_units = NULL;
+
+  return rc;
+}
+
+
+/* Prepare thread, takes file segments until all of them are done */
+
+
+void *prepare_thread_proc(void *arg)
+{
+  unsigned long long total = prepare_units[num_files - 1];
+  unsigned long long unit;
+  unsigned int       file = 0;
+  long long          from, to;
+  char               *buffer = NULL;
+
+  (void) arg; /* unused */
+
+  if (file_prepare_mode == PREPARE_MODE_WRITE)
+  {
+    buffer = sb_memalign(prepare_write_size);
+    if (buffer == NULL)
+    {
+      log_text(LOG_FATAL, "Failed to allocate I/O buffer!");
+      prepare_error = 1;
+      return NULL;
+    }
+    memset(buffer, 0, prepare_write_size);
+  }
+
+  while (!prepare_error)
+  {
+    unit = sb_atomic_add_u64(&prepare_next_unit, 1);
+    if (unit >= total)
+      break;
+
+    /* Units are taken in ascending order, so files only move forward */
+    while (prepare_units[file] <= unit)
+      file++;
+
+    from = prepare_start[file] + (long long) (unit -
+      (file > 0 ? prepare_units[file - 1] : 0)) * prepare_segment;
+    to = from + prepare_segment;
+    if (to > file_size)
+      to = file_size;
+
+    if (prepare_range(file, from, to, buffer))
+      prepare_error = 1;
+  }
+
+  if (buffer != NULL)
+    sb_free_memaligned(buffer);
+
+  return NULL;
+}
+
+
+/* Prepare the [from, to) range of a file according to --file-prepare-mode */
+
+
+int prepare_range(unsigned int file, long long from, long long to,
+                  char *buffer)
+{
+  char      file_name[512];
+  int       fd;
+  int       direct;
+  long long offset;
+  long long len;
+  long long i;
+#ifdef HAVE_POSIX_FALLOCATE
+  int       err;
+#endif
+
+  file_get_name(file, file_name, sizeof(file_name));
+
+  /* Direct I/O requires aligned offsets and sizes */
+  direct = PREPARE_O_DIRECT != 0 &&
+    file_prepare_mode == PREPARE_MODE_WRITE &&
+    from % PREPARE_DIRECT_ALIGN == 0 &&
+    prepare_write_size % PREPARE_DIRECT_ALIGN == 0;
+
+  fd = open(file_name, O_WRONLY | (direct ? PREPARE_O_DIRECT : 0));
+  if (fd < 0 && direct && errno == EINVAL)
+  {
+    /* The file system does not support direct I/O */
+    direct = 0;
+    fd = open(file_name, O_WRONLY);
+  }
+  if (fd < 0)
+  {
+    log_errno(LOG_FATAL, "Can't open file");
+    return 1;
+  }
+
+  switch (file_prepare_mode) {
+    case PREPARE_MODE_SPARSE:
+      if (ftruncate(fd, to))
+      {
+        log_errno(LOG_FATAL, "ftruncate() failed on file %s", file_name);
+        goto error;
+      }
+      break;
+
+    case PREPARE_MODE_FALLOCATE:
+#ifdef HAVE_POSIX_FALLOCATE
+      /* posix_fallocate() returns an error code rather than setting errno */
+      err = posix_fallocate(fd, from, to - from);
+      if (err != 0)
+      {
+        errno = err;
+        log_errno(LOG_FATAL, "posix_fallocate() failed on file %s",
+                  file_name);
+        goto error;
+      }
+#endif
+      break;
+
+    case PREPARE_MODE_WRITE:
+      for (offset = from; offset < to; offset += len)
+      {
+        len = to - offset;
+        if (len > prepare_write_size)
+          len = prepare_write_size;
+
+        /*
+          If in validation mode, fill full blocks with random values and
+          write checksums
+        */
+        if (sb_globals.validate)
+        {
+          for (i = 0; i + file_block_size <= len; i += file_block_size)
+            file_fill_buffer((unsigned char *) buffer + i, file_block_size,
+                             offset + i);
+          memset(buffer + i, 0, len - i);
+        }
+
+        /* The tail of a file may be unaligned, write it through the cache */
+        if (direct && len % PREPARE_DIRECT_ALIGN != 0)
+        {
+          close(fd);
+          direct = 0;
+          fd = open(file_name, O_WRONLY);
+          if (fd < 0)
+          {
+            log_errno(LOG_FATAL, "Can't open file");
+            return 1;
+          }
+        }
+
+        if (prepare_pwrite(fd, buffer, len, offset))
+        {
+          log_errno(LOG_FATAL, "Failed to write file!");
+          goto error;
+        }
+      }
+      break;
+  }
+
+  sb_atomic_add_u64(&prepare_written, to - from);
+  close(fd);
+
   return 0;
 
  error:
-  log_errno(LOG_FATAL, "Failed to write file!");
   close(fd);
   return 1;
 }
 
 
+/* Write a buffer at the specified offset, retrying on partial writes */
+
+
+int prepare_pwrite(int fd, const char *buf, size_t len, long long offset)
+{
+  ssize_t rc;
+
+  while (len > 0)
+  {
+#ifndef _WIN32
+    rc = pwrite(fd, buf, len, offset);
+#else
+    if (_lseeki64(fd, offset, SEEK_SET) < 0)
+      return 1;
+    rc = write(fd, buf, (unsigned int) len);
+#endif
+    if (rc < 0 && errno == EINTR)
+      continue;
+    if (rc <= 0)
+      return 1;
+
+    buf += rc;
+    len -= rc;
+    offset += rc;
+  }
+
+  return 0;
+}
+
+
 /* Remove test files */
 
 
@@ -1028,7 +1729,7 @@ int remove_files(void)
   
   for (i = 0; i < num_files; i++)
   {
-    snprintf(file_name, sizeof(file_name), "test_file.%d",i);
+    file_get_name(i, file_name, sizeof(file_name));
     unlink(file_name);
   }
 
@@ -1068,33 +1769,96 @@ int file_cmd_cleanup(void)
 
 void init_vars(void)
 {
-  position = 0; /* position in file */
-  current_file = 0;
-  fsynced_file = 0; /* for counting file to be fsynced */
+  seq_req_num = 0;
+  seq_reqs_per_file = (file_size + file_max_request_size - 1) /
+    file_max_request_size;
+  if (seq_reqs_per_file == 0)
+    seq_reqs_per_file = 1;
   fsynced_file2 = 0;
-  req_performed = 0;
-  is_dirty = 0;
-  if (sb_globals.validate)
+
+  if (file_seq_streams == SEQ_STREAMS_PER_THREAD)
+    init_seq_streams();
+}
+
+
+/*
+  Assign each thread its own sequential stream. With at least as many files
+  as threads, every thread gets a subset of whole files. Otherwise the space
+  of request numbers is split evenly, so each thread gets a region within a
+  file.
+*/
+
+
+void init_seq_streams(void)
+{
+  unsigned int       nthreads = sb_globals.num_threads;
+  unsigned long long total = seq_reqs_per_file * num_files;
+  unsigned long long first;
+  unsigned long long last;
+  unsigned int       i;
+
+  for (i = 0; i < nthreads; i++)
+  {
+    sb_file_thread_t *ctxt = &file_threads[i];
+
+    if (num_files >= nthreads)
+    {
+      first = (unsigned long long) i * num_files / nthreads * seq_reqs_per_file;
+      last = (unsigned long long) (i + 1) * num_files / nthreads *
+        seq_reqs_per_file;
+    }
+    else
+    {
+      first = i * total / nthreads;
+      last = (i + 1) * total / nthreads;
+    }
+
+    /* More threads than requests, let some threads share a single request */
+    if (last <= first)
+    {
+      first = i % total;
+      last = first + 1;
+    }
+
+    ctxt->seq_first = first;
+    ctxt->seq_last = last;
+    ctxt->seq_next = first;
+    ctxt->seq_first_file = (unsigned int) (first / seq_reqs_per_file);
+    ctxt->seq_num_files = (unsigned int) ((last - 1) / seq_reqs_per_file) -
+      ctxt->seq_first_file + 1;
+  }
+}
+
+/* Discard statistics collected during warmup */
+
+
+void file_reset_stats(void)
+{
+  unsigned int op;
+  unsigned int dir;
+
+  clear_stats();
+
+  for (op = FILE_OP_TYPE_READ; op <= FILE_OP_TYPE_FSYNC; op++)
+    sb_percentile_reset(&op_latency[op]);
+
+  if (file_num_dirs > 0)
   {
-    prev_req.size = 0;
-    prev_req.operation = FILE_OP_TYPE_NULL;
-    prev_req.file_id = 0;
-    prev_req.pos = 0;
+    dir_stats_snapshot(dir_last_cumulative);
+    for (dir = 0; dir < file_num_dirs; dir++)
+      sb_percentile_reset(&dir_latency[dir]);
   }
 }
 
+
 void clear_stats(void)
 {
-  read_ops = 0;
-  real_read_ops = 0;
-  write_ops = 0;
-  real_write_ops = 0;
-  other_ops = 0;
+  sb_counters_reset();
   last_other_ops = 0;
-  bytes_read = 0;
   last_bytes_read = 0;
-  bytes_written = 0;
   last_bytes_written = 0;
+  if (file_num_dirs > 0)
+    dir_stats_snapshot(dir_last_interval);
   /*
     So that intermediate stats are calculated from the current moment
     rather than from the previous intermediate report
@@ -1104,184 +1868,1024 @@ void clear_stats(void)
 }
 
 
-#ifdef HAVE_LIBAIO
-/* Allocate async contexts pool */
+/*
+  Allocate per-directory counters and histograms. Counters of each thread are
+  page-aligned, so that threads do not share cache lines.
+*/
 
 
-int file_async_init(void)
+int dir_stats_init(void)
 {
   unsigned int i;
 
-  if (file_io_mode != FILE_IO_MODE_ASYNC)
+  if (file_num_dirs == 0)
     return 0;
-  
-  file_async_backlog = sb_get_value_int("file-async-backlog");
-  if (file_async_backlog <= 0) {
-    log_text(LOG_FATAL, "Invalid value of file-async-backlog: %d",
-             file_async_backlog);
+
+  for (i = 0; i < sb_globals.num_threads; i++)
+  {
+    file_threads[i].dir_stats = sb_memalign(file_num_dirs *
+                                            sizeof(file_dir_stats_t));
+    if (file_threads[i].dir_stats == NULL)
+    {
+      log_text(LOG_FATAL, "Memory allocation failure.");
+      return 1;
+    }
+    memset(file_threads[i].dir_stats, 0,
+           file_num_dirs * sizeof(file_dir_stats_t));
+  }
+
+  dir_last_interval = (file_dir_stats_t *) calloc(file_num_dirs,
+                                                  sizeof(file_dir_stats_t));
+  dir_last_cumulative = (file_dir_stats_t *) calloc(file_num_dirs,
+                                                    sizeof(file_dir_stats_t));
+  dir_latency = (sb_percentile_t *) calloc(file_num_dirs,
+                                           sizeof(sb_percentile_t));
+  if (dir_last_interval == NULL || dir_last_cumulative == NULL ||
+      dir_latency == NULL)
+  {
+    log_text(LOG_FATAL, "Memory allocation failure.");
     return 1;
   }
 
-  aio_ctxts = (sb_aio_context_t *)calloc(sb_globals.num_threads,
-                                         sizeof(sb_aio_context_t));
+  for (i = 0; i < file_num_dirs; i++)
+    if (sb_percentile_init(&dir_latency[i], sb_globals.histogram_digits,
+                           OP_LATENCY_MAX_VALUE))
+      return 1;
+
+  return 0;
+}
+
+
+void dir_stats_done(void)
+{
+  unsigned int i;
+
+  if (file_num_dirs == 0)
+    return;
+
+  for (i = 0; i < file_num_dirs; i++)
+    sb_percentile_done(&dir_latency[i]);
+
+  free(dir_latency);
+  free(dir_last_interval);
+  free(dir_last_cumulative);
+}
+
+
+/* Sum per-directory counters of all threads */
+
+
+void dir_stats_snapshot(file_dir_stats_t *to)
+{
+  file_dir_stats_t *stats;
+  unsigned int     i, dir, op;
+
+  memset(to, 0, file_num_dirs * sizeof(file_dir_stats_t));
+
   for (i = 0; i < sb_globals.num_threads; i++)
+    for (dir = 0; dir < file_num_dirs; dir++)
+    {
+      stats = &file_threads[i].dir_stats[dir];
+      for (op = FILE_OP_TYPE_READ; op <= FILE_OP_TYPE_FSYNC; op++)
+      {
+        to[dir].ops[op] += sb_atomic_load_u64(&stats->ops[op]);
+        to[dir].bytes[op] += sb_atomic_load_u64(&stats->bytes[op]);
+      }
+    }
+}
+
+
+/*
+  Print statistics of each directory for the period since the previous report
+  of the same type, and add them to 'rec', if it is not NULL
+*/
+
+
+void dir_stats_print(sb_stat_t type, double seconds, sb_output_record_t *rec)
+{
+  file_dir_stats_t   *snapshot;
+  file_dir_stats_t   *last;
+  file_dir_stats_t   *cur;
+  double             values[MAX_PERCENTILES];
+  double             max;
+  double             reads, writes, fsyncs;
+  double             bytes;
+  char               name[48];
+  char               s1[16];
+  unsigned long long n;
+  unsigned int       rank = percentile_rank_index();
+  unsigned int       dir;
+
+  if (file_num_dirs == 0)
+    return;
+
+  snapshot = (file_dir_stats_t *) malloc(file_num_dirs *
+                                         sizeof(file_dir_stats_t));
+  if (snapshot == NULL)
+    return;
+  dir_stats_snapshot(snapshot);
+
+  last = type == SB_STAT_INTERMEDIATE ? dir_last_interval :
+    dir_last_cumulative;
+
+  if (type == SB_STAT_CUMULATIVE)
   {
-    if (io_queue_init(file_async_backlog, &aio_ctxts[i].io_ctxt))
+    log_text(LOG_NOTICE, "");
+    log_text(LOG_NOTICE, "Per-directory statistics:");
+  }
+
+  for (dir = 0; dir < file_num_dirs; dir++)
+  {
+    cur = &snapshot[dir];
+    reads = cur->ops[FILE_OP_TYPE_READ] - last[dir].ops[FILE_OP_TYPE_READ];
+    writes = cur->ops[FILE_OP_TYPE_WRITE] -
+      last[dir].ops[FILE_OP_TYPE_WRITE];
+    fsyncs = cur->ops[FILE_OP_TYPE_FSYNC] -
+      last[dir].ops[FILE_OP_TYPE_FSYNC];
+    bytes = (cur->bytes[FILE_OP_TYPE_READ] -
+             last[dir].bytes[FILE_OP_TYPE_READ]) +
+      (cur->bytes[FILE_OP_TYPE_WRITE] - last[dir].bytes[FILE_OP_TYPE_WRITE]);
+    last[dir] = *cur;
+
+    if (type == SB_STAT_INTERMEDIATE)
+      n = sb_percentile_calculate_interval(&dir_latency[dir],
+                                           sb_globals.percentiles, values,
+                                           sb_globals.n_percentiles, &max);
+    else
     {
-      log_errno(LOG_FATAL, "io_queue_init() failed!");
-      return 1;
+      n = sb_percentile_calculate_multi(&dir_latency[dir],
+                                        sb_globals.percentiles, values,
+                                        sb_globals.n_percentiles, &max);
+      sb_percentile_reset_cumulative(&dir_latency[dir]);
     }
-      
-    aio_ctxts[i].events = (struct io_event *)malloc(file_async_backlog *
-                                                    sizeof(struct io_event));
-    if (aio_ctxts[i].events == NULL)
+    if (n == 0)
     {
-      log_errno(LOG_FATAL, "Failed to allocate async I/O context!");
-      return 1;
+      memset(values, 0, sizeof(values));
+      max = 0;
     }
+
+    if (type == SB_STAT_INTERMEDIATE)
+      log_text(LOG_NOTICE, "    %s: reads: %.2f/s writes: %.2f/s "
+               "fsyncs: %.2f/s %4.2f MB/s latency p%g: %.2fms max: %.2fms",
+               file_dirs[dir], reads / seconds, writes / seconds,
+               fsyncs / seconds, bytes / megabyte / seconds,
+               sb_globals.percentiles[rank], NS2MS(values[rank]),
+               NS2MS(max));
+    else
+    {
+      log_text(LOG_NOTICE, "    %s:", file_dirs[dir]);
+      log_text(LOG_NOTICE, "        %.0f reads (%.2f/s), %.0f writes "
+               "(%.2f/s), %.0f fsyncs (%.2f/s)", reads, reads / seconds,
+               writes, writes / seconds, fsyncs, fsyncs / seconds);
+      log_text(LOG_NOTICE, "        %sb/sec, latency p%g: %.2fms, max: %.2fms",
+               sb_print_value_size(s1, sizeof(s1), bytes / seconds),
+               sb_globals.percentiles[rank], NS2MS(values[rank]),
+               NS2MS(max));
+    }
+
+    if (rec != NULL)
+    {
+      snprintf(name, sizeof(name), "dir%u_reads_per_sec", dir);
+      sb_output_add(rec, name, reads / seconds);
+      snprintf(name, sizeof(name), "dir%u_writes_per_sec", dir);
+      sb_output_add(rec, name, writes / seconds);
+      snprintf(name, sizeof(name), "dir%u_fsyncs_per_sec", dir);
+      sb_output_add(rec, name, fsyncs / seconds);
+      snprintf(name, sizeof(name), "dir%u_mb_per_sec", dir);
+      sb_output_add(rec, name, bytes / megabyte / seconds);
+      snprintf(name, sizeof(name), "dir%u_latency", dir);
+      sb_output_add_percentiles(rec, name, values, max);
+    }
+  }
+
+  free(snapshot);
+}
+
+
+/* Initialize per-operation latency histograms */
+
+
+int op_latency_init(void)
+{
+  unsigned int op;
+
+  for (op = FILE_OP_TYPE_READ; op <= FILE_OP_TYPE_FSYNC; op++)
+    if (sb_percentile_init(&op_latency[op], sb_globals.histogram_digits,
+                           OP_LATENCY_MAX_VALUE))
+      return 1;
+
+  return 0;
+}
+
+
+void op_latency_done(void)
+{
+  unsigned int op;
+
+  for (op = FILE_OP_TYPE_READ; op <= FILE_OP_TYPE_FSYNC; op++)
+    sb_percentile_done(&op_latency[op]);
+}
+
+
+/*
+  Record completion of an operation of 'len' bytes on file 'file_id' started
+  at 'start'
+*/
+
+
+void file_op_record(int thread_id, unsigned int file_id, sb_file_op_t op,
+                    ssize_t len, sb_time_t start)
+{
+  long long          ns = sb_time_diff(sb_timer_now(), start);
+  unsigned long long value = ns > 0 ? (unsigned long long) ns : 0;
+  file_dir_stats_t   *stats;
+  unsigned int       dir;
+
+  sb_percentile_update(&op_latency[op], value);
+
+  if (file_num_dirs == 0)
+    return;
+
+  dir = file_id % file_num_dirs;
+  stats = &file_threads[thread_id].dir_stats[dir];
+  /* Only the owning thread writes, no read-modify-write atomicity needed */
+  sb_atomic_store_u64(&stats->ops[op], sb_atomic_load_u64(&stats->ops[op]) + 1);
+  sb_atomic_store_u64(&stats->bytes[op],
+                      sb_atomic_load_u64(&stats->bytes[op]) + len);
+  sb_percentile_update(&dir_latency[dir], value);
+}
+
+
+/* Get index of the --percentile rank in the list of reported percentiles */
+
+
+unsigned int percentile_rank_index(void)
+{
+  unsigned int i;
+
+  for (i = 0; i < sb_globals.n_percentiles; i++)
+    if (sb_globals.percentiles[i] == sb_globals.percentile_rank)
+      return i;
+
+  return 0;
+}
+
+
+/*
+  Format the --percentile rank and the maximum latency of each operation type
+  performed since the previous call into 'buf' for intermediate reports. All
+  percentiles are added to 'rec', if it is not NULL.
+*/
+
+
+void op_latency_print_interval(char *buf, size_t size, sb_output_record_t *rec)
+{
+  double             values[MAX_PERCENTILES];
+  double             max;
+  char               name[32];
+  unsigned long long n;
+  unsigned int       op;
+  unsigned int       rank = percentile_rank_index();
+  size_t             len = 0;
+
+  buf[0] = '\0';
+  for (op = FILE_OP_TYPE_READ; op <= FILE_OP_TYPE_FSYNC; op++)
+  {
+    n = sb_percentile_calculate_interval(&op_latency[op],
+                                         sb_globals.percentiles, values,
+                                         sb_globals.n_percentiles, &max);
+    if (n == 0)
+      continue;
+
+    if (len < size)
+      len += snprintf(buf + len, size - len, ", %s p%g: %.2fms max: %.2fms",
+                      op_names[op], sb_globals.percentiles[rank],
+                      NS2MS(values[rank]), NS2MS(max));
+
+    if (rec != NULL)
+    {
+      snprintf(name, sizeof(name), "%s_latency", op_names[op]);
+      sb_output_add_percentiles(rec, name, values, max);
+    }
+  }
+}
+
+
+/*
+  Print percentiles of each operation type performed since the previous
+  cumulative report and add them to 'rec', if it is not NULL
+*/
+
+
+void op_latency_print_cumulative(sb_output_record_t *rec)
+{
+  double             values[MAX_PERCENTILES];
+  double             max;
+  char               line[512];
+  char               name[32];
+  unsigned long long n;
+  unsigned int       op;
+  unsigned int       i;
+  size_t             len;
+
+  len = snprintf(line, sizeof(line), "    %-8s %12s", "", "count");
+  for (i = 0; i < sb_globals.n_percentiles && len < sizeof(line); i++)
+  {
+    snprintf(name, sizeof(name), "p%g", sb_globals.percentiles[i]);
+    len += snprintf(line + len, sizeof(line) - len, " %10s", name);
+  }
+  if (len < sizeof(line))
+    snprintf(line + len, sizeof(line) - len, " %10s", "max");
+
+  log_text(LOG_NOTICE, "");
+  log_text(LOG_NOTICE, "Latency by operation type (ms):");
+  log_text(LOG_NOTICE, "%s", line);
+
+  for (op = FILE_OP_TYPE_READ; op <= FILE_OP_TYPE_FSYNC; op++)
+  {
+    n = sb_percentile_calculate_multi(&op_latency[op], sb_globals.percentiles,
+                                      values, sb_globals.n_percentiles, &max);
+    sb_percentile_reset_cumulative(&op_latency[op]);
+
+    len = snprintf(line, sizeof(line), "    %-8s %12llu", op_names[op], n);
+    for (i = 0; i < sb_globals.n_percentiles && len < sizeof(line); i++)
+      len += snprintf(line + len, sizeof(line) - len, " %10.2f",
+                      n > 0 ? NS2MS(values[i]) : 0.0);
+    if (len < sizeof(line))
+      snprintf(line + len, sizeof(line) - len, " %10.2f",
+               n > 0 ? NS2MS(max) : 0.0);
+    log_text(LOG_NOTICE, "%s", line);
+
+    if (rec != NULL && n > 0)
+    {
+      snprintf(name, sizeof(name), "%s_latency", op_names[op]);
+      sb_output_add_percentiles(rec, name, values, max);
+    }
+  }
+}
+
+
+/*
+  Calculate the layout of per-thread I/O buffers. The buffers are allocated
+  in file_thread_init().
+*/
+
+
+int file_buffers_init(void)
+{
+  unsigned long page_size = sb_getpagesize();
+
+  file_buffer_slots = 1;
+#ifdef HAVE_LIBAIO
+  if (file_io_mode == FILE_IO_MODE_ASYNC)
+    file_buffer_slots = file_async_backlog;
+#endif
+#ifdef HAVE_IO_URING
+  if (file_io_mode == FILE_IO_MODE_IO_URING)
+    file_buffer_slots = file_uring_depth;
+#endif
+
+  /* Keep each buffer page-aligned for direct I/O */
+  file_buffer_size = (file_max_request_size + page_size - 1) / page_size *
+    page_size;
+
+  return 0;
+}
+
+
+/*
+  Get the I/O buffer for the next read or write request of the specified
+  thread. In asynchronous modes this is the buffer of the slot to be used by
+  the next submitted request, so wait for a request to complete if all slots
+  are busy.
+*/
+
+
+void *file_get_buffer(int thread_id)
+{
+  unsigned int slot = 0;
+
+#ifdef HAVE_LIBAIO
+  if (file_io_mode == FILE_IO_MODE_ASYNC)
+  {
+    sb_aio_context_t *ctxt = &aio_ctxts[thread_id];
+
+    /* Operation N always uses buffer slot N */
+    if (ctxt->nfree == 0 && file_wait(thread_id, 1))
+      return NULL;
+    slot = ctxt->free_opers[ctxt->nfree - 1];
+  }
+#endif
+#ifdef HAVE_IO_URING
+  if (file_io_mode == FILE_IO_MODE_IO_URING)
+  {
+    sb_uring_context_t *ctxt = &uring_ctxts[thread_id];
+
+    if (ctxt->nfree == 0 && file_uring_wait(thread_id, 1))
+      return NULL;
+    slot = ctxt->free_slots[ctxt->nfree - 1];
+  }
+#endif
+
+  return (char *)file_threads[thread_id].buffers + slot * file_buffer_size;
+}
+
+
+#if defined(HAVE_LIBAIO) || defined(HAVE_IO_URING)
+/* Wait for all async operations to complete before the end of the test */
+
+
+int file_thread_done(int thread_id)
+{
+#ifdef HAVE_LIBAIO
+  if (file_io_mode == FILE_IO_MODE_ASYNC && aio_ctxts[thread_id].nrequests > 0)
+    return file_wait(thread_id, aio_ctxts[thread_id].nrequests);
+#endif
+#ifdef HAVE_IO_URING
+  if (file_io_mode == FILE_IO_MODE_IO_URING)
+    return file_uring_wait(thread_id,
+                           file_uring_depth - uring_ctxts[thread_id].nfree);
+#endif
+
+  return 0;
+}
+#endif
+
+
+#ifdef HAVE_LIBAIO
+/* Allocate async contexts pool */
+
+
+int file_async_init(void)
+{
+  unsigned int i, j;
+
+  if (file_io_mode != FILE_IO_MODE_ASYNC)
+    return 0;
+  
+  file_async_backlog = sb_get_value_int("file-async-backlog");
+  if (file_async_backlog <= 0) {
+    log_text(LOG_FATAL, "Invalid value of file-async-backlog: %d",
+             file_async_backlog);
+    return 1;
+  }
+
+  file_async_batch = sb_get_value_int("file-async-batch");
+  if (file_async_batch <= 0 || file_async_batch > file_async_backlog) {
+    log_text(LOG_FATAL, "Invalid value of file-async-batch: %d",
+             file_async_batch);
+    return 1;
+  }
+
+  aio_ctxts = (sb_aio_context_t *)calloc(sb_globals.num_threads,
+                                         sizeof(sb_aio_context_t));
+  for (i = 0; i < sb_globals.num_threads; i++)
+  {
+    if (io_queue_init(file_async_backlog, &aio_ctxts[i].io_ctxt))
+    {
+      log_errno(LOG_FATAL, "io_queue_init() failed!");
+      return 1;
+    }
+      
+    aio_ctxts[i].events = (struct io_event *)malloc(file_async_backlog *
+                                                    sizeof(struct io_event));
+    aio_ctxts[i].opers = (sb_aio_oper_t *)calloc(file_async_backlog,
+                                                 sizeof(sb_aio_oper_t));
+    aio_ctxts[i].free_opers = (unsigned int *)malloc(file_async_backlog *
+                                                     sizeof(unsigned int));
+    aio_ctxts[i].pending = (struct iocb **)malloc(file_async_backlog *
+                                                  sizeof(struct iocb *));
+    if (aio_ctxts[i].events == NULL || aio_ctxts[i].opers == NULL ||
+        aio_ctxts[i].free_opers == NULL || aio_ctxts[i].pending == NULL)
+    {
+      log_errno(LOG_FATAL, "Failed to allocate async I/O context!");
+      return 1;
+    }
+
+    for (j = 0; j < file_async_backlog; j++)
+      aio_ctxts[i].free_opers[j] = file_async_backlog - j - 1;
+    aio_ctxts[i].nfree = file_async_backlog;
+  }
+
+  return 0;
+}
+
+
+/* Destroy async contexts pool */
+
+
+int file_async_done(void)
+{
+  unsigned int i;
+  
+  if (file_io_mode != FILE_IO_MODE_ASYNC)
+    return 0;
+
+  for (i = 0; i < sb_globals.num_threads; i++)
+  {
+    io_queue_release(aio_ctxts[i].io_ctxt);
+    free(aio_ctxts[i].events);
+    free(aio_ctxts[i].opers);
+    free(aio_ctxts[i].free_opers);
+    free(aio_ctxts[i].pending);
+  }
+  
+  free(aio_ctxts);
+
+  return 0;
+}  
+
+
+/*
+  Queue async I/O requests and submit them in batches of file_async_batch
+  requests until the length of request queue exceeds the limit. Then wait for
+  at least one request to complete and proceed.
+*/
+
+
+int file_submit_or_wait(struct iocb *iocb, sb_file_op_t type,
+                        unsigned int file_id, ssize_t len, long long pos,
+                        void *buf, int thread_id)
+{
+  sb_aio_context_t *ctxt = &aio_ctxts[thread_id];
+  sb_aio_oper_t    *oper;
+
+  if (ctxt->nfree == 0 && file_wait(thread_id, 1))
+    return 1;
+
+  /* The buffer was returned by file_get_buffer() for the top free operation */
+  oper = &ctxt->opers[ctxt->free_opers[--ctxt->nfree]];
+
+  memcpy(&oper->iocb, iocb, sizeof(*iocb));
+  oper->start = sb_timer_now();
+  oper->type = type;
+  oper->file_id = file_id;
+  oper->len = len;
+  oper->pos = pos;
+  oper->buf = buf;
+
+  if (type == FILE_OP_TYPE_WRITE)
+    file_writes_start(file_id, pos, len);
+  else if (type == FILE_OP_TYPE_READ)
+    oper->write_gen = file_writes_gen(file_id, pos, len, &oper->overlap);
+
+  ctxt->pending[ctxt->npending++] = &oper->iocb;
+  ctxt->nrequests++;
+
+  if (ctxt->npending >= file_async_batch && file_async_flush(thread_id))
+    return 1;
+
+  if (ctxt->nfree > 0)
+    return 0;
+  
+  return file_wait(thread_id, 1);
+}
+
+
+/* Submit all pending I/O requests of the specified thread */
+
+
+int file_async_flush(int thread_id)
+{
+  sb_aio_context_t *ctxt = &aio_ctxts[thread_id];
+  unsigned int     nsubmitted = 0;
+  int              rc;
+
+  while (nsubmitted < ctxt->npending)
+  {
+    rc = io_submit(ctxt->io_ctxt, ctxt->npending - nsubmitted,
+                   ctxt->pending + nsubmitted);
+    if (rc < 1)
+    {
+      log_errno(LOG_FATAL, "io_submit() failed!");
+      return 1;
+    }
+    nsubmitted += rc;
+  }
+  ctxt->npending = 0;
+
+  return 0;
+}
+
+
+/*
+  Wait for at least nreq I/O requests to complete
+*/
+
+
+int file_wait(int thread_id, long nreq)
+{ 
+  long            i;
+  long            nr;
+  struct io_event *event;
+  sb_aio_oper_t   *oper;
+  struct iocb     *iocbp;
+
+  /* Make sure that requests we are going to wait for are submitted */
+  if (aio_ctxts[thread_id].npending > 0 && file_async_flush(thread_id))
+    return 1;
+
+  /* Try to read some events */
+#ifdef HAVE_OLD_GETEVENTS
+  (void)nreq; /* unused */
+  nr = io_getevents(aio_ctxts[thread_id].io_ctxt, file_async_backlog,
+                    aio_ctxts[thread_id].events, NULL);
+#else
+  nr = io_getevents(aio_ctxts[thread_id].io_ctxt, nreq, file_async_backlog,
+                    aio_ctxts[thread_id].events, NULL);
+#endif
+  if (nr < 1)
+  {
+    log_errno(LOG_FATAL, "io_getevents() failed!");
+    return 1;
+  }
+
+  /*
+    Release all reaped operations before checking results, so that
+    file_thread_done() does not wait for them again after an error
+  */
+  for (i = 0; i < nr; i++)
+  {
+    event = (struct io_event *)aio_ctxts[thread_id].events + i;
+    oper = (sb_aio_oper_t *)(unsigned long)event->obj;
+    aio_ctxts[thread_id].free_opers[aio_ctxts[thread_id].nfree++] =
+      oper - aio_ctxts[thread_id].opers;
+    aio_ctxts[thread_id].nrequests--;
+    if (oper->type == FILE_OP_TYPE_WRITE)
+      file_writes_complete(oper->file_id, oper->pos, oper->len);
+  }
+
+  /* Verify results */
+  for (i = 0; i < nr; i++)
+  {
+    event = (struct io_event *)aio_ctxts[thread_id].events + i;
+    iocbp = (struct iocb *)(unsigned long)event->obj;
+    oper = (sb_aio_oper_t *)iocbp;
+    switch (oper->type) {
+      case FILE_OP_TYPE_FSYNC:
+        if (event->res != 0)
+        {
+          log_text(LOG_FATAL, "Asynchronous fsync failed!\n");
+          return 1;
+        }
+        break;
+      case FILE_OP_TYPE_READ:
+        if ((ssize_t)event->res != oper->len)
+        {
+          log_text(LOG_FATAL, "Asynchronous read failed!\n");
+          return 1;
+        }
+        /* Skip reads that may have seen a partially written block */
+        if (sb_globals.validate &&
+            !file_writes_overlap(oper->file_id, oper->pos, oper->len,
+                                 oper->write_gen, oper->overlap) &&
+            file_validate_buffer(oper->buf, oper->len, oper->pos))
+        {
+          log_text(LOG_FATAL,
+                   "Validation failed on block offset 0x%llx, exiting...",
+                   (unsigned long long) oper->pos);
+          return 1;
+        }
+        break;
+      case FILE_OP_TYPE_WRITE:
+        if ((ssize_t)event->res != oper->len)
+        {
+          log_text(LOG_FATAL, "Asynchronous write failed!\n");
+          return 1;
+        }
+        break;
+      default:
+        break;
+    }
+    file_op_record(thread_id, oper->file_id, oper->type, oper->len,
+                   oper->start);
+  }
+  
+  return 0;
+}
+#endif /* HAVE_LIBAIO */
+
+#ifdef HAVE_IO_URING
+/* Create per-thread io_uring contexts */
+
+
+int file_uring_init(void)
+{
+  unsigned int       i, j;
+  int                rc;
+  sb_uring_context_t *ctxt;
+
+  if (file_io_mode != FILE_IO_MODE_IO_URING)
+    return 0;
+
+  rc = sb_get_value_int("file-uring-depth");
+  if (rc <= 0)
+  {
+    log_text(LOG_FATAL, "Invalid value of file-uring-depth: %d", rc);
+    return 1;
+  }
+  file_uring_depth = rc;
+  file_uring_fixed = sb_get_value_flag("file-uring-fixed");
+  file_uring_sqpoll = sb_get_value_flag("file-uring-sqpoll");
+
+  uring_ctxts = (sb_uring_context_t *)calloc(sb_globals.num_threads,
+                                             sizeof(sb_uring_context_t));
+  if (uring_ctxts == NULL)
+  {
+    log_text(LOG_FATAL, "Failed to allocate io_uring contexts!");
+    return 1;
+  }
+
+  for (i = 0; i < sb_globals.num_threads; i++)
+  {
+    ctxt = &uring_ctxts[i];
+
+    if ((rc = sb_uring_init(&ctxt->ring, file_uring_depth,
+                            file_uring_sqpoll)) < 0)
+    {
+      errno = -rc;
+      log_errno(LOG_FATAL, "io_uring_setup() failed!");
+      return 1;
+    }
+    uring_nctxts++;
+
+    ctxt->opers = (sb_uring_oper_t *)calloc(file_uring_depth,
+                                            sizeof(sb_uring_oper_t));
+    ctxt->free_slots = (unsigned int *)malloc(file_uring_depth *
+                                              sizeof(unsigned int));
+    ctxt->nwrites = (unsigned int *)calloc(num_files, sizeof(unsigned int));
+    if (ctxt->opers == NULL || ctxt->free_slots == NULL ||
+        ctxt->nwrites == NULL)
+    {
+      log_text(LOG_FATAL, "Failed to allocate io_uring context!");
+      return 1;
+    }
+
+    for (j = 0; j < file_uring_depth; j++)
+      ctxt->free_slots[j] = file_uring_depth - j - 1;
+    ctxt->nfree = file_uring_depth;
+  }
+
+  return 0;
+}
+
+
+/* Register files and the thread's I/O buffers with its io_uring context */
+
+
+int file_uring_thread_init(int thread_id)
+{
+  int          rc;
+  struct iovec iov;
+
+  if (file_io_mode != FILE_IO_MODE_IO_URING || !file_uring_fixed)
+    return 0;
+
+  iov.iov_base = file_threads[thread_id].buffers;
+  iov.iov_len = file_buffer_slots * file_buffer_size;
+
+  if ((rc = sb_uring_register_files(&uring_ctxts[thread_id].ring, files,
+                                    num_files)) < 0)
+  {
+    errno = -rc;
+    log_errno(LOG_FATAL, "Failed to register files with io_uring!");
+    return 1;
+  }
+  if ((rc = sb_uring_register_buffers(&uring_ctxts[thread_id].ring, &iov,
+                                      1)) < 0)
+  {
+    errno = -rc;
+    log_errno(LOG_FATAL, "Failed to register buffers with io_uring!");
+    return 1;
   }
 
   return 0;
 }
 
 
-/* Destroy async contexts pool */
+/* Destroy io_uring contexts */
 
 
-int file_async_done(void)
+int file_uring_done(void)
 {
   unsigned int i;
-  
-  if (file_io_mode != FILE_IO_MODE_ASYNC)
+
+  if (file_io_mode != FILE_IO_MODE_IO_URING || uring_ctxts == NULL)
     return 0;
 
   for (i = 0; i < sb_globals.num_threads; i++)
   {
-    io_queue_release(aio_ctxts[i].io_ctxt);
-    free(aio_ctxts[i].events);
+    if (i < uring_nctxts)
+      sb_uring_done(&uring_ctxts[i].ring);
+    free(uring_ctxts[i].opers);
+    free(uring_ctxts[i].free_slots);
+    free(uring_ctxts[i].nwrites);
   }
-  
-  free(aio_ctxts);
-
-  return 0;
-}  
-
-
-/* Wait for all async operations to complete before the end of the test */
 
-
-int file_thread_done(int thread_id)
-{
-  if (file_io_mode == FILE_IO_MODE_ASYNC && aio_ctxts[thread_id].nrequests > 0)
-    return file_wait(thread_id, aio_ctxts[thread_id].nrequests);
+  free(uring_ctxts);
+  uring_ctxts = NULL;
+  uring_nctxts = 0;
 
   return 0;
 }
 
+
 /*
-  Submit async I/O requests until the length of request queue exceeds
-  the limit. Then wait for at least one request to complete and proceed.
+  Queue an I/O request to the thread's ring. If the queue depth limit is
+  reached, wait for at least one request to complete first.
 */
 
 
-int file_submit_or_wait(struct iocb *iocb, sb_file_op_t type, ssize_t len,
-                        int thread_id)
+int file_uring_submit(int thread_id, sb_file_op_t type, unsigned int file_id,
+                      void *buf, ssize_t len, long long pos)
 {
-  sb_aio_oper_t   *oper;
-  struct iocb     *iocbp;
+  sb_uring_context_t  *ctxt = &uring_ctxts[thread_id];
+  sb_uring_oper_t     *oper;
+  struct io_uring_sqe *sqe;
+  unsigned int        slot;
+  int                 rc;
+
+  /*
+    Wait for the thread's writes to the file to complete before fsync. Unlike
+    IOSQE_IO_DRAIN, this does not stall unrelated requests behind the fsync.
+  */
+  while (type == FILE_OP_TYPE_FSYNC && ctxt->nwrites[file_id] > 0)
+    if (file_uring_wait(thread_id, 1))
+      return 1;
 
-  oper = (sb_aio_oper_t *)malloc(sizeof(sb_aio_oper_t));
-  if (oper == NULL)
+  if (ctxt->nfree == 0 && file_uring_wait(thread_id, 1))
+    return 1;
+
+  sqe = sb_uring_get_sqe(&ctxt->ring);
+  if (sqe == NULL)
   {
-    log_text(LOG_FATAL, "Failed to allocate AIO operation!");
+    log_text(LOG_FATAL, "io_uring submission queue overflow!");
     return 1;
   }
 
-  memcpy(&oper->iocb, iocb, sizeof(*iocb));
+  slot = ctxt->free_slots[--ctxt->nfree];
+  oper = &ctxt->opers[slot];
   oper->type = type;
+  oper->file_id = file_id;
   oper->len = len;
-  iocbp = &oper->iocb;
+  oper->pos = pos;
+  oper->buf = buf;
 
-  if (io_submit(aio_ctxts[thread_id].io_ctxt, 1, &iocbp) < 1)
+  if (type == FILE_OP_TYPE_WRITE)
   {
-    log_errno(LOG_FATAL, "io_submit() failed!");
-    return 1;
+    ctxt->nwrites[file_id]++;
+    file_writes_start(file_id, pos, len);
   }
-  
-  aio_ctxts[thread_id].nrequests++;
-  if (aio_ctxts[thread_id].nrequests < file_async_backlog)
-    return 0;
-  
-  return file_wait(thread_id, 1);
-}
+  else if (type == FILE_OP_TYPE_READ)
+    oper->write_gen = file_writes_gen(file_id, pos, len, &oper->overlap);
 
+  switch (type) {
+    case FILE_OP_TYPE_READ:
+      sqe->opcode = file_uring_fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+      break;
+    case FILE_OP_TYPE_WRITE:
+      sqe->opcode = file_uring_fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+      break;
+    case FILE_OP_TYPE_FSYNC:
+      sqe->opcode = IORING_OP_FSYNC;
+      if (file_fsync_mode == FSYNC_DATA)
+        sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+      break;
+    default:
+      log_text(LOG_FATAL, "Unknown io_uring operation type: %d", type);
+      return 1;
+  }
 
-/*
-  Wait for at least nreq I/O requests to complete
-*/
+  if (file_uring_fixed)
+  {
+    sqe->fd = file_id;
+    sqe->flags |= IOSQE_FIXED_FILE;
+  }
+  else
+    sqe->fd = files[file_id];
 
+  if (type != FILE_OP_TYPE_FSYNC)
+  {
+    sqe->addr = (unsigned long) buf;
+    sqe->len = len;
+    sqe->off = pos;
+  }
+  sqe->user_data = slot;
 
-int file_wait(int thread_id, long nreq)
-{ 
-  long            i;
-  long            nr;
-  struct io_event *event;
-  sb_aio_oper_t   *oper;
-  struct iocb     *iocbp;
+  oper->start = sb_timer_now();
 
-  /* Try to read some events */
-#ifdef HAVE_OLD_GETEVENTS
-  (void)nreq; /* unused */
-  nr = io_getevents(aio_ctxts[thread_id].io_ctxt, file_async_backlog,
-                    aio_ctxts[thread_id].events, NULL);
-#else
-  nr = io_getevents(aio_ctxts[thread_id].io_ctxt, nreq, file_async_backlog,
-                    aio_ctxts[thread_id].events, NULL);
-#endif
-  if (nr < 1)
+  if ((rc = sb_uring_submit(&ctxt->ring, 0)) < 0)
   {
-    log_errno(LOG_FATAL, "io_getevents() failed!");
+    errno = -rc;
+    log_errno(LOG_FATAL, "io_uring_enter() failed!");
     return 1;
   }
 
-  /* Verify results */
-  for (i = 0; i < nr; i++)
+  /* Reap requests that have already completed, but do not wait */
+  return file_uring_wait(thread_id, 0);
+}
+
+
+/*
+  Process completed requests, waiting until at least nreq requests are
+  complete. Response times are recorded at this point.
+*/
+
+
+int file_uring_wait(int thread_id, unsigned int nreq)
+{
+  sb_uring_context_t  *ctxt = &uring_ctxts[thread_id];
+  sb_uring_oper_t     *oper;
+  struct io_uring_cqe *cqe;
+  unsigned int        slot;
+  unsigned int        nr = 0;
+  int                 res;
+  int                 rc;
+
+  while (ctxt->nfree < file_uring_depth)
   {
-    event = (struct io_event *)aio_ctxts[thread_id].events + i;
-    iocbp = (struct iocb *)(unsigned long)event->obj;
-    oper = (sb_aio_oper_t *)iocbp;
+    cqe = sb_uring_peek_cqe(&ctxt->ring);
+    if (cqe == NULL)
+    {
+      if (nr >= nreq)
+        break;
+
+      if ((rc = sb_uring_submit(&ctxt->ring, 1)) < 0)
+      {
+        errno = -rc;
+        log_errno(LOG_FATAL, "io_uring_enter() failed!");
+        return 1;
+      }
+      continue;
+    }
+
+    slot = (unsigned int) cqe->user_data;
+    res = cqe->res;
+    sb_uring_cqe_seen(&ctxt->ring);
+
+    /*
+      Return the slot before checking the result, so that file_thread_done()
+      does not wait for this request again after an error
+    */
+    oper = &ctxt->opers[slot];
+    ctxt->free_slots[ctxt->nfree++] = slot;
+    nr++;
+    if (oper->type == FILE_OP_TYPE_WRITE)
+    {
+      ctxt->nwrites[oper->file_id]--;
+      file_writes_complete(oper->file_id, oper->pos, oper->len);
+    }
+
     switch (oper->type) {
       case FILE_OP_TYPE_FSYNC:
-        if (event->res != 0)
+        if (res != 0)
         {
-          log_text(LOG_FATAL, "Asynchronous fsync failed!\n");
+          log_text(LOG_FATAL, "Asynchronous fsync failed: %s",
+                   strerror(-res));
           return 1;
         }
         break;
       case FILE_OP_TYPE_READ:
-        if ((ssize_t)event->res != oper->len)
+        if ((ssize_t) res != oper->len)
         {
-          log_text(LOG_FATAL, "Asynchronous read failed!\n");
+          log_text(LOG_FATAL, "Asynchronous read failed: %s",
+                   res < 0 ? strerror(-res) : "short read");
+          return 1;
+        }
+        SB_TRACE_SET_OP(oper->type);
+        log_event_complete(thread_id, oper->start);
+        /* Skip reads that may have seen a partially written block */
+        if (sb_globals.validate &&
+            !file_writes_overlap(oper->file_id, oper->pos, oper->len,
+                                 oper->write_gen, oper->overlap) &&
+            file_validate_buffer(oper->buf, oper->len, oper->pos))
+        {
+          log_text(LOG_FATAL,
+                   "Validation failed on block offset 0x%llx, exiting...",
+                   (unsigned long long) oper->pos);
           return 1;
         }
         break;
       case FILE_OP_TYPE_WRITE:
-        if ((ssize_t)event->res != oper->len)
+        if ((ssize_t) res != oper->len)
         {
-          log_text(LOG_FATAL, "Asynchronous write failed!\n");
+          log_text(LOG_FATAL, "Asynchronous write failed: %s",
+                   res < 0 ? strerror(-res) : "short write");
           return 1;
         }
+        SB_TRACE_SET_OP(oper->type);
+        log_event_complete(thread_id, oper->start);
         break;
       default:
         break;
     }
-    free(oper);
-    aio_ctxts[thread_id].nrequests--;
+    file_op_record(thread_id, oper->file_id, oper->type, oper->len,
+                   oper->start);
   }
-  
+
   return 0;
 }
-#endif /* HAVE_LIBAIO */
+#endif /* HAVE_IO_URING */
 
                         
 #ifdef HAVE_MMAP
@@ -1378,6 +2982,12 @@ int file_fsync(unsigned int file_id, int thread_id)
   (void)thread_id; /* unused */
 #endif
 
+#ifdef HAVE_IO_URING
+  if (file_io_mode == FILE_IO_MODE_IO_URING)
+    return file_uring_submit(thread_id, FILE_OP_TYPE_FSYNC, file_id, NULL, 0,
+                             0);
+#endif
+
   /*
     FIXME: asynchronous fsync support is missing
     in Linux kernel at the moment
@@ -1414,7 +3024,8 @@ int file_fsync(unsigned int file_id, int thread_id)
     else
       io_prep_fdsync(&iocb, fd);
 
-    return file_submit_or_wait(&iocb, FILE_OP_TYPE_FSYNC, 0, thread_id);
+    return file_submit_or_wait(&iocb, FILE_OP_TYPE_FSYNC, file_id, 0, 0, NULL,
+                               thread_id);
   }
 #endif
 #ifdef HAVE_MMAP
@@ -1552,13 +3163,24 @@ ssize_t file_pread(unsigned int file_id, void *buf, ssize_t count,
     
   if (file_io_mode == FILE_IO_MODE_SYNC)
     return pread(fd, buf, count, offset);
+#ifdef HAVE_IO_URING
+  else if (file_io_mode == FILE_IO_MODE_IO_URING)
+  {
+    if (file_uring_submit(thread_id, FILE_OP_TYPE_READ, file_id, buf, count,
+                          offset))
+      return 0;
+
+    return count;
+  }
+#endif
 #ifdef HAVE_LIBAIO
   else if (file_io_mode == FILE_IO_MODE_ASYNC)
   {
     /* Use asynchronous read */
     io_prep_pread(&iocb, fd, buf, count, offset);
 
-    if (file_submit_or_wait(&iocb, FILE_OP_TYPE_READ, count, thread_id))
+    if (file_submit_or_wait(&iocb, FILE_OP_TYPE_READ, file_id, count, offset,
+                            buf, thread_id))
       return 0;
 
     return count;
@@ -1575,7 +3197,7 @@ ssize_t file_pread(unsigned int file_id, void *buf, ssize_t count,
                  fd, page_addr);
     if (start == MAP_FAILED)
       return 0;
-    memcpy(buffer, (char *)start + page_offset, count);
+    memcpy(buf, (char *)start + page_offset, count);
     munmap(start, count + page_offset);
     return count;
 # else
@@ -1584,7 +3206,7 @@ ssize_t file_pread(unsigned int file_id, void *buf, ssize_t count,
     (void)page_offset; /* unused */
     
     /* We already have all files mapped on 64-bit platforms */
-    memcpy(buffer, (char *)mmaps[file_id] + offset, count);
+    memcpy(buf, (char *)mmaps[file_id] + offset, count);
 
     return count;
 # endif
@@ -1612,13 +3234,24 @@ ssize_t file_pwrite(unsigned int file_id, void *buf, ssize_t count,
   
   if (file_io_mode == FILE_IO_MODE_SYNC)
     return pwrite(fd, buf, count, offset);
+#ifdef HAVE_IO_URING
+  else if (file_io_mode == FILE_IO_MODE_IO_URING)
+  {
+    if (file_uring_submit(thread_id, FILE_OP_TYPE_WRITE, file_id, buf, count,
+                          offset))
+      return 0;
+
+    return count;
+  }
+#endif
 #ifdef HAVE_LIBAIO
   else if (file_io_mode == FILE_IO_MODE_ASYNC)
   {
     /* Use asynchronous write */
     io_prep_pwrite(&iocb, fd, buf, count, offset);
 
-    if (file_submit_or_wait(&iocb, FILE_OP_TYPE_WRITE, count, thread_id))
+    if (file_submit_or_wait(&iocb, FILE_OP_TYPE_WRITE, file_id, count, offset,
+                            buf, thread_id))
       return 0;
 
     return count;
@@ -1636,7 +3269,7 @@ ssize_t file_pwrite(unsigned int file_id, void *buf, ssize_t count,
 
     if (start == MAP_FAILED)
       return 0;
-    memcpy((char *)start + page_offset, buffer, count);
+    memcpy((char *)start + page_offset, buf, count);
     munmap(start, count + page_offset);
 
     return count;
@@ -1646,7 +3279,7 @@ ssize_t file_pwrite(unsigned int file_id, void *buf, ssize_t count,
     (void)page_offset; /* unused */
 
     /* We already have all files mapped on 64-bit platforms */
-    memcpy((char *)mmaps[file_id] + offset, buffer, count);
+    memcpy((char *)mmaps[file_id] + offset, buf, count);
 
     return count;
 # endif    
@@ -1723,6 +3356,16 @@ int parse_arguments(void)
     log_text(LOG_FATAL,
              "asynchronous I/O mode is unsupported on this platform.");
     return 1;
+#endif
+  }
+  else if (!strcmp(mode, "io_uring"))
+  {
+#ifdef HAVE_IO_URING
+    file_io_mode = FILE_IO_MODE_IO_URING;
+#else
+    log_text(LOG_FATAL,
+             "io_uring I/O mode is unsupported on this platform.");
+    return 1;
 #endif
   }
   else if (!strcmp(mode, "mmap"))
@@ -1762,6 +3405,50 @@ int parse_arguments(void)
   else
     file_max_request_size = file_block_size;
 
+  mode = sb_get_value_string("file-prepare-mode");
+  if (mode == NULL || !strcmp(mode, "write"))
+    file_prepare_mode = PREPARE_MODE_WRITE;
+  else if (!strcmp(mode, "fallocate"))
+  {
+#ifdef HAVE_POSIX_FALLOCATE
+    file_prepare_mode = PREPARE_MODE_FALLOCATE;
+#else
+    log_text(LOG_FATAL, "--file-prepare-mode=fallocate is not supported on "
+             "this platform");
+    return 1;
+#endif
+  }
+  else if (!strcmp(mode, "sparse"))
+    file_prepare_mode = PREPARE_MODE_SPARSE;
+  else
+  {
+    log_text(LOG_FATAL, "Invalid value for file-prepare-mode: %s", mode);
+    return 1;
+  }
+  if (sb_globals.command == SB_COMMAND_PREPARE && sb_globals.validate &&
+      file_prepare_mode != PREPARE_MODE_WRITE)
+  {
+    log_text(LOG_FATAL, "--validate requires --file-prepare-mode=write");
+    return 1;
+  }
+
+  if (sb_globals.validate)
+    crc32c_init();
+
+  if (parse_file_dirs())
+    return 1;
+
+  mode = sb_get_value_string("file-seq-streams");
+  if (mode == NULL || !strcmp(mode, "shared"))
+    file_seq_streams = SEQ_STREAMS_SHARED;
+  else if (!strcmp(mode, "per-thread"))
+    file_seq_streams = SEQ_STREAMS_PER_THREAD;
+  else
+  {
+    log_text(LOG_FATAL, "Invalid value for file-seq-streams: %s", mode);
+    return 1;
+  }
+
   mode = sb_get_value_string("file-extra-flags");
   if (mode == NULL || !strlen(mode))
     file_extra_flags = SB_FILE_FLAG_NORMAL;
@@ -1818,7 +3505,16 @@ int parse_arguments(void)
     return 1;
   }
 
-  buffer = sb_memalign(file_max_request_size);
+  file_rand_type = sb_get_value_string("file-rand-type");
+  file_rand_func = sb_rand_get_func(file_rand_type);
+  if (file_rand_func == NULL)
+  {
+    log_text(LOG_FATAL, "Invalid random IO offsets distribution: %s.", file_rand_type);
+    return 1;
+  }
+  file_rand_blocks = (int) (file_size * num_files / file_block_size);
+  if (file_rand_blocks < 1)
+    file_rand_blocks = 1;
 
   return 0;
 }
@@ -2002,22 +3698,102 @@ static FILE_DESCRIPTOR sb_open(const char *name)
 }
 
 
+/* splitmix64 output function, used to seed the fill generator */
+
+static inline unsigned long long splitmix64(unsigned long long z)
+{
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+
+#ifdef __GNUC__
+/*
+  Four xorshift128+ generators running in parallel, one per 64-bit lane of a
+  vector. The compiler maps vectors to SIMD registers where available.
+*/
+typedef unsigned long long sb_u64x4_t __attribute__((vector_size(32)));
+
+static inline void xorshift128plus_x4(sb_u64x4_t *s0, sb_u64x4_t *s1,
+                                      sb_u64x4_t *out)
+{
+  sb_u64x4_t a = *s0;
+  sb_u64x4_t b = *s1;
+
+  *s0 = b;
+  a ^= a << 23;
+  *s1 = a ^ b ^ (a >> 17) ^ (b >> 26);
+  *out = *s1 + b;
+}
+#endif
+
+
+/*
+  Fill buffer with pseudo-random bytes. The generator state is seeded from the
+  thread's generator for every buffer. Two independent sets of vector
+  generators are interleaved to hide the latency of each step.
+*/
+
+
+static void file_fill_random(unsigned char *buf, unsigned int len)
+{
+  const unsigned long long seed = sb_rand_u64();
+  unsigned int             i;
+#ifdef __GNUC__
+  sb_u64x4_t               s[4];
+  sb_u64x4_t               w0;
+  sb_u64x4_t               w1;
+  unsigned int             j, k;
+
+  for (k = 0; k < 4; k++)
+    for (j = 0; j < 4; j++)
+      s[k][j] = splitmix64(seed + (4 * k + j + 1) * SPLITMIX64_GAMMA);
+
+  for (i = 0; i + 2 * sizeof(w0) <= len; i += 2 * sizeof(w0))
+  {
+    xorshift128plus_x4(&s[0], &s[1], &w0);
+    xorshift128plus_x4(&s[2], &s[3], &w1);
+    memcpy(buf + i, &w0, sizeof(w0));
+    memcpy(buf + i + sizeof(w0), &w1, sizeof(w1));
+  }
+
+  while (i < len)
+  {
+    xorshift128plus_x4(&s[0], &s[1], &w0);
+    k = len - i < sizeof(w0) ? len - i : sizeof(w0);
+    memcpy(buf + i, &w0, k);
+    i += k;
+  }
+#else
+  unsigned long long       word;
+  unsigned int             n;
+
+  for (i = 0; i < len; i += n)
+  {
+    word = splitmix64(seed + (i / sizeof(word) + 1) * SPLITMIX64_GAMMA);
+    n = len - i < sizeof(word) ? len - i : sizeof(word);
+    memcpy(buf + i, &word, n);
+  }
+#endif
+}
+
+
 /* Fill buffer with random values and write checksum */
 
 
 void file_fill_buffer(unsigned char *buf, unsigned int len,
                       size_t offset)
 {
-  unsigned int i;
+  const unsigned int data_len = len -
+    (FILE_CHECKSUM_LENGTH + FILE_OFFSET_LENGTH);
 
-  for (i = 0; i < len - (FILE_CHECKSUM_LENGTH + FILE_OFFSET_LENGTH); i++)
-    buf[i] = sb_rnd() & 0xFF;
+  file_fill_random(buf, data_len);
 
   /* Store the checksum */
-  *(int *)(buf + i) = (int)crc32(0, (unsigned char *)buf, len -
-                                 (FILE_CHECKSUM_LENGTH + FILE_OFFSET_LENGTH));
+  *(int *)(buf + data_len) = (int)crc32c(0, buf, data_len);
   /* Store the offset */
-  *(long *)(buf + i + FILE_CHECKSUM_LENGTH) = offset;
+  *(long *)(buf + data_len + FILE_CHECKSUM_LENGTH) = offset;
 }
 
 
@@ -2031,7 +3807,7 @@ int file_validate_buffer(unsigned char  *buf, unsigned int len, size_t offset)
 
   cs_offset = len - (FILE_CHECKSUM_LENGTH + FILE_OFFSET_LENGTH);
   
-  checksum = (unsigned int)crc32(0, (unsigned char *)buf, cs_offset);
+  checksum = crc32c(0, buf, cs_offset);
 
   if (checksum != *(unsigned int *)(buf + cs_offset))
   {
@@ -2051,3 +3827,120 @@ int file_validate_buffer(unsigned char  *buf, unsigned int len, size_t offset)
 
   return 0;
 }
+
+
+/*
+  Allocate write tracking buckets if reads are validated on completion of
+  asynchronous requests, i.e. possibly concurrently with writes to the same
+  blocks from this or other threads
+*/
+
+
+int file_writes_init(void)
+{
+  if (!sb_globals.validate || (file_io_mode != FILE_IO_MODE_ASYNC &&
+                               file_io_mode != FILE_IO_MODE_IO_URING))
+    return 0;
+
+  file_block_writes = (file_block_writes_t *)
+    calloc(FILE_WRITE_BUCKETS, sizeof(file_block_writes_t));
+  if (file_block_writes == NULL)
+  {
+    log_text(LOG_FATAL, "Memory allocation failure.");
+    return 1;
+  }
+
+  return 0;
+}
+
+
+/* Get the write tracking bucket of a block */
+
+
+static inline file_block_writes_t *file_writes_bucket(unsigned int file_id,
+                                                      long long block)
+{
+  unsigned long long key = (unsigned long long) file_id *
+    (file_size / file_block_size) + block;
+
+  return &file_block_writes[key & (FILE_WRITE_BUCKETS - 1)];
+}
+
+
+/* Account a write submitted to blocks in [pos, pos + len) */
+
+
+void file_writes_start(unsigned int file_id, long long pos, ssize_t len)
+{
+  long long block;
+
+  if (file_block_writes == NULL)
+    return;
+
+  for (block = pos / file_block_size; block * file_block_size < pos + len;
+       block++)
+    sb_atomic_add_u64(&file_writes_bucket(file_id, block)->started, 1);
+}
+
+
+/* Account a completed write to blocks in [pos, pos + len) */
+
+
+void file_writes_complete(unsigned int file_id, long long pos, ssize_t len)
+{
+  long long block;
+
+  if (file_block_writes == NULL)
+    return;
+
+  for (block = pos / file_block_size; block * file_block_size < pos + len;
+       block++)
+    sb_atomic_add_u64(&file_writes_bucket(file_id, block)->completed, 1);
+}
+
+
+/*
+  Get the number of writes started to blocks in [pos, pos + len), set
+  '*busy' if any of them is still in flight
+*/
+
+
+unsigned long long file_writes_gen(unsigned int file_id, long long pos,
+                                   ssize_t len, int *busy)
+{
+  file_block_writes_t *bucket;
+  unsigned long long  gen = 0;
+  unsigned long long  started;
+  long long           block;
+
+  *busy = 0;
+  if (file_block_writes == NULL)
+    return 0;
+
+  for (block = pos / file_block_size; block * file_block_size < pos + len;
+       block++)
+  {
+    bucket = file_writes_bucket(file_id, block);
+    started = sb_atomic_load_u64(&bucket->started);
+    if (sb_atomic_load_u64(&bucket->completed) != started)
+      *busy = 1;
+    gen += started;
+  }
+
+  return gen;
+}
+
+
+/*
+  Check if a completed read of [pos, pos + len) could have raced with a
+  write, given the state returned by file_writes_gen() on its submission
+*/
+
+
+int file_writes_overlap(unsigned int file_id, long long pos, ssize_t len,
+                        unsigned long long gen, int busy)
+{
+  int now_busy;
+
+  return busy || file_writes_gen(file_id, pos, len, &now_busy) != gen;
+}
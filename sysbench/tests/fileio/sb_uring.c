@@ -0,0 +1,230 @@
+/* Copyright (C) 2011 Alexey Kopytov.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#ifdef HAVE_IO_URING
+
+#ifdef STDC_HEADERS
+# include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+# include <string.h>
+#endif
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif
+#ifdef HAVE_ERRNO_H
+# include <errno.h>
+#endif
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "sb_uring.h"
+
+/* System call wrappers, there is no glibc support for io_uring */
+
+static int sys_io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+  return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned int to_submit,
+                              unsigned int min_complete, unsigned int flags)
+{
+  return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                       flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned int opcode, const void *arg,
+                                 unsigned int nr_args)
+{
+  return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+
+int sb_uring_init(sb_uring_t *ring, unsigned int entries, int sqpoll)
+{
+  struct io_uring_params p;
+  char                   *sq;
+  char                   *cq;
+
+  memset(ring, 0, sizeof(*ring));
+  memset(&p, 0, sizeof(p));
+
+  if (sqpoll)
+    p.flags |= IORING_SETUP_SQPOLL;
+
+  ring->fd = sys_io_uring_setup(entries, &p);
+  if (ring->fd < 0)
+    return -errno;
+
+  ring->flags = p.flags;
+
+  ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+  ring->cq_ring_size = p.cq_off.cqes +
+    p.cq_entries * sizeof(struct io_uring_cqe);
+  ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+  ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+  ring->sqes = (struct io_uring_sqe *)
+    mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+         MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED ||
+      ring->sqes == MAP_FAILED)
+  {
+    int err = errno;
+    sb_uring_done(ring);
+    return -err;
+  }
+
+  sq = (char *) ring->sq_ring;
+  ring->sq_head = (unsigned int *) (sq + p.sq_off.head);
+  ring->sq_tail = (unsigned int *) (sq + p.sq_off.tail);
+  ring->sq_mask = (unsigned int *) (sq + p.sq_off.ring_mask);
+  ring->sq_entries = (unsigned int *) (sq + p.sq_off.ring_entries);
+  ring->sq_flags = (unsigned int *) (sq + p.sq_off.flags);
+  ring->sq_array = (unsigned int *) (sq + p.sq_off.array);
+  ring->sqe_tail = *ring->sq_tail;
+
+  cq = (char *) ring->cq_ring;
+  ring->cq_head = (unsigned int *) (cq + p.cq_off.head);
+  ring->cq_tail = (unsigned int *) (cq + p.cq_off.tail);
+  ring->cq_mask = (unsigned int *) (cq + p.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+
+  return 0;
+}
+
+
+void sb_uring_done(sb_uring_t *ring)
+{
+  if (ring->sqes != NULL && ring->sqes != MAP_FAILED)
+    munmap(ring->sqes, ring->sqes_size);
+  if (ring->cq_ring != NULL && ring->cq_ring != MAP_FAILED)
+    munmap(ring->cq_ring, ring->cq_ring_size);
+  if (ring->sq_ring != NULL && ring->sq_ring != MAP_FAILED)
+    munmap(ring->sq_ring, ring->sq_ring_size);
+  if (ring->fd >= 0)
+    close(ring->fd);
+
+  memset(ring, 0, sizeof(*ring));
+  ring->fd = -1;
+}
+
+
+int sb_uring_register_files(sb_uring_t *ring, const int *fds,
+                            unsigned int nfds)
+{
+  if (sys_io_uring_register(ring->fd, IORING_REGISTER_FILES, fds, nfds) < 0)
+    return -errno;
+
+  return 0;
+}
+
+
+int sb_uring_register_buffers(sb_uring_t *ring, const struct iovec *iovs,
+                              unsigned int niovs)
+{
+  if (sys_io_uring_register(ring->fd, IORING_REGISTER_BUFFERS, iovs, niovs) < 0)
+    return -errno;
+
+  return 0;
+}
+
+
+struct io_uring_sqe *sb_uring_get_sqe(sb_uring_t *ring)
+{
+  unsigned int        head;
+  unsigned int        idx;
+  struct io_uring_sqe *sqe;
+
+  head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+  if (ring->sqe_tail - head >= *ring->sq_entries)
+    return NULL;
+
+  idx = ring->sqe_tail & *ring->sq_mask;
+  ring->sq_array[idx] = idx;
+  ring->sqe_tail++;
+
+  sqe = &ring->sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+
+  return sqe;
+}
+
+
+int sb_uring_submit(sb_uring_t *ring, unsigned int wait_nr)
+{
+  unsigned int to_submit;
+  unsigned int flags = 0;
+  int          rc;
+
+  /* Make new entries visible to the kernel */
+  __atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+
+  if (ring->flags & IORING_SETUP_SQPOLL)
+  {
+    /* Entries are picked up by the kernel thread, unless it is sleeping */
+    to_submit = 0;
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(ring->sq_flags, __ATOMIC_RELAXED) &
+        IORING_SQ_NEED_WAKEUP)
+      flags |= IORING_ENTER_SQ_WAKEUP;
+  }
+  else
+    to_submit = ring->sqe_tail - __atomic_load_n(ring->sq_head,
+                                                 __ATOMIC_ACQUIRE);
+
+  if (wait_nr > 0)
+    flags |= IORING_ENTER_GETEVENTS;
+
+  if (to_submit == 0 && flags == 0)
+    return 0;
+
+  do
+  {
+    rc = sys_io_uring_enter(ring->fd, to_submit, wait_nr, flags);
+  } while (rc < 0 && errno == EINTR);
+
+  return rc < 0 ? -errno : 0;
+}
+
+
+struct io_uring_cqe *sb_uring_peek_cqe(sb_uring_t *ring)
+{
+  unsigned int head;
+
+  head = *ring->cq_head;
+  if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+    return NULL;
+
+  return &ring->cqes[head & *ring->cq_mask];
+}
+
+
+void sb_uring_cqe_seen(sb_uring_t *ring)
+{
+  __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+#endif /* HAVE_IO_URING */
@@ -0,0 +1,96 @@
+/* Copyright (C) 2011 Alexey Kopytov.
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef SB_URING_H
+#define SB_URING_H
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#ifdef HAVE_IO_URING
+
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+/*
+  Minimal wrapper over the Linux io_uring interface. Only the subset required
+  by the fileio test is implemented. Each ring must only be used by a single
+  thread.
+*/
+
+typedef struct
+{
+  int                 fd;          /* ring file descriptor */
+  unsigned int        flags;       /* setup flags */
+
+  /* Submission queue */
+  unsigned int        *sq_head;
+  unsigned int        *sq_tail;
+  unsigned int        *sq_mask;
+  unsigned int        *sq_entries;
+  unsigned int        *sq_flags;
+  unsigned int        *sq_array;
+  struct io_uring_sqe *sqes;
+  unsigned int        sqe_tail;    /* next SQE to be allocated */
+
+  /* Completion queue */
+  unsigned int        *cq_head;
+  unsigned int        *cq_tail;
+  unsigned int        *cq_mask;
+  struct io_uring_cqe *cqes;
+
+  /* Mappings */
+  void                *sq_ring;
+  size_t              sq_ring_size;
+  void                *cq_ring;
+  size_t              cq_ring_size;
+  size_t              sqes_size;
+} sb_uring_t;
+
+/* Create a ring with the specified number of entries */
+int sb_uring_init(sb_uring_t *ring, unsigned int entries, int sqpoll);
+
+/* Destroy a ring */
+void sb_uring_done(sb_uring_t *ring);
+
+/* Register an array of file descriptors to be used as fixed files */
+int sb_uring_register_files(sb_uring_t *ring, const int *fds,
+                            unsigned int nfds);
+
+/* Register an array of buffers to be used with *_FIXED operations */
+int sb_uring_register_buffers(sb_uring_t *ring, const struct iovec *iovs,
+                              unsigned int niovs);
+
+/* Get a zeroed submission queue entry, or NULL if the queue is full */
+struct io_uring_sqe *sb_uring_get_sqe(sb_uring_t *ring);
+
+/*
+  Submit all queued entries and wait for at least 'wait_nr' completions.
+  Returns 0 on success, or a negative errno value on failure.
+*/
+int sb_uring_submit(sb_uring_t *ring, unsigned int wait_nr);
+
+/* Get the next completion queue entry without waiting, or NULL if none */
+struct io_uring_cqe *sb_uring_peek_cqe(sb_uring_t *ring);
+
+/* Mark the completion entry returned by sb_uring_peek_cqe() as consumed */
+void sb_uring_cqe_seen(sb_uring_t *ring);
+
+#endif /* HAVE_IO_URING */
+
+#endif /* SB_URING_H */
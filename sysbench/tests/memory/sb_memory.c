@@ -23,6 +23,7 @@
 #endif
 
 #include "sysbench.h"
+#include "sb_output.h"
 
 #ifdef HAVE_SYS_IPC_H
 # include <sys/ipc.h>
@@ -54,10 +55,13 @@ static sb_arg_t memory_args[] =
 
 /* Memory test operations */
 static int memory_init(void);
+static int memory_thread_init(int);
 static void memory_print_mode(void);
-static sb_request_t memory_get_request(void);
+static sb_request_t memory_get_request(int);
 static int memory_execute_request(sb_request_t *, int);
 static void memory_print_stats(sb_stat_t type);
+static int memory_done(void);
+static void memory_reset_stats(void);
 
 static sb_test_t memory_test =
 {
@@ -66,14 +70,15 @@ static sb_test_t memory_test =
   {
     memory_init,
     NULL,
-    NULL,
+    memory_thread_init,
     memory_print_mode,
     memory_get_request,
     memory_execute_request,
     memory_print_stats,
     NULL,
     NULL,
-    NULL
+    memory_done,
+    memory_reset_stats
   },
   {
     NULL,
@@ -97,9 +102,7 @@ static unsigned int memory_hugetlb;
 #endif
 
 /* Statistics */
-static unsigned int total_ops;
-static long long    total_bytes;
-static long long    last_bytes;
+static unsigned long long last_bytes;
 
 /* Array of per-thread buffers */
 static int **buffers;
@@ -118,18 +121,59 @@ int register_test_memory(sb_list_t *tests)
 }
 
 
-int memory_init(void)
+void memory_reset_stats(void)
+{
+  last_bytes = 0;
+}
+
+
+int memory_done(void)
 {
   unsigned int i;
+
+#ifdef HAVE_LARGE_PAGES
+  /* HugeTLB segments are released on exit */
+  if (memory_hugetlb)
+    return 0;
+#endif
+
+  if (memory_scope == SB_MEM_SCOPE_GLOBAL)
+  {
+    free(buffer);
+    buffer = NULL;
+  }
+  else
+  {
+    for (i = 0; i < sb_globals.num_threads; i++)
+      free(buffers[i]);
+    free(buffers);
+    buffers = NULL;
+  }
+
+  return 0;
+}
+
+
+int memory_init(void)
+{
   char         *s;
   
   memory_block_size = sb_get_value_size("memory-block-size");
+  if (memory_block_size <= 0)
+  {
+    log_text(LOG_FATAL, "Invalid value for memory-block-size: %ld",
+             (long)memory_block_size);
+    return 1;
+  }
   if (memory_block_size % sizeof(int) != 0)
   {
     log_text(LOG_FATAL, "memory-block-size must be a multiple of %ld!", (long)sizeof(int));
     return 1;
   }
   memory_total_size = sb_get_value_size("memory-total-size");
+  /* The test is limited by the total size rather than --max-requests */
+  sb_set_request_limit((memory_total_size + memory_block_size - 1) /
+                       memory_block_size);
   
   s = sb_get_value_string("memory-scope");
   if (!strcmp(s, "global"))
@@ -188,49 +232,58 @@ int memory_init(void)
   }
   else
   {
-    buffers = (int **)malloc(sb_globals.num_threads * sizeof(char *));
+    /* Per-thread buffers are allocated by threads in memory_thread_init() */
+    buffers = (int **)calloc(sb_globals.num_threads, sizeof(char *));
     if (buffers == NULL)
     {
       log_text(LOG_FATAL, "Failed to allocate buffers array!");
       return 1;
     }
-    for (i = 0; i < sb_globals.num_threads; i++)
-    {
+  }
+  
+  return 0;
+}
+
+
+/*
+  Allocate and touch the thread's buffer from the thread itself, so that it
+  is placed according to the thread's CPU affinity and NUMA policy
+*/
+
+int memory_thread_init(int thread_id)
+{
+  if (memory_scope != SB_MEM_SCOPE_LOCAL)
+    return 0;
+
 #ifdef HAVE_LARGE_PAGES
-      if (memory_hugetlb)
-        buffers[i] = (int *)hugetlb_alloc(memory_block_size);
-      else
+  if (memory_hugetlb)
+    buffers[thread_id] = (int *)hugetlb_alloc(memory_block_size);
+  else
 #endif
-      buffers[i] = (int *)malloc(memory_block_size);
-      if (buffers[i] == NULL)
-      {
-        log_text(LOG_FATAL, "Failed to allocate buffer for thread #%d!", i);
-        return 1;
-      }
-
-      memset(buffers[i], 0, memory_block_size);
-    }
+  buffers[thread_id] = (int *)malloc(memory_block_size);
+  if (buffers[thread_id] == NULL)
+  {
+    log_text(LOG_FATAL, "Failed to allocate buffer for thread #%d!",
+             thread_id);
+    return 1;
   }
-  
+
+  memset(buffers[thread_id], 0, memory_block_size);
+
   return 0;
 }
 
 
-sb_request_t memory_get_request(void)
+sb_request_t memory_get_request(int thread_id)
 {
   sb_request_t      req;
   sb_mem_request_t  *mem_req = &req.u.mem_request;
   
-  SB_THREAD_MUTEX_LOCK();
-  if (total_bytes >= memory_total_size)
+  if (!sb_more_requests(thread_id))
   {
     req.type = SB_REQ_TYPE_NULL;
-    SB_THREAD_MUTEX_UNLOCK();
     return req;
   }
-  total_ops++;
-  total_bytes += memory_block_size;
-  SB_THREAD_MUTEX_UNLOCK();
 
   req.type = SB_REQ_TYPE_MEMORY;
   mem_req->block_size = memory_block_size;
@@ -313,6 +366,9 @@ int memory_execute_request(sb_request_t *sb_req, int thread_id)
   
   LOG_EVENT_STOP(msg, thread_id);
 
+  sb_counter_add(thread_id, mem_req->type == SB_MEM_OP_READ ?
+                 SB_CNT_BYTES_READ : SB_CNT_BYTES_WRITTEN, memory_block_size);
+
   return 0;
 }
 
@@ -360,17 +416,30 @@ void memory_print_mode(void)
 
 void memory_print_stats(sb_stat_t type)
 {
-  double       seconds;
-  const double megabyte = 1024.0 * 1024.0;
+  double             seconds;
+  const double       megabyte = 1024.0 * 1024.0;
+  unsigned long long total_ops;
+  unsigned long long total_bytes;
+  sb_output_record_t rec;
 
   switch (type) {
   case SB_STAT_INTERMEDIATE:
     SB_THREAD_MUTEX_LOCK();
     seconds = NS2SEC(sb_timer_split(&sb_globals.exec_timer));
+    total_bytes = sb_counter_value(SB_CNT_BYTES_READ) +
+      sb_counter_value(SB_CNT_BYTES_WRITTEN);
 
     log_timestamp(LOG_NOTICE, &sb_globals.exec_timer,
                   "%4.2f MB/sec,",
                   (double)(total_bytes - last_bytes) / megabyte / seconds);
+    if (SB_OUTPUT_ENABLED())
+    {
+      sb_output_begin(&rec, type, "memory");
+      sb_output_add(&rec, "threads", sb_globals.num_threads);
+      sb_output_add(&rec, "mb_per_sec",
+                    (double)(total_bytes - last_bytes) / megabyte / seconds);
+      sb_output_write(&rec);
+    }
     last_bytes = total_bytes;
     SB_THREAD_MUTEX_UNLOCK();
 
@@ -378,15 +447,27 @@ void memory_print_stats(sb_stat_t type)
 
   case SB_STAT_CUMULATIVE:
     seconds = NS2SEC(sb_timer_split(&sb_globals.cumulative_timer1));
+    total_ops = sb_counter_value(SB_CNT_EVENTS);
+    total_bytes = sb_counter_value(SB_CNT_BYTES_READ) +
+      sb_counter_value(SB_CNT_BYTES_WRITTEN);
 
-    log_text(LOG_NOTICE, "Operations performed: %d (%8.2f ops/sec)\n",
+    log_text(LOG_NOTICE, "Operations performed: %llu (%8.2f ops/sec)\n",
              total_ops, total_ops / seconds);
     if (memory_oper != SB_MEM_OP_NONE)
       log_text(LOG_NOTICE, "%4.2f MB transferred (%4.2f MB/sec)\n",
                total_bytes / megabyte,
                total_bytes / megabyte / seconds);
-    total_ops = 0;
-    total_bytes = 0;
+    if (SB_OUTPUT_ENABLED())
+    {
+      sb_output_begin(&rec, type, "memory");
+      sb_output_add(&rec, "operations", total_ops);
+      sb_output_add(&rec, "ops_per_sec", total_ops / seconds);
+      sb_output_add(&rec, "transferred_mb", total_bytes / megabyte);
+      sb_output_add(&rec, "mb_per_sec", total_bytes / megabyte / seconds);
+      sb_output_write(&rec);
+    }
+    sb_counters_reset();
+    last_bytes = 0;
     /*
       So that intermediate stats are calculated from the current moment
       rather than from the previous intermediate report
@@ -53,7 +53,7 @@ static sb_arg_t threads_args[] =
 static int threads_init(void);
 static int threads_prepare(void);
 static void threads_print_mode(void);
-static sb_request_t threads_get_request(void);
+static sb_request_t threads_get_request(int);
 static int threads_execute_request(sb_request_t *, int);
 static int threads_cleanup(void);
 
@@ -72,6 +72,7 @@ static sb_test_t threads_test =
     NULL,
     NULL,
     threads_cleanup,
+    NULL
   },
   {
     NULL,
@@ -86,7 +87,6 @@ static sb_test_t threads_test =
 static unsigned int thread_yields;
 static unsigned int thread_locks;
 static pthread_mutex_t *test_mutexes;
-static unsigned int req_performed;
 
 
 int register_test_threads(sb_list_t *tests)
@@ -101,7 +101,6 @@ int threads_init(void)
 {
   thread_yields = sb_get_value_int("thread-yields");
   thread_locks = sb_get_value_int("thread-locks");
-  req_performed = 0;
   
   return 0;
 }
@@ -138,23 +137,21 @@ int threads_cleanup(void)
 }
 
 
-sb_request_t threads_get_request(void)
+sb_request_t threads_get_request(int thread_id)
 {
   sb_request_t         sb_req;
   sb_threads_request_t *threads_req = &sb_req.u.threads_request;
 
-  SB_THREAD_MUTEX_LOCK();
-  if (req_performed >= sb_globals.max_requests)
+  if (!sb_more_requests(thread_id))
   {
     sb_req.type = SB_REQ_TYPE_NULL;
-    SB_THREAD_MUTEX_UNLOCK();
     return sb_req;
   }
   
   sb_req.type = SB_REQ_TYPE_THREADS;
-  threads_req->lock_num = req_performed % thread_locks; 
-  req_performed++;
-  SB_THREAD_MUTEX_UNLOCK();
+  /* Cycle through locks, starting from a different lock in each thread */
+  threads_req->lock_num = (thread_id + sb_thread_requests(thread_id)) %
+    thread_locks;
 
   return sb_req;
 }